@@ -9,10 +9,22 @@ const char* HttpConn::srcDir;           // 资源的目录
 std::atomic<int> HttpConn::userCount;   // 总共的客户端的连接数
 bool HttpConn::isET;
 
+namespace {
+struct ConnMetrics {                    // 请求路径上的指标，InitMetrics之前为空
+    Metrics::Counter* requests[6];      // 按状态码分类，下标0是其他
+    Metrics::Histogram* duration;
+    Metrics::Counter* bytes;
+};
+ConnMetrics* connMetrics = nullptr;
+}
+
 HttpConn::HttpConn() { 
     fd_ = -1;
     addr_ = { 0 };
     isClose_ = true;
+    generation_ = 0;
+    reqStartUs_ = 0;
+    respBytes_ = 0;
 };
 
 HttpConn::~HttpConn() { 
@@ -24,6 +36,7 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     userCount++;
     addr_ = addr;
     fd_ = fd;
+    generation_++;
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
     isClose_ = false;
@@ -31,6 +44,8 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
 }
 
 void HttpConn::Close() {
+    if(reqStartUs_ && respBytes_) { FinishRequest_(respBytes_ - ToWriteBytes()); }   // 响应没发完连接就关了
+    reqStartUs_ = 0;
     response_.UnmapFile();
     if(isClose_ == false){
         isClose_ = true; 
@@ -90,6 +105,7 @@ ssize_t HttpConn::write(int* saveErrno) {
             writeBuff_.Retrieve(len);
         }
     } while(isET || ToWriteBytes() > 10240);
+    if(reqStartUs_ && ToWriteBytes() == 0) { FinishRequest_(respBytes_); }
     return len;
 }
 
@@ -99,13 +115,50 @@ bool HttpConn::process() {
     if(readBuff_.ReadableBytes() <= 0) {
         return false;
     }
-    else if(request_.parse(readBuff_)) {
+    respBytes_ = 0;
+    if(AccessLog::Enabled() || connMetrics) { reqStartUs_ = AccessLog::NowUs(); }
+    if(request_.parse(readBuff_)) {
         LOG_DEBUG("%s", request_.path().c_str());
+        if(request_.IsVerifyPending()) {
+            return false;               // 登录注册交给数据库线程池，验证完再生成响应
+        }
         response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+        if(Metrics::Enabled() && request_.path() == Metrics::PATH && request_.method() == "GET"
+           && Metrics::Allowed(addr_.sin_addr.s_addr)) {
+            response_.SetBody(Metrics::Instance()->Render(), Metrics::CONTENT_TYPE);
+        }
     } else {
         response_.Init(srcDir, request_.path(), false, 400);
     }
+    PrepareResponse_();
+    return true;
+}
+
+// 数据库线程中执行，验证用户后生成响应
+void HttpConn::FinishVerify(bool verify) {
+    if(verify) { request_.Verify(); }
+    else { request_.SkipVerify(); }
+    response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+    PrepareResponse_();
+}
+
+// 用异步连接池验证用户，回调在事件循环线程中生成响应
+void HttpConn::VerifyAsync(AsyncSqlPool& sqlPool, std::function<void()> done) {
+    uint64_t generation = generation_;
+    request_.VerifyAsync(sqlPool, [this, generation, done](bool ok) {
+        if(isClose_ || generation != generation_) {
+            LOG_WARN("Client[%d] gone before verify finished, result dropped", fd_);
+            return;
+        }
+        request_.SetVerifyResult(ok);
+        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+        PrepareResponse_();
+        done();
+    });
+}
 
+// 向写缓冲区写入响应报文，将资源映射内存中，设置分散写数组
+void HttpConn::PrepareResponse_() {
     response_.MakeResponse(writeBuff_);
     /* 响应头 */
     iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
@@ -118,6 +171,45 @@ bool HttpConn::process() {
         iov_[1].iov_len = response_.FileLen();
         iovCnt_ = 2;
     }
+    respBytes_ = ToWriteBytes();
     LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
+}
+
+void HttpConn::InitMetrics(Metrics* metrics) {
+    static ConnMetrics m;
+    static const char* CODES[] = { "other", "1xx", "2xx", "3xx", "4xx", "5xx" };
+    for(int i = 0; i < 6; i++) {
+        m.requests[i] = metrics->AddCounter("webserver_http_requests_total", "HTTP requests by status class.",
+                                            string("code=\"") + CODES[i] + "\"");
+    }
+    m.duration = metrics->AddHistogram("webserver_http_request_duration_seconds",
+                                       "Time from parsing a request to its last response byte.",
+                                       { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+                                         0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 });
+    m.bytes = metrics->AddCounter("webserver_http_response_bytes_total", "Response bytes written to clients.");
+    metrics->AddGauge("webserver_connections_active", "Open client connections.",
+                      [] { return static_cast<double>(userCount.load(memory_order_relaxed)); });
+    connMetrics = &m;
+}
+
+// 访问日志按状态码采样，留下来的才去取请求信息
+void HttpConn::FinishRequest_(size_t bytes) {
+    int64_t startUs = reqStartUs_;
+    reqStartUs_ = 0;
+    int code = response_.Code();
+    if(connMetrics) {
+        connMetrics->requests[code >= 100 && code < 600 ? code / 100 : 0]->Inc();
+        connMetrics->duration->Observe((AccessLog::NowUs() - startUs) / 1e6);
+        connMetrics->bytes->Inc(bytes);
+    }
+    if(!AccessLog::Enabled()) { return; }
+    AccessLog* log = AccessLog::Instance();
+    if(!log->Sample(code)) { return; }
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr_.sin_addr, ip, sizeof(ip));
+    std::string method = request_.method(), version = request_.version();
+    AccessLog::Entry entry = { ip, method.c_str(), request_.path().c_str(), version.c_str(),
+                               request_.GetHeader("Referer"), request_.GetHeader("User-Agent"),
+                               code, bytes, AccessLog::NowUs() - startUs };
+    log->Write(entry);
 }
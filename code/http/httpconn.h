@@ -12,6 +12,7 @@
 #include <errno.h>      
 
 #include "../log/log.h"
+#include "../log/accesslog.h"
 #include "../pool/sqlconnRAII.h"
 #include "../buffer/buffer.h"
 #include "httprequest.h"
@@ -33,6 +34,8 @@ public:
 
     int GetFd() const;                                  // 得到通信文件描述符
 
+    bool IsClose() const { return isClose_; }           // 连接是否已关闭
+
     int GetPort() const;                                // 得到客户端的端口
 
     const char* GetIP() const;                          // 到客户端的ip地址
@@ -41,6 +44,14 @@ public:
     
     bool process();                                     // 业务处理（解析请求，返回响应）
 
+    bool IsVerifyPending() const {                      // 请求需要查数据库，还没生成响应
+        return request_.IsVerifyPending();
+    }
+
+    void FinishVerify(bool verify = true);              // 数据库线程中验证用户(verify为假时按失败处理)，然后生成响应
+    // 异步验证，生成响应后在事件循环线程中调用done。结果回来时连接已经关闭或换成了新客户端(fd复用)就丢掉结果，不调用done
+    void VerifyAsync(AsyncSqlPool& sqlPool, std::function<void()> done);
+
     // 分散写块中还需要写的的字节长度
     int ToWriteBytes() {                                
         return iov_[0].iov_len + iov_[1].iov_len;
@@ -53,9 +64,13 @@ public:
     static bool isET;                                   // 是否是ET模式
     static const char* srcDir;                          // 资源的目录
     static std::atomic<int> userCount;                  // 总共的客户端的连接数
+
+    static void InitMetrics(Metrics* metrics);          // 注册请求数、耗时、发送字节数和连接数的指标，之后开始统计
     
 private:
-   
+    void PrepareResponse_();                            // 向写缓冲区写入响应报文，设置分散写数组
+    void FinishRequest_(size_t bytes);                  // 请求结束，更新指标、写一行访问日志
+
     int fd_;                                            // 与客户端通信的描述符
     struct  sockaddr_in addr_;                          // 客户端的地址信息
 
@@ -69,6 +84,11 @@ private:
 
     HttpRequest request_;                               // 请求对象
     HttpResponse response_;                             // 响应对象
+
+    uint64_t generation_;                               // 每次init加一，异步回调用它判断连接有没有换人，只在事件循环线程写
+
+    int64_t reqStartUs_;                                // 开始处理当前请求的时间，0表示访问日志和指标都没开启
+    size_t respBytes_;                                  // 当前响应的总字节数，0表示还没生成响应
 };
 
 #endif //HTTP_CONN_H
\ No newline at end of file
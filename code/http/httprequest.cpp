@@ -14,9 +14,15 @@ const unordered_set<string> HttpRequest::DEFAULT_HTML{
 const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
             {"/register.html", 0}, {"/login.html", 1},  };
 
+bool HttpRequest::deferVerify = false;
+UserStore* HttpRequest::userStore = nullptr;
+bool HttpRequest::uniqueNames = false;
+
 void HttpRequest::Init() {
     method_ = path_ = version_ = body_ = "";
     state_ = REQUEST_LINE;
+    verifyPending_ = false;
+    isLogin_ = false;
     header_.clear();
     post_.clear();
 }
@@ -127,13 +133,9 @@ void HttpRequest::ParsePost_() {
             int tag = DEFAULT_HTML_TAG.find(path_)->second;
             LOG_DEBUG("Tag:%d", tag);
             if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
-                    path_ = "/error.html";
-                }
+                isLogin_ = (tag == 1);
+                verifyPending_ = true;
+                if(!deferVerify) { Verify(); }      // 没有数据库线程池时在当前线程直接查
             }
         }
     }   
@@ -181,66 +183,164 @@ void HttpRequest::ParseFromUrlencoded_() {
     }
 }
 
+// 查数据库验证用户，决定返回的页面
+void HttpRequest::Verify() {
+    assert(verifyPending_);
+    SetVerifyResult(UserVerify(post_["username"], post_["password"], isLogin_));
+}
+
+// 用异步连接池验证，回调在事件循环线程中执行
+void HttpRequest::VerifyAsync(AsyncSqlPool& sqlPool, std::function<void(bool)> done) {
+    assert(verifyPending_);
+    AsyncUserVerify(sqlPool, post_["username"], post_["password"], isLogin_, std::move(done));
+}
+
+void HttpRequest::SetVerifyResult(bool ok) {
+    verifyPending_ = false;
+    if(ok) {
+        path_ = "/welcome.html";
+    } 
+    else {
+        path_ = "/error.html";
+    }
+}
+
+// 数据库线程池满，直接按验证失败处理
+void HttpRequest::SkipVerify() {
+    verifyPending_ = false;
+    path_ = "/error.html";
+}
+
+// 先查凭据缓存，能确定结果时返回true并通过result带回；
+// 注册且缓存或用户名过滤器确定用户不存在时skipSelect为真，直接插入，重复的用户名靠唯一索引挡住
+bool HttpRequest::CachedVerify_(const string& name, const string& pwd, bool isLogin, bool* result, bool* skipSelect) {
+    *skipSelect = false;
+    switch(UserCache::Instance()->Check(name, pwd)) {
+    case UserCache::MATCH:
+        *result = isLogin;
+        if(!isLogin) { LOG_DEBUG("user used!"); }
+        return true;
+    case UserCache::MISMATCH:
+        *result = false;
+        LOG_DEBUG("%s", isLogin ? "pwd error!" : "user used!");
+        return true;
+    case UserCache::UNKNOWN_USER:
+        if(isLogin) {
+            *result = false;
+            LOG_DEBUG("pwd error!");
+            return true;
+        }
+        *skipSelect = uniqueNames;
+        return false;
+    default:
+        *skipSelect = !isLogin && uniqueNames && UserFilter::Instance()->IsNameFree(name);
+        return false;
+    }
+}
+
+// 插入结果回写缓存：成功时缓存新用户并加入用户名过滤器，失败时作废可能过时的负缓存
+void HttpRequest::CacheInsert_(const string& name, const string& pwd, bool ok) {
+    if(ok) {
+        UserCache::Instance()->Put(name, pwd);
+        UserFilter::Instance()->Add(name);
+    } else {
+        LOG_DEBUG("Insert error!");
+        UserCache::Instance()->Invalidate(name);
+    }
+}
+
 bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
     if(name == "" || pwd == "") { return false; }
     LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-    MYSQL* sql;                         // 创建一个mysql句柄，它的值是下一行代码里从连接池取得一个数据库连接得到的
-    SqlConnRAII(&sql,  SqlConnPool::Instance());    
-    assert(sql);                        // 如果断言没问题，那么我们获得一个已经连接的数据库句柄
-    
-    bool flag = false;                  // 用来做登陆还是注册的逻辑判断，且最终作为返回值表示是否登陆或者注册成功
-    unsigned int j = 0;
-    char order[256] = { 0 };            // 保存sql语句
-    MYSQL_FIELD* fields = nullptr;      // 字段结构的数组，MYSQL_FIELD中包含了字段名、字段类型和大小等信息
-    MYSQL_RES* res = nullptr;           // MYSQL_RES结构体中包含了查询结果集，也就是从数据库中查询到的数据
-    
-    if(!isLogin) { flag = true; }
-    /* 查询用户及密码 */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
-    LOG_DEBUG("%s", order);
-
-    if(mysql_query(sql, order)) {       // 如果查询成功，返回0。如果出现错误，返回非0值
-        mysql_free_result(res);         // 释放结果集使用的内存
-        return false;
-    }
-    res = mysql_store_result(sql);      // 检索完整的结果集至客户端
-    j = mysql_num_fields(res);          // 返回结果集中的行数
-    fields = mysql_fetch_fields(res);   // 返回所有字段结构的数组，对于结果集，返回所有MYSQL_FIELD结构的数组。每个结构提供了结果集中1列的字段定义
-                                        // MYSQL_ROW,这是1行数据的“类型安全”表示
-    while(MYSQL_ROW row = mysql_fetch_row(res)) {   // 检索结果集的下一行，返回下一行的MYSQL_ROW结构。如果没有更多要检索的行或出现了错误，返回NULL
-        LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]); 
-        string password(row[1]);
-        /* 登陆行为*/
+    bool flag = false;
+    bool skipSelect = false;
+    if(CachedVerify_(name, pwd, isLogin, &flag, &skipSelect)) { return flag; }
+
+    if(!userStore) { return false; }
+
+    if(!skipSelect) {
+        /* 查询用户的密码 */
+        string password;
+        UserStore::RESULT res = userStore->Lookup(name, &password);
+        if(res == UserStore::FAILED) { return false; }
+        bool found = (res == UserStore::OK);
+        if(found) { UserCache::Instance()->Put(name, password); }
+        else { UserCache::Instance()->PutUnknown(name); }
+
+        /* 登陆行为 */
         if(isLogin) {
-            if(pwd == password) { flag = true;}
-            else {
-                flag = false;
-                LOG_DEBUG("pwd error!");
-            }
-        } 
+            flag = found && pwd == password;
+            if(!flag) { LOG_DEBUG("pwd error!"); }
+            return flag;
+        }
         // 这代表需要注册，但是数据库有该用户名，需要换
-        else {  
-            flag = false; 
+        if(found) {
             LOG_DEBUG("user used!");
+            return false;
         }
     }
-    mysql_free_result(res);
+    /* 注册行为 且 用户名未被使用 */
+    LOG_DEBUG("regirster!");
+    UserStore::RESULT res = userStore->Insert(name, pwd);
+    if(res == UserStore::EXISTS) { LOG_DEBUG("user used!"); }
+    flag = (res == UserStore::OK);
+    CacheInsert_(name, pwd, flag);
+    if(flag) { LOG_DEBUG("UserVerify success!!"); }
+    return flag;
+}
 
-    /* 注册行为 且 用户名未被使用*/
-    if(!isLogin && flag == true) {
+// 和UserVerify逻辑相同，查询通过异步连接池发出，不阻塞调用线程
+void HttpRequest::AsyncUserVerify(AsyncSqlPool& sqlPool, const string& name, const string& pwd,
+                                  bool isLogin, std::function<void(bool)> done) {
+    if(name == "" || pwd == "") {
+        done(false);
+        return;
+    }
+    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+    bool flag = false;
+    bool skipSelect = false;
+    if(CachedVerify_(name, pwd, isLogin, &flag, &skipSelect)) {
+        done(flag);
+        return;
+    }
+    auto insert = [&sqlPool, name, pwd, done] {
+        /* 注册行为 且 用户名未被使用 */
         LOG_DEBUG("regirster!");
-        bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-        LOG_DEBUG( "%s", order);
-        if(mysql_query(sql, order)) { 
-            LOG_DEBUG( "Insert error!");
-            flag = false; 
-        }
-        flag = true;
+        string order = "INSERT INTO user(username, password) VALUES('" + AsyncSqlPool::Escape(name) +
+                       "','" + AsyncSqlPool::Escape(pwd) + "')";
+        sqlPool.Query(order, [name, pwd, done](const SqlResult& res) {
+            CacheInsert_(name, pwd, res.ok);
+            done(res.ok);
+        });
+    };
+    if(skipSelect) {
+        insert();
+        return;
     }
-    SqlConnPool::Instance()->FreeConn(sql);
-    LOG_DEBUG( "UserVerify success!!");
-    return flag;
+    string order = "SELECT username, password FROM user WHERE username='" + AsyncSqlPool::Escape(name) + "' LIMIT 1";
+    sqlPool.Query(order, [name, pwd, isLogin, done, insert](const SqlResult& res) {
+        if(!res.ok) {
+            LOG_WARN("Verify query error: %s", res.error.c_str());
+            done(false);
+            return;
+        }
+        bool found = !res.rows.empty() && res.rows[0].size() > 1;
+        if(found) { UserCache::Instance()->Put(name, res.rows[0][1]); }
+        else { UserCache::Instance()->PutUnknown(name); }
+        /* 登陆行为 */
+        if(isLogin) {
+            bool flag = found && res.rows[0][1] == pwd;
+            if(!flag) { LOG_DEBUG("pwd error!"); }
+            done(flag);
+            return;
+        }
+        if(found) {
+            LOG_DEBUG("user used!");
+            done(false);
+            return;
+        }
+        insert();
+    });
 }
 
 std::string HttpRequest::path() const{
@@ -266,6 +366,11 @@ std::string HttpRequest::GetPost(const std::string& key) const {
     return "";
 }
 
+const char* HttpRequest::GetHeader(const char* key) const {
+    auto it = header_.find(key);
+    return it == header_.end() ? nullptr : it->second.c_str();
+}
+
 std::string HttpRequest::GetPost(const char* key) const {
     assert(key != nullptr);
     if(post_.count(key) == 1) {
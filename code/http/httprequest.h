@@ -10,12 +10,13 @@
 #include <string>
 #include <regex>
 #include <errno.h>     
-#include <mysql/mysql.h>  //mysql
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
-#include "../pool/sqlconnpool.h"
-#include "../pool/sqlconnRAII.h"
+#include "../pool/asyncsqlpool.h"
+#include "userstore.h"
+#include "usercache.h"
+#include "userfilter.h"
 
 class HttpRequest {
 public:
@@ -49,9 +50,25 @@ public:
     std::string version() const;                            // 获得请求http版本
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
+    const char* GetHeader(const char* key) const;           // 请求头部的值，没有这个头部时返回nullptr
 
     bool IsKeepAlive() const;                               // 是否保持http长连接
 
+    bool IsVerifyPending() const { return verifyPending_; } // 是否还有登录注册要查数据库
+    void Verify();                                          // 查数据库验证用户，决定返回的页面
+    void SkipVerify();                                      // 数据库线程池满，直接按验证失败处理
+    // 用异步连接池验证，done在事件循环线程中带着结果调用，调用者确认请求还有效后再SetVerifyResult
+    void VerifyAsync(AsyncSqlPool& sqlPool, std::function<void(bool)> done);
+    void SetVerifyResult(bool ok);                          // 按验证结果决定返回的页面
+
+    // 异步验证用户信息，先查用户，注册时再插入，结果通过done返回
+    static void AsyncUserVerify(AsyncSqlPool& sqlPool, const std::string& name, const std::string& pwd,
+                                bool isLogin, std::function<void(bool)> done);
+
+    static bool deferVerify;                                // 为真时解析不查数据库，只标记verifyPending_，交给数据库线程池
+    static UserStore* userStore;                            // 登录注册用的用户存储，为空时验证都失败
+    static bool uniqueNames;                                // 用户存储保证用户名唯一时为真，注册才能省掉查重的SELECT
+
     /* 
     todo 
     void HttpConn::ParseFormData() {}
@@ -68,8 +85,13 @@ private:
     void ParseFromUrlencoded_();                            // 解析用户名密码
     // 验证用户信息
     static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
+    static bool CachedVerify_(const std::string& name, const std::string& pwd, bool isLogin,
+                              bool* result, bool* skipSelect);  // 先查凭据缓存
+    static void CacheInsert_(const std::string& name, const std::string& pwd, bool ok);   // 注册结果回写缓存
 
     PARSE_STATE state_;                                     // 主状态机解析状态
+    bool verifyPending_;                                    // 登录注册请求还没查数据库
+    bool isLogin_;                                          // 待验证的是登录还是注册
     std::string method_;                                    // 请求方法
     std::string path_;                                      // 请求资源名称
     std::string version_;                                   // 请求http版本
@@ -44,12 +44,22 @@ const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 404, "/404.html" },
 };
 
+namespace {
+struct FileMetrics {                            // 静态文件路径上的计数，InitMetrics之前为空
+    Metrics::Counter* files;
+    Metrics::Counter* bytes;
+    Metrics::Counter* errors;
+};
+FileMetrics* fileMetrics = nullptr;
+}
+
 HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
     mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
+    bodyType_ = nullptr;
 };
 
 HttpResponse::~HttpResponse() {
@@ -65,10 +75,33 @@ void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, in
     srcDir_ = srcDir;
     mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
+    body_.clear();
+    bodyType_ = nullptr;
+}
+
+void HttpResponse::SetBody(string body, const char* type) {
+    body_ = std::move(body);
+    bodyType_ = type;
+}
+
+void HttpResponse::InitMetrics(Metrics* metrics) {
+    static FileMetrics m = {
+        metrics->AddCounter("webserver_static_files_total", "Static files mapped for a response."),
+        metrics->AddCounter("webserver_static_file_bytes_total", "Bytes of static files mapped for a response."),
+        metrics->AddCounter("webserver_static_file_errors_total", "Static files that could not be opened or mapped."),
+    };
+    fileMetrics = &m;
 }
 
 // 依据自己响应对象内容向写缓冲区写入响应报文
 void HttpResponse::MakeResponse(Buffer& buff) {
+    if(bodyType_) {
+        AddStateLine_(buff);
+        AddHeader_(buff);
+        buff.Append("Content-length: " + to_string(body_.size()) + "\r\n\r\n");
+        buff.Append(body_);
+        return;
+    }
     /* 判断请求的资源文件 */
     if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {  //前面是没有该文件，后面代表它是一个目录
         code_ = 404;
@@ -126,12 +159,18 @@ void HttpResponse::AddHeader_(Buffer& buff) {
         buff.Append("close\r\n");
     }
     buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    char date[TimeCache::HTTP_DATE_LEN];
+    TimeCache::HttpDate(date);                  // 每个线程每秒格式化一次的Date
+    buff.Append("Date: ");
+    buff.Append(date, TimeCache::HTTP_DATE_LEN - 1);
+    buff.Append("\r\n");
 }
 
 // 向缓冲区写响应体
 void HttpResponse::AddContent_(Buffer& buff) {
     int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
     if(srcFd < 0) { 
+        if(fileMetrics) { fileMetrics->errors->Inc(); }
         ErrorContent(buff, "File NotFound!");
         return; 
     }
@@ -141,10 +180,15 @@ void HttpResponse::AddContent_(Buffer& buff) {
     LOG_DEBUG("file path %s", (srcDir_ + path_).data());
     int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
     if(*mmRet == -1) {
+        if(fileMetrics) { fileMetrics->errors->Inc(); }
         ErrorContent(buff, "File NotFound!");
         return; 
     }
     mmFile_ = (char*)mmRet;
+    if(fileMetrics) {
+        fileMetrics->files->Inc();
+        fileMetrics->bytes->Inc(mmFileStat_.st_size);
+    }
     close(srcFd);
     buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
 }
@@ -158,6 +202,7 @@ void HttpResponse::UnmapFile() {
 }
 // 判断文件类型
 string HttpResponse::GetFileType_() {
+    if(bodyType_) { return bodyType_; }
     string::size_type idx = path_.find_last_of('.');
     if(idx == string::npos) {
         return "text/plain";
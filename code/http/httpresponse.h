@@ -13,6 +13,7 @@
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../server/metrics.h"
 
 class HttpResponse {
 public:
@@ -26,6 +27,9 @@ public:
     size_t FileLen() const;                                                     // 返回以字节为单位的资源文件容量
     void ErrorContent(Buffer& buff, std::string message);                       // 代表文件不存在，向写缓冲区写入响应体(描述错误的信息)
     int Code() const { return code_; }                                          // 返回状态码
+    void SetBody(std::string body, const char* type);                           // 在Init之后调用，响应体直接给出，不读文件
+
+    static void InitMetrics(Metrics* metrics);                                  // 注册静态文件的指标
 
 private:
     void AddStateLine_(Buffer &buff);                                           // 向缓冲区写响应首行
@@ -44,6 +48,9 @@ private:
     char* mmFile_;                                                              // 文件内存映射的指针
     struct stat mmFileStat_;                                                    // 资源文件的状态信息
 
+    std::string body_;                                                          // SetBody给出的响应体
+    const char* bodyType_;                                                      // 同上，它的类型，为空表示响应文件
+
     static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;      // map,键为文件后缀名,值为文件类型
     static const std::unordered_map<int, std::string> CODE_STATUS;              // map,键为状态码,值为状态描述
     static const std::unordered_map<int, std::string> CODE_PATH;                // map,键为状态码,值为资源名称
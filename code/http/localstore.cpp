@@ -0,0 +1,211 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "localstore.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <array>
+#include <assert.h>
+#include "../log/log.h"
+using namespace std;
+
+LocalUserStore::LocalUserStore(): fd_(-1), syncIntervalMs_(0), writeOffset_(0),
+        requestedOffset_(0), syncedOffset_(0), syncError_(false), isClosed_(false) {}
+
+LocalUserStore::~LocalUserStore() {
+    if(syncer_.joinable()) {
+        {
+            lock_guard<mutex> locker(syncMtx_);
+            isClosed_ = true;
+        }
+        syncCond_.notify_one();
+        syncer_.join();
+    }
+    if(fd_ >= 0) { close(fd_); }
+}
+
+bool LocalUserStore::Init(const char* path, int syncIntervalMs) {
+    assert(fd_ < 0);
+    path_ = path;
+    syncIntervalMs_ = syncIntervalMs;
+    fd_ = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd_ < 0) {
+        LOG_ERROR("LocalUserStore open %s error: %s", path, strerror(errno));
+        return false;
+    }
+    if(!Recover_()) { return false; }
+    if(syncIntervalMs_ >= 0) { syncer_ = thread(&LocalUserStore::Syncer_, this); }
+    LOG_INFO("LocalUserStore %s: %zu users, %llu bytes", path, index_.size(), (unsigned long long)writeOffset_);
+    return true;
+}
+
+// 崩溃时最后一条记录可能只写了一部分，它对应的插入还没有返回成功，直接丢掉
+bool LocalUserStore::Recover_() {
+    struct stat st;
+    if(fstat(fd_, &st) < 0) { return false; }
+    string data(st.st_size, '\0');
+    size_t got = 0;
+    while(got < data.size()) {
+        ssize_t n = pread(fd_, &data[got], data.size() - got, got);
+        if(n < 0 && errno == EINTR) { continue; }
+        if(n <= 0) {
+            LOG_ERROR("LocalUserStore read %s error: %s", path_.c_str(), strerror(errno));
+            return false;
+        }
+        got += n;
+    }
+    size_t pos = 0;
+    while(data.size() - pos >= HEADER_SIZE) {
+        const char* rec = data.data() + pos;
+        uint32_t crc;
+        uint16_t nameLen, pwdLen;
+        memcpy(&crc, rec, 4);
+        memcpy(&nameLen, rec + 4, 2);
+        memcpy(&pwdLen, rec + 6, 2);
+        size_t len = HEADER_SIZE + nameLen + pwdLen;
+        if(data.size() - pos < len || Crc32_(rec + 4, len - 4) != crc) { break; }
+        index_[string(rec + HEADER_SIZE, nameLen)] = string(rec + HEADER_SIZE + nameLen, pwdLen);
+        pos += len;
+    }
+    if(pos < data.size()) {
+        LOG_WARN("LocalUserStore %s: drop %zu bytes of torn record", path_.c_str(), data.size() - pos);
+        if(ftruncate(fd_, pos) < 0 || fdatasync(fd_) < 0) { return false; }
+    }
+    writeOffset_ = requestedOffset_ = syncedOffset_ = pos;
+    return true;
+}
+
+UserStore::RESULT LocalUserStore::Lookup(const string& name, string* pwd) {
+    shared_lock<shared_mutex> locker(mtx_);
+    auto it = index_.find(name);
+    if(it == index_.end()) { return NOT_FOUND; }
+    *pwd = it->second;
+    return OK;
+}
+
+// 查重、写日志在同一把锁里完成，然后在锁外等这条记录刷盘，刷盘成功后再放进索引，
+// 登录不会查到可能丢失的用户；刷盘失败时不放进索引，这个用户名之后还能重新注册
+UserStore::RESULT LocalUserStore::Insert(const string& name, const string& pwd) {
+    if(name.size() > UINT16_MAX || pwd.size() > UINT16_MAX) { return FAILED; }
+    uint16_t nameLen = name.size(), pwdLen = pwd.size();
+    string rec(HEADER_SIZE, '\0');
+    memcpy(&rec[4], &nameLen, 2);
+    memcpy(&rec[6], &pwdLen, 2);
+    rec += name;
+    rec += pwd;
+    uint32_t crc = Crc32_(rec.data() + 4, rec.size() - 4);
+    memcpy(&rec[0], &crc, 4);
+
+    uint64_t end;
+    {
+        unique_lock<shared_mutex> locker(mtx_);
+        if(syncError_.load(memory_order_relaxed)) { return FAILED; }
+        if(index_.count(name) || unsynced_.count(name)) { return EXISTS; }
+        if(!WriteAt_(rec, writeOffset_)) {
+            LOG_ERROR("LocalUserStore write error: %s", strerror(errno));
+            if(ftruncate(fd_, writeOffset_) < 0) { LOG_ERROR("LocalUserStore truncate error!"); }
+            return FAILED;
+        }
+        writeOffset_ += rec.size();
+        end = writeOffset_;
+        if(syncIntervalMs_ < 0) {
+            index_.emplace(name, pwd);
+            return OK;
+        }
+        unsynced_.insert(name);
+    }
+
+    bool synced;
+    {
+        unique_lock<mutex> locker(syncMtx_);
+        if(end > requestedOffset_) {
+            requestedOffset_ = end;
+            syncCond_.notify_one();
+        }
+        doneCond_.wait(locker, [this, end] { return syncedOffset_ >= end || syncError_ || isClosed_; });
+        synced = syncedOffset_ >= end;
+    }
+    unique_lock<shared_mutex> locker(mtx_);
+    unsynced_.erase(name);
+    if(!synced) { return FAILED; }
+    index_.emplace(name, pwd);
+    return OK;
+}
+
+bool LocalUserStore::ForEachName(const function<void(const string&)>& fn) {
+    shared_lock<shared_mutex> locker(mtx_);
+    for(auto& item : index_) { fn(item.first); }
+    return true;
+}
+
+size_t LocalUserStore::Size() {
+    shared_lock<shared_mutex> locker(mtx_);
+    return index_.size();
+}
+
+bool LocalUserStore::WriteAt_(const string& data, uint64_t offset) {
+    size_t done = 0;
+    while(done < data.size()) {
+        ssize_t n = pwrite(fd_, data.data() + done, data.size() - done, offset + done);
+        if(n < 0 && errno == EINTR) { continue; }
+        if(n <= 0) { return false; }
+        done += n;
+    }
+    return true;
+}
+
+// 有插入等待时先睡syncIntervalMs攒一批，再一次fdatasync，唤醒这一批的所有等待者。
+// fdatasync失败后文件里的数据是否落盘无法确定，之后的插入都返回失败，并尽量截掉没确认刷盘的记录，
+// 免得重启后重放出注册时已经报告失败的用户
+void LocalUserStore::Syncer_() {
+    unique_lock<mutex> locker(syncMtx_);
+    while(true) {
+        syncCond_.wait(locker, [this] { return isClosed_ || requestedOffset_ > syncedOffset_; });
+        if(requestedOffset_ <= syncedOffset_) { break; }
+        if(syncIntervalMs_ > 0 && !isClosed_) {
+            syncCond_.wait_for(locker, chrono::milliseconds(syncIntervalMs_), [this] { return isClosed_; });
+        }
+        uint64_t target = requestedOffset_;
+        locker.unlock();
+        bool ok = fdatasync(fd_) == 0;
+        locker.lock();
+        if(ok) {
+            syncedOffset_ = target;
+        } else {
+            LOG_ERROR("LocalUserStore fdatasync error: %s", strerror(errno));
+            syncError_ = true;
+        }
+        doneCond_.notify_all();
+        if(syncError_) {
+            uint64_t synced = syncedOffset_;
+            locker.unlock();
+            /* 设置syncError_之后拿到mtx_的插入都不会再写日志 */
+            unique_lock<shared_mutex> writeLocker(mtx_);
+            if(ftruncate(fd_, synced) < 0) { LOG_ERROR("LocalUserStore truncate error!"); }
+            writeOffset_ = synced;
+            break;
+        }
+    }
+}
+
+uint32_t LocalUserStore::Crc32_(const char* data, size_t len) {
+    static const auto table = [] {
+        array<uint32_t, 256> t;
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++) { c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1; }
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for(size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
@@ -0,0 +1,66 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef LOCAL_STORE_H
+#define LOCAL_STORE_H
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include "userstore.h"
+
+// 进程内的本地用户存储：只追加的日志文件加内存里的哈希索引，不依赖MySQL。
+// 启动时顺序重放日志重建索引，遇到写了一半或校验不对的记录就截断到最后一条完整的记录；
+// 插入先写日志，再等后台线程fdatasync，同一批等待的插入共用一次刷盘，刷盘成功后才能查到新用户
+class LocalUserStore: public UserStore {
+public:
+    LocalUserStore();
+    ~LocalUserStore();
+
+    // 打开(没有就创建)日志文件并恢复索引。syncIntervalMs是攒一批插入再刷盘的最长时间，
+    // 0表示有插入就刷，负数表示不刷盘，交给操作系统(压测用)
+    bool Init(const char* path, int syncIntervalMs);
+
+    RESULT Lookup(const std::string& name, std::string* pwd) override;
+    RESULT Insert(const std::string& name, const std::string& pwd) override;
+    bool ForEachName(const std::function<void(const std::string&)>& fn) override;
+    bool HasUniqueNames() override { return true; }         // 插入时在锁里查重
+    const char* Name() const override { return "local"; }
+
+    size_t Size();                                          // 用户数
+
+private:
+    /* 记录格式：crc32(4字节) 用户名长度(2字节) 密码长度(2字节) 用户名 密码，crc32覆盖crc之后的所有字节 */
+    static const size_t HEADER_SIZE = 8;
+
+    bool Recover_();                                        // 重放日志，截掉尾部不完整的记录
+    bool WriteAt_(const std::string& data, uint64_t offset);
+    void Syncer_();                                         // 后台刷盘线程
+    static uint32_t Crc32_(const char* data, size_t len);
+
+    int fd_;
+    int syncIntervalMs_;
+    std::string path_;
+
+    std::shared_mutex mtx_;                                 // 保护index_、unsynced_和日志的写入位置，查找用共享锁
+    std::unordered_map<std::string, std::string> index_;    // 用户名到密码，只有已经刷盘的用户
+    std::unordered_set<std::string> unsynced_;              // 已写日志、还在等刷盘的用户名，同名的插入返回EXISTS
+    uint64_t writeOffset_;                                  // 日志写到的位置
+
+    std::mutex syncMtx_;                                    // 保护下面的刷盘状态
+    std::condition_variable syncCond_;                      // 有数据等待刷盘时唤醒后台线程
+    std::condition_variable doneCond_;                      // 一批刷完时唤醒等待的插入
+    uint64_t requestedOffset_;                              // 等待刷盘的最大位置
+    uint64_t syncedOffset_;                                 // 已经刷盘的位置
+    std::atomic<bool> syncError_;                           // 刷盘失败过，之后的插入都失败，插入时在mtx_里检查
+    bool isClosed_;
+    std::thread syncer_;
+};
+
+#endif //LOCAL_STORE_H
@@ -0,0 +1,128 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "usercache.h"
+#include <random>
+#include <assert.h>
+#include "../timer/timecache.h"
+#include "../pool/sha1.h"
+
+using namespace std;
+
+UserCache* UserCache::Instance() {
+    static UserCache cache;
+    return &cache;
+}
+
+UserCache::UserCache(): enabled_(false), shardCapacity_(0), ttlMs_(0), negativeTtlMs_(0),
+        hits_(0), negativeHits_(0), misses_(0) {}
+
+// 启动时调用一次，之后只读配置
+void UserCache::Init(size_t capacity, int ttlMs, int negativeTtlMs, size_t shardCount) {
+    assert(!IsEnabled() && shardCount > 0);
+    if(capacity == 0 || ttlMs <= 0) { return; }
+    shardCount = min(shardCount, capacity);
+    shardCapacity_ = (capacity + shardCount - 1) / shardCount;
+    ttlMs_ = ttlMs;
+    negativeTtlMs_ = negativeTtlMs;
+    random_device rd;
+    for(int i = 0; i < 4; i++) {
+        uint32_t r = rd();
+        salt_.append(reinterpret_cast<const char*>(&r), sizeof(r));
+    }
+    for(size_t i = 0; i < shardCount; i++) {
+        shards_.emplace_back(new Shard);
+    }
+    enabled_.store(true, memory_order_release);
+}
+
+UserCache::RESULT UserCache::Check(const string& name, const string& pwd) {
+    if(!IsEnabled()) { return MISS; }
+    Shard& shard = ShardOf_(name);
+    string verifier;
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.index.find(name);
+        if(it == shard.index.end()) {
+            misses_.fetch_add(1, memory_order_relaxed);
+            return MISS;
+        }
+        if(it->second->expiresMs <= TimeCache::NowMs()) {
+            shard.lru.erase(it->second);
+            shard.index.erase(it);
+            misses_.fetch_add(1, memory_order_relaxed);
+            return MISS;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);    // 移到表头
+        verifier = it->second->verifier;
+    }
+    if(verifier.empty()) {
+        negativeHits_.fetch_add(1, memory_order_relaxed);
+        return UNKNOWN_USER;
+    }
+    hits_.fetch_add(1, memory_order_relaxed);
+    return Verifier_(pwd) == verifier ? MATCH : MISMATCH;     // 哈希在锁外算
+}
+
+void UserCache::Put(const string& name, const string& pwd) {
+    if(!IsEnabled()) { return; }
+    Insert_(name, Verifier_(pwd), ttlMs_);
+}
+
+void UserCache::PutUnknown(const string& name) {
+    if(!IsEnabled() || negativeTtlMs_ <= 0) { return; }
+    Insert_(name, "", negativeTtlMs_);
+}
+
+void UserCache::Invalidate(const string& name) {
+    if(!IsEnabled()) { return; }
+    Shard& shard = ShardOf_(name);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+}
+
+UserCache::Stats UserCache::GetStats() const {
+    size_t size = 0;
+    for(auto& shard : shards_) {
+        lock_guard<mutex> locker(shard->mtx);
+        size += shard->lru.size();
+    }
+    return { hits_.load(memory_order_relaxed), negativeHits_.load(memory_order_relaxed),
+             misses_.load(memory_order_relaxed), size };
+}
+
+UserCache::Shard& UserCache::ShardOf_(const string& name) {
+    return *shards_[hash<string>()(name) % shards_.size()];
+}
+
+string UserCache::Verifier_(const string& pwd) const {
+    return Sha1(salt_ + pwd);
+}
+
+// 插入或更新条目，放到表头，超过上限时淘汰表尾。
+// 负缓存不覆盖没过期的正向条目：注册提交前发出的查询可能在注册写入缓存之后才回来，不能把新用户又标成不存在
+void UserCache::Insert_(const string& name, string verifier, int ttlMs) {
+    Shard& shard = ShardOf_(name);
+    int64_t now = TimeCache::NowMs();
+    int64_t expires = now + ttlMs;
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        if(verifier.empty() && !it->second->verifier.empty() && it->second->expiresMs > now) { return; }
+        it->second->verifier = std::move(verifier);
+        it->second->expiresMs = expires;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    shard.lru.push_front(Entry{ name, std::move(verifier), expires });
+    shard.index[name] = shard.lru.begin();
+    if(shard.lru.size() > shardCapacity_) {
+        shard.index.erase(shard.lru.back().name);
+        shard.lru.pop_back();
+    }
+}
@@ -0,0 +1,78 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+// 用户名到密码校验值的缓存，按用户名哈希分片，每个分片一把锁和一条有上限的LRU链表，条目带过期时间。
+// 不存在的用户也缓存(负缓存)，重复的失败登录不用再查数据库；注册成功时写入正向条目，负缓存不会盖掉它。
+// 缓存里不存明文密码，只存加了进程随机盐的SHA1
+class UserCache {
+public:
+    enum RESULT {                                           // 查缓存的结果
+        MISS = 0,                                           // 没有缓存或已过期，需要查数据库
+        MATCH,                                              // 用户存在且密码一致
+        MISMATCH,                                           // 用户存在但密码不一致
+        UNKNOWN_USER,                                       // 用户不存在(负缓存)
+    };
+
+    struct Stats {
+        uint64_t hits;                                      // 命中正向条目
+        uint64_t negativeHits;                              // 命中负缓存
+        uint64_t misses;                                    // 没命中
+        size_t size;                                        // 当前条目数
+    };
+
+    static UserCache* Instance();
+
+    UserCache();
+
+    // capacity为0表示关闭缓存，ttlMs是正向条目的有效期，negativeTtlMs是负缓存的有效期
+    void Init(size_t capacity, int ttlMs, int negativeTtlMs, size_t shardCount = 16);
+    bool IsEnabled() const { return enabled_.load(std::memory_order_acquire); }
+
+    RESULT Check(const std::string& name, const std::string& pwd);
+    void Put(const std::string& name, const std::string& pwd);     // 缓存数据库里查到(或刚插入)的用户
+    void PutUnknown(const std::string& name);               // 缓存不存在的用户，已有正向条目时不变
+    void Invalidate(const std::string& name);               // 注册等改变了用户表时作废条目
+
+    Stats GetStats() const;
+
+private:
+    struct Entry {
+        std::string name;
+        std::string verifier;                               // 密码的校验值，负缓存为空
+        int64_t expiresMs;                                  // 过期时间
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<Entry> lru;                               // 表头是最近使用的
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    };
+
+    Shard& ShardOf_(const std::string& name);
+    std::string Verifier_(const std::string& pwd) const;
+    void Insert_(const std::string& name, std::string verifier, int ttlMs);
+
+    std::atomic<bool> enabled_;
+    size_t shardCapacity_;                                  // 每个分片的条目上限
+    int ttlMs_;
+    int negativeTtlMs_;
+    std::string salt_;                                      // 进程启动时随机生成
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> negativeHits_;
+    std::atomic<uint64_t> misses_;
+};
+
+#endif //USER_CACHE_H
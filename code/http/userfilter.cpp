@@ -0,0 +1,54 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "userfilter.h"
+#include <thread>
+#include "../log/log.h"
+
+using namespace std;
+
+UserFilter* UserFilter::Instance() {
+    static UserFilter filter;
+    return &filter;
+}
+
+UserFilter::UserFilter(): state_(DISABLED) {}
+
+void UserFilter::Init(UserStore* store, size_t memoryBytes, double fpRate) {
+    assert(State() == DISABLED && store);
+    if(memoryBytes == 0) { return; }
+    filter_.reset(new BloomFilter(memoryBytes, fpRate));
+    state_.store(LOADING, memory_order_release);
+    thread(Load_, this, store).detach();
+}
+
+bool UserFilter::IsNameFree(const string& name) const {
+    return State() == READY && !filter_->MayContain(name);
+}
+
+void UserFilter::Add(const string& name) {
+    int state = state_.load(memory_order_acquire);
+    if(state == LOADING || state == READY) { filter_->Add(name); }
+}
+
+// 加载期间注册的用户由Add加入，不会漏掉；加载失败后过滤器不再下结论，注册照常查重
+void UserFilter::Load_(UserFilter* filter, UserStore* store) {
+    BloomFilter& bloom = *filter->filter_;
+    size_t rows = 0;
+    bool ok = store->ForEachName([&bloom, &rows](const string& name) {
+        bloom.Add(name);
+        rows++;
+    });
+    if(!ok) {
+        LOG_ERROR("UserFilter load error!");
+        filter->state_.store(FAILED, memory_order_release);
+        return;
+    }
+    LOG_INFO("UserFilter loaded %zu names from %s, capacity: %zu, hashes: %d, memory: %zuKB",
+             rows, store->Name(), bloom.Capacity(), bloom.HashCount(), bloom.MemoryBytes() / 1024);
+    if(bloom.Count() > bloom.Capacity()) {
+        LOG_WARN("UserFilter over capacity, false positive rate will rise");
+    }
+    filter->state_.store(READY, memory_order_release);
+}
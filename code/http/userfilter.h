@@ -0,0 +1,43 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef USER_FILTER_H
+#define USER_FILTER_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include "../pool/bloomfilter.h"
+#include "userstore.h"
+
+// 已注册用户名的布隆过滤器：启动后由后台线程从用户存储加载，注册成功时加入。
+// 加载完成后，过滤器判定不存在的用户名一定没有被注册，注册时可以省掉查重的SELECT
+class UserFilter {
+public:
+    enum STATE {
+        DISABLED = 0,                                       // 没有开启
+        LOADING,                                            // 后台加载中，还不能下结论
+        READY,                                              // 加载完成
+        FAILED,                                             // 加载失败，不再使用
+    };
+
+    static UserFilter* Instance();
+
+    UserFilter();
+
+    // 创建过滤器并启动后台从store加载，memoryBytes是位数组大小(0表示不开启)，fpRate是目标误判率
+    void Init(UserStore* store, size_t memoryBytes, double fpRate);
+
+    bool IsNameFree(const std::string& name) const;         // 加载完成且用户名一定没被注册时返回true
+    void Add(const std::string& name);                      // 注册成功后调用，加载期间也要加入
+    STATE State() const { return static_cast<STATE>(state_.load(std::memory_order_acquire)); }
+
+private:
+    static void Load_(UserFilter* filter, UserStore* store); // 后台线程，遍历所有用户名
+
+    std::unique_ptr<BloomFilter> filter_;
+    std::atomic<int> state_;
+};
+
+#endif //USER_FILTER_H
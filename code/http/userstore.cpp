@@ -0,0 +1,283 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "userstore.h"
+#include <string.h>
+#include <chrono>
+#include <unordered_set>
+#include <unordered_map>
+#include <strings.h>                // strcasecmp
+#include <mysql/errmsg.h>           // CR_SERVER_GONE_ERROR等客户端错误码
+#include <mysql/mysqld_error.h>     // ER_UNKNOWN_STMT_HANDLER等服务器错误码
+#include "../log/log.h"
+#include "../pool/sqlconnRAII.h"
+using namespace std;
+
+// 一次插入rows行的INSERT
+static string InsertUsersSql(size_t rows) {
+    string order = "INSERT INTO user(username, password) VALUES(?, ?)";
+    for(size_t i = 1; i < rows; i++) { order += ",(?, ?)"; }
+    return order;
+}
+
+const vector<string> MySqlUserStore::SQL_STMTS {
+            "SELECT password FROM user WHERE username = ? LIMIT 1",
+            InsertUsersSql(1),
+            InsertUsersSql(8),
+            InsertUsersSql(32),
+            InsertUsersSql(64), };
+
+// 攒批时每段的行数和对应的语句，从大到小
+static const struct { size_t rows; size_t stmt; } INSERT_CHUNKS[] = {
+    { 64, MySqlUserStore::STMT_INSERT_USERS_64 },
+    { 32, MySqlUserStore::STMT_INSERT_USERS_32 },
+    { 8, MySqlUserStore::STMT_INSERT_USERS_8 },
+    { 1, MySqlUserStore::STMT_INSERT_USER },
+};
+
+// 不超过left行的最大一段
+static const auto* ChunkFor(size_t left) {
+    const auto* chunk = INSERT_CHUNKS;
+    while(chunk->rows > left) { chunk++; }
+    return chunk;
+}
+
+MySqlUserStore::MySqlUserStore(): batching_(false), intervalMs_(0), maxRows_(0), isClosed_(false) {}
+
+// 还在排队的注册提交完再退出
+MySqlUserStore::~MySqlUserStore() {
+    if(writer_.joinable()) {
+        {
+            lock_guard<mutex> locker(mtx_);
+            isClosed_ = true;
+        }
+        cond_.notify_one();
+        writer_.join();
+    }
+}
+
+// 在开始处理请求之前调用
+void MySqlUserStore::EnableBatch(int intervalMs, size_t maxRows) {
+    assert(!batching_ && intervalMs >= 0 && maxRows > 0);
+    intervalMs_ = intervalMs;
+    maxRows_ = maxRows;
+    batching_ = true;
+    writer_ = thread(&MySqlUserStore::Writer_, this);
+}
+
+// 执行连接上预处理好的语句，参数都按字符串绑定，走二进制协议，不拼接SQL。
+// 连接断开或语句句柄失效时重连、重新准备后再试一次；事务中间不能重连，重连后前面的语句就丢了
+MYSQL_STMT* MySqlUserStore::ExecuteStmt_(MYSQL* sql, size_t id, const vector<const string*>& params,
+                                         unsigned int* err, bool reconnect) {
+    vector<MYSQL_BIND> bind(params.size());
+    vector<unsigned long> lens(params.size());
+    *err = 0;
+    for(int retry = 0; retry < 2; retry++) {
+        MYSQL_STMT* stmt = SqlConnPool::Instance()->GetStmt(sql, id);
+        if(stmt) {
+            memset(bind.data(), 0, sizeof(MYSQL_BIND) * bind.size());
+            size_t i = 0;
+            for(const string* param : params) {
+                lens[i] = param->size();
+                bind[i].buffer_type = MYSQL_TYPE_STRING;
+                bind[i].buffer = const_cast<char*>(param->data());
+                bind[i].buffer_length = lens[i];
+                bind[i].length = &lens[i];
+                i++;
+            }
+            if(mysql_stmt_bind_param(stmt, bind.data()) == 0 && mysql_stmt_execute(stmt) == 0) { return stmt; }
+            *err = mysql_stmt_errno(stmt);
+            LOG_WARN("MySql execute error: %s", mysql_stmt_error(stmt));
+            if(*err != CR_SERVER_GONE_ERROR && *err != CR_SERVER_LOST &&
+               *err != ER_UNKNOWN_STMT_HANDLER && *err != ER_NEED_REPREPARE) { return nullptr; }
+        }
+        if(!reconnect || retry > 0 || !SqlConnPool::Instance()->Reconnect(sql)) { break; }
+    }
+    return nullptr;
+}
+
+UserStore::RESULT MySqlUserStore::Lookup(const string& name, string* pwd) {
+    MYSQL* sql;
+    SqlConnRAII sqlRAII(&sql, SqlConnPool::Instance());     // 离开函数时归还连接
+    if(!sql) { return FAILED; }         // 连接池忙
+
+    unsigned int err;
+    MYSQL_STMT* stmt = ExecuteStmt_(sql, STMT_SELECT_USER, { &name }, &err);
+    if(!stmt) { return FAILED; }
+    char password[256];                 // 结果绑定到这个缓冲区
+    unsigned long passwordLen = 0;
+    MYSQL_BIND result;
+    memset(&result, 0, sizeof(result));
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = password;
+    result.buffer_length = sizeof(password);
+    result.length = &passwordLen;
+    RESULT res = FAILED;
+    if(mysql_stmt_bind_result(stmt, &result) == 0 && mysql_stmt_store_result(stmt) == 0) {
+        int ret = mysql_stmt_fetch(stmt);
+        if(ret == 0) {
+            pwd->assign(password, passwordLen);
+            res = OK;
+        } else if(ret == MYSQL_DATA_TRUNCATED) {
+            /* 比缓冲区长，按实际长度再取一次 */
+            pwd->resize(passwordLen);
+            result.buffer = &(*pwd)[0];
+            result.buffer_length = passwordLen;
+            res = mysql_stmt_fetch_column(stmt, &result, 0, 0) == 0 ? OK : FAILED;
+        } else if(ret == MYSQL_NO_DATA) {
+            res = NOT_FOUND;
+        }
+    }
+    mysql_stmt_free_result(stmt);
+    return res;
+}
+
+UserStore::RESULT MySqlUserStore::Insert(const string& name, const string& pwd) {
+    if(batching_) {
+        /* 交给写线程，等所在的批次提交 */
+        future<RESULT> result;
+        {
+            lock_guard<mutex> locker(mtx_);
+            if(isClosed_) { return FAILED; }
+            pending_.push_back({name, pwd, promise<RESULT>()});
+            result = pending_.back().done.get_future();
+            if(pending_.size() == 1 || pending_.size() >= maxRows_) { cond_.notify_one(); }
+        }
+        return result.get();
+    }
+    MYSQL* sql;
+    SqlConnRAII sqlRAII(&sql, SqlConnPool::Instance());
+    if(!sql) { return FAILED; }
+
+    unsigned int err;
+    if(ExecuteStmt_(sql, STMT_INSERT_USER, { &name, &pwd }, &err)) { return OK; }
+    return err == ER_DUP_ENTRY ? EXISTS : FAILED;
+}
+
+// 逐行从服务器读取，不把整张表放进内存
+bool MySqlUserStore::ForEachName(const function<void(const string&)>& fn) {
+    MYSQL* sql;
+    SqlConnRAII sqlRAII(&sql, SqlConnPool::Instance());
+    if(!sql || mysql_query(sql, "SELECT username FROM user") != 0) { return false; }
+    MYSQL_RES* res = mysql_use_result(sql);
+    if(!res) { return false; }
+    while(MYSQL_ROW row = mysql_fetch_row(res)) {
+        if(row[0]) { fn(row[0]); }
+    }
+    bool ok = mysql_errno(sql) == 0;    // 读取中途出错时fetch也返回NULL
+    mysql_free_result(res);
+    if(!ok) { LOG_ERROR("MySql read users error: %s", mysql_error(sql)); }
+    return ok;
+}
+
+// 查SHOW INDEX，Non_unique为0且只有username一列的索引才算；出错时按没有处理，注册照常查重
+bool MySqlUserStore::HasUniqueNames() {
+    MYSQL* sql;
+    SqlConnRAII sqlRAII(&sql, SqlConnPool::Instance());
+    if(!sql || mysql_query(sql, "SHOW INDEX FROM user") != 0) { return false; }
+    MYSQL_RES* res = mysql_store_result(sql);
+    if(!res) { return false; }
+    unordered_map<string, bool> keys;   // 唯一索引名 -> 是否只含username
+    if(mysql_num_fields(res) >= 5) {
+        /* 列依次是 Table, Non_unique, Key_name, Seq_in_index, Column_name */
+        while(MYSQL_ROW row = mysql_fetch_row(res)) {
+            if(!row[1] || strcmp(row[1], "0") != 0 || !row[2] || !row[4]) { continue; }
+            bool isName = strcasecmp(row[4], "username") == 0;
+            auto it = keys.emplace(row[2], true).first;
+            it->second = it->second && isName;
+        }
+    }
+    mysql_free_result(res);
+    for(const auto& key : keys) {
+        if(key.second) { return true; }
+    }
+    return false;
+}
+
+// 第一条注册到达后再等intervalMs让后面的注册跟上，攒够maxRows条就不再等；
+// 提交这一批的时候新到的注册继续排队，成为下一批
+void MySqlUserStore::Writer_() {
+    unique_lock<mutex> locker(mtx_);
+    while(true) {
+        cond_.wait(locker, [this] { return isClosed_ || !pending_.empty(); });
+        if(pending_.empty()) { break; }
+        cond_.wait_for(locker, chrono::milliseconds(intervalMs_),
+                       [this] { return isClosed_ || pending_.size() >= maxRows_; });
+        vector<PendingInsert> batch;
+        while(!pending_.empty() && batch.size() < maxRows_) {
+            batch.push_back(std::move(pending_.front()));
+            pending_.pop_front();
+        }
+        locker.unlock();
+        CommitBatch_(batch);
+        locker.lock();
+    }
+}
+
+// 整批在一个事务里插入，只提交(刷盘)一次。有用户名已存在时整个事务回滚，
+// 这时退回逐行插入，区分出哪些已存在(很少发生，注册前已经查过重)。同一批里重复的用户名只插第一条
+void MySqlUserStore::CommitBatch_(vector<PendingInsert>& batch) {
+    vector<PendingInsert*> rows;
+    unordered_set<string> names;
+    for(auto& item : batch) {
+        if(names.insert(item.name).second) { rows.push_back(&item); }
+        else { item.done.set_value(EXISTS); }
+    }
+    LOG_DEBUG("Register batch: %zu rows", rows.size());
+
+    MYSQL* sql;
+    SqlConnRAII sqlRAII(&sql, SqlConnPool::Instance());
+    for(int retry = 0; sql && retry < 2; retry++) {
+        unsigned int err = 0;
+        if(InsertRows_(sql, rows, &err)) {
+            for(auto row : rows) { row->done.set_value(OK); }
+            return;
+        }
+        if(err == ER_DUP_ENTRY) {
+            for(auto row : rows) {
+                MYSQL_STMT* stmt = ExecuteStmt_(sql, STMT_INSERT_USER, { &row->name, &row->pwd }, &err);
+                row->done.set_value(stmt ? OK : (err == ER_DUP_ENTRY ? EXISTS : FAILED));
+            }
+            return;
+        }
+        /* 连接断开时重连再试一次 */
+        if((err != CR_SERVER_GONE_ERROR && err != CR_SERVER_LOST) || retry > 0 ||
+           !SqlConnPool::Instance()->Reconnect(sql)) { break; }
+    }
+    for(auto row : rows) { row->done.set_value(FAILED); }
+}
+
+// 按64/32/8/1行拆成几段，每段执行一次预处理好的多行INSERT，参数绑定，不拼接SQL。
+// 只有一段时自动提交，多段时关掉自动提交，最后一起提交，出错回滚
+bool MySqlUserStore::InsertRows_(MYSQL* sql, vector<PendingInsert*>& rows, unsigned int* err) {
+    *err = 0;
+    bool multi = ChunkFor(rows.size())->rows < rows.size();
+    if(multi && mysql_autocommit(sql, 0) != 0) {
+        *err = mysql_errno(sql);
+        LOG_WARN("Register batch error: %s", mysql_error(sql));
+        return false;
+    }
+    bool ok = true;
+    vector<const string*> params;
+    for(size_t i = 0; ok && i < rows.size();) {
+        const auto* chunk = ChunkFor(rows.size() - i);
+        params.clear();
+        for(size_t j = i; j < i + chunk->rows; j++) {
+            params.push_back(&rows[j]->name);
+            params.push_back(&rows[j]->pwd);
+        }
+        ok = ExecuteStmt_(sql, chunk->stmt, params, err, !multi) != nullptr;
+        i += chunk->rows;
+    }
+    if(multi) {
+        if(ok && mysql_commit(sql) != 0) {
+            *err = mysql_errno(sql);
+            LOG_WARN("Register batch commit error: %s", mysql_error(sql));
+            ok = false;
+        }
+        if(!ok) { mysql_rollback(sql); }
+        mysql_autocommit(sql, 1);
+    }
+    return ok;
+}
@@ -0,0 +1,88 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <mysql/mysql.h>
+
+// 用户存储接口：登录注册只通过它查用户和插入用户，后端可以是MySQL也可以是进程内的本地存储
+class UserStore {
+public:
+    enum RESULT {
+        OK = 0,
+        NOT_FOUND,                                          // 用户不存在
+        EXISTS,                                             // 注册时用户名已被使用
+        FAILED,                                             // 存储出错
+    };
+
+    virtual ~UserStore() = default;
+
+    virtual RESULT Lookup(const std::string& name, std::string* pwd) = 0;         // 查用户的密码
+    virtual RESULT Insert(const std::string& name, const std::string& pwd) = 0;   // 插入新用户
+    virtual bool ForEachName(const std::function<void(const std::string&)>& fn) = 0;  // 遍历所有用户名，加载用户名过滤器用
+    virtual bool HasUniqueNames() = 0;                      // 重复的用户名是否一定插入失败，启动时检查一次
+    virtual const char* Name() const = 0;                   // 后端名，写日志用
+};
+
+// MySQL后端：从SqlConnPool取连接，执行连接上预处理好的语句。
+// 开启攒批后注册交给写线程，一批注册按64/32/8/1行拆开，用预处理好的多行INSERT在一个事务里提交，一批只付一次提交的刷盘代价
+class MySqlUserStore: public UserStore {
+public:
+    enum SQL_STMT {                                         // 数据库连接池在每个连接上预处理的语句，下标对应SQL_STMTS
+        STMT_SELECT_USER = 0,                               // 按用户名查密码
+        STMT_INSERT_USER,                                   // 注册新用户
+        STMT_INSERT_USERS_8,                                // 攒批注册，一次插入8行
+        STMT_INSERT_USERS_32,
+        STMT_INSERT_USERS_64,
+    };
+
+    static const std::vector<std::string> SQL_STMTS;        // 预处理语句的文本，传给SqlConnPool::Init
+
+    MySqlUserStore();
+    ~MySqlUserStore();
+
+    // 开启注册攒批：第一条注册到达后最多等intervalMs，或者攒够maxRows条，合成一批提交
+    void EnableBatch(int intervalMs, size_t maxRows);
+
+    RESULT Lookup(const std::string& name, std::string* pwd) override;
+    RESULT Insert(const std::string& name, const std::string& pwd) override;
+    bool ForEachName(const std::function<void(const std::string&)>& fn) override;
+    bool HasUniqueNames() override;                         // user表上有没有只含username的唯一索引
+    const char* Name() const override { return "mysql"; }
+
+private:
+    struct PendingInsert {                                  // 等待写线程提交的注册
+        std::string name;
+        std::string pwd;
+        std::promise<RESULT> done;                          // 所在的批次提交后设置结果
+    };
+
+    void Writer_();                                         // 写线程，攒批并提交
+    void CommitBatch_(std::vector<PendingInsert>& batch);
+    bool InsertRows_(MYSQL* sql, std::vector<PendingInsert*>& rows, unsigned int* err);  // 整批在一个事务里插入
+
+    // 执行预处理语句，reconnect为真时连接断开或语句句柄失效会重连再试一次，失败时err带回错误码
+    static MYSQL_STMT* ExecuteStmt_(MYSQL* sql, size_t id, const std::vector<const std::string*>& params,
+                                    unsigned int* err, bool reconnect = true);
+
+    bool batching_;                                         // 是否开启攒批
+    int intervalMs_;                                        // 攒批的最长等待时间
+    size_t maxRows_;                                        // 一批最多的行数
+    bool isClosed_;
+    std::mutex mtx_;                                        // 保护pending_和isClosed_
+    std::condition_variable cond_;
+    std::deque<PendingInsert> pending_;
+    std::thread writer_;
+};
+
+#endif //USER_STORE_H
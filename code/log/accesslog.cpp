@@ -0,0 +1,305 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "accesslog.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>           // IOV_MAX
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include "../timer/timecache.h"
+
+using namespace std;
+
+std::atomic<bool> AccessLog::isOpen_(false);
+
+namespace {
+struct LocalRing {
+    shared_ptr<LogRing> ring;
+    ~LocalRing() { if(ring) { ring->Close(); } }
+};
+
+// 往定长的行缓冲区里追加，放不下的部分丢掉
+struct LineWriter {
+    char* buf;
+    size_t len;
+    size_t cap;
+
+    void Put(const char* s, size_t n) {
+        n = min(n, cap - len);
+        memcpy(buf + len, s, n);
+        len += n;
+    }
+    void Put(const char* s) { Put(s, strlen(s)); }
+    void Put(char c) { if(len < cap) { buf[len++] = c; } }
+    void PutNum(long long v) {
+        char num[24];
+        Put(num, snprintf(num, sizeof(num), "%lld", v));
+    }
+
+    // 请求里的字符串原样来自客户端，引号、反斜杠和控制字符都要转义，一行日志不能被拆成两行
+    void PutEscaped(const char* s, bool json, size_t maxLen) {
+        if(!s || !*s) {
+            Put(json ? "" : "-");
+            return;
+        }
+        for(size_t i = 0; s[i] && i < maxLen; i++) {
+            unsigned char c = s[i];
+            if(c == '"' || c == '\\') {
+                Put('\\');
+                Put(c);
+            } else if(c < 0x20 || c == 0x7f) {
+                char hex[8];
+                Put(hex, snprintf(hex, sizeof(hex), json ? "\\u%04x" : "\\x%02x", c));
+            } else {
+                Put(c);
+            }
+        }
+    }
+};
+}
+
+AccessLog::AccessLog() {
+    fd_ = -1;
+    format_ = COMBINED;
+    ringSize_ = 0;
+    for(int i = 0; i < MAX_CODE; i++) { keep_[i] = 1ull << 32; }
+    wakeup_ = false;
+    isClosed_ = false;
+    written_ = 0;
+    sampledOut_ = 0;
+    dropped_ = 0;
+}
+
+AccessLog::~AccessLog() {
+    isOpen_ = false;
+    if(writeThread_ && writeThread_->joinable()) {
+        {
+            lock_guard<mutex> locker(condMtx_);
+            isClosed_ = true;
+        }
+        cond_.notify_one();
+        writeThread_->join();
+    }
+    if(fd_ >= 0) { close(fd_); }
+}
+
+AccessLog* AccessLog::Instance() {
+    static AccessLog inst;
+    return &inst;
+}
+
+bool AccessLog::Open(const char* path, FORMAT format, size_t ringSize) {
+    assert(path && !writeThread_);
+    fd_ = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd_ < 0) {
+        /* 目录不存在时建一级目录再试 */
+        string dir(path);
+        size_t pos = dir.rfind('/');
+        if(pos != string::npos && pos > 0) {
+            mkdir(dir.substr(0, pos).c_str(), 0777);
+            fd_ = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        }
+        if(fd_ < 0) { return false; }
+    }
+    format_ = format;
+    ringSize_ = max(ringSize, static_cast<size_t>(LINE_MAX_LEN) * 2);
+    writeThread_.reset(new thread(&AccessLog::AsyncWrite_, this));
+    isOpen_.store(true, memory_order_release);
+    return true;
+}
+
+void AccessLog::SetSampling(int code, double rate) {
+    assert(!Enabled());
+    rate = min(max(rate, 0.0), 1.0);
+    uint64_t keep = static_cast<uint64_t>(rate * static_cast<double>(1ull << 32));
+    if(code >= 1 && code <= 5) {
+        for(int i = code * 100; i < code * 100 + 100; i++) { keep_[i] = keep; }
+    } else if(code >= 0 && code < MAX_CODE) {
+        keep_[code] = keep;
+    }
+}
+
+// 每个线程一个xorshift随机数，不同线程之间不需要同步
+bool AccessLog::Sample(int code) {
+    uint64_t keep = keep_[code >= 0 && code < MAX_CODE ? code : 0];
+    if(keep >= (1ull << 32)) { return true; }
+    thread_local uint64_t seed = static_cast<uint64_t>(NowUs()) ^ reinterpret_cast<uintptr_t>(&seed);
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    if((seed >> 32) < keep) { return true; }
+    sampledOut_.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+int64_t AccessLog::NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+const char* AccessLog::LocalTime_(time_t sec) {
+    thread_local TimeStamp ts = { -1, {} };
+    if(ts.sec != sec) {
+        struct tm t;
+        localtime_r(&sec, &t);
+        strftime(ts.text, sizeof(ts.text), format_ == JSON ? "%Y-%m-%dT%H:%M:%S%z" : "%d/%b/%Y:%H:%M:%S %z", &t);
+        ts.sec = sec;
+    }
+    return ts.text;
+}
+
+// COMMON:   ip - - [时间] "方法 路径 版本" 状态码 字节数
+// COMBINED: 同上 "Referer" "User-Agent" 耗时(微秒)
+// JSON:     {"time":..,"ip":..,"method":..,"path":..,"version":..,"status":..,"bytes":..,"us":..,"referer":..,"ua":..}
+void AccessLog::Write(const Entry& e) {
+    thread_local char buf[LINE_MAX_LEN];
+    LineWriter w = { buf, 0, LINE_MAX_LEN - 1 };             // 留一个字节给换行
+    const char* now = LocalTime_(TimeCache::RealUs() / 1000000);
+    if(format_ == JSON) {
+        w.Put("{\"time\":\"");
+        w.Put(now);
+        w.Put("\",\"ip\":\"");
+        w.PutEscaped(e.ip, true, FIELD_MAX_LEN);
+        w.Put("\",\"method\":\"");
+        w.PutEscaped(e.method, true, FIELD_MAX_LEN);
+        w.Put("\",\"path\":\"");
+        w.PutEscaped(e.path, true, FIELD_MAX_LEN);
+        w.Put("\",\"version\":\"");
+        w.PutEscaped(e.version, true, FIELD_MAX_LEN);
+        w.Put("\",\"status\":");
+        w.PutNum(e.code);
+        w.Put(",\"bytes\":");
+        w.PutNum(e.bytes);
+        w.Put(",\"us\":");
+        w.PutNum(e.latencyUs);
+        w.Put(",\"referer\":\"");
+        w.PutEscaped(e.referer, true, FIELD_MAX_LEN);
+        w.Put("\",\"ua\":\"");
+        w.PutEscaped(e.userAgent, true, FIELD_MAX_LEN);
+        w.Put("\"}");
+    } else {
+        w.PutEscaped(e.ip, false, FIELD_MAX_LEN);
+        w.Put(" - - [");
+        w.Put(now);
+        w.Put("] \"");
+        w.PutEscaped(e.method, false, FIELD_MAX_LEN);
+        w.Put(' ');
+        w.PutEscaped(e.path, false, FIELD_MAX_LEN);
+        w.Put(" HTTP/");
+        w.PutEscaped(e.version, false, FIELD_MAX_LEN);
+        w.Put("\" ");
+        w.PutNum(e.code);
+        w.Put(' ');
+        w.PutNum(e.bytes);
+        if(format_ == COMBINED) {
+            w.Put(" \"");
+            w.PutEscaped(e.referer, false, FIELD_MAX_LEN);
+            w.Put("\" \"");
+            w.PutEscaped(e.userAgent, false, FIELD_MAX_LEN);
+            w.Put("\" ");
+            w.PutNum(e.latencyUs);
+        }
+    }
+    buf[w.len++] = '\n';
+
+    LogRing* ring = LocalRing_();
+    if(!ring->TryPush(buf, w.len)) {
+        dropped_.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    written_.fetch_add(1, memory_order_relaxed);
+    size_t size = ring->Size();
+    if(size * 2 >= ring->Capacity() && (size - w.len) * 2 < ring->Capacity()) {
+        lock_guard<mutex> locker(condMtx_);
+        wakeup_ = true;
+        cond_.notify_one();
+    }
+}
+
+AccessLog::Stats AccessLog::GetStats() const {
+    return { written_.load(memory_order_relaxed), sampledOut_.load(memory_order_relaxed),
+             dropped_.load(memory_order_relaxed) };
+}
+
+LogRing* AccessLog::LocalRing_() {
+    thread_local LocalRing local;
+    if(!local.ring) {
+        local.ring = make_shared<LogRing>(ringSize_);
+        lock_guard<mutex> locker(ringMtx_);
+        rings_.push_back(local.ring);
+    }
+    return local.ring.get();
+}
+
+// 和Log的写线程一样：所有缓冲区的数据放进一次writev，写不进去(磁盘出错)时丢掉这一批
+size_t AccessLog::WriteRings_() {
+    vector<shared_ptr<LogRing>> rings;
+    {
+        lock_guard<mutex> locker(ringMtx_);
+        rings = rings_;
+    }
+    vector<struct iovec> iov;
+    vector<size_t> lens(rings.size());
+    size_t total = 0;
+    bool hasClosed = false;
+    for(size_t i = 0; i < rings.size(); i++) {
+        const char *p1, *p2;
+        size_t l1, l2;
+        lens[i] = rings[i]->Peek(&p1, &l1, &p2, &l2);
+        if(l1 > 0) { iov.push_back({ const_cast<char*>(p1), l1 }); }
+        if(l2 > 0) { iov.push_back({ const_cast<char*>(p2), l2 }); }
+        total += lens[i];
+        if(rings[i]->IsClosed()) { hasClosed = true; }
+    }
+    struct iovec* vec = iov.data();
+    int cnt = iov.size();
+    while(cnt > 0) {
+        ssize_t n = writev(fd_, vec, min(cnt, IOV_MAX));
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            break;
+        }
+        while(cnt > 0 && static_cast<size_t>(n) >= vec->iov_len) {
+            n -= vec->iov_len;
+            vec++;
+            cnt--;
+        }
+        if(cnt > 0) {
+            vec->iov_base = static_cast<char*>(vec->iov_base) + n;
+            vec->iov_len -= n;
+        }
+    }
+    for(size_t i = 0; i < rings.size(); i++) { rings[i]->Consume(lens[i]); }
+    if(hasClosed) {
+        lock_guard<mutex> locker(ringMtx_);
+        for(size_t i = 0; i < rings_.size();) {
+            if(rings_[i]->IsClosed() && rings_[i]->Size() == 0) {
+                rings_[i] = rings_.back();
+                rings_.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+    return total;
+}
+
+void AccessLog::AsyncWrite_() {
+    while(true) {
+        size_t n = WriteRings_();
+        unique_lock<mutex> locker(condMtx_);
+        if(isClosed_) {
+            if(n == 0) { break; }
+            continue;
+        }
+        cond_.wait_for(locker, chrono::milliseconds(FLUSH_INTERVAL_MS), [this] { return wakeup_ || isClosed_; });
+        wakeup_ = false;
+    }
+}
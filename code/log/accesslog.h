@@ -0,0 +1,102 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+#include "logring.h"
+
+// 访问日志：每个完成的请求一行，和普通日志分开写到单独的文件。打日志的线程格式化后追加到自己的无锁环形缓冲区，
+// 写线程定时一次writev写出；缓冲区满时直接丢掉并计数，不会阻塞处理请求的线程。
+// 按状态码设置采样比例，没开启时请求路径上只多读一个原子变量
+class AccessLog {
+public:
+    enum FORMAT {                                           // 每行的格式
+        COMMON = 0,                                         // Common Log Format
+        COMBINED,                                           // Combined Log Format，末尾再加处理耗时(微秒)
+        JSON,                                               // 每行一个JSON对象
+    };
+
+    struct Entry {                                          // 一个请求的信息，字符串可以为空(输出为"-")
+        const char* ip;
+        const char* method;
+        const char* path;
+        const char* version;
+        const char* referer;
+        const char* userAgent;
+        int code;                                           // 响应状态码
+        size_t bytes;                                       // 发送的字节数(响应头加文件)
+        int64_t latencyUs;                                  // 从开始处理请求到响应发送完的时间
+    };
+
+    struct Stats {
+        uint64_t written;                                   // 放进缓冲区的行数
+        uint64_t sampledOut;                                // 被采样丢掉的行数
+        uint64_t dropped;                                   // 缓冲区满丢掉的行数
+    };
+
+    static AccessLog* Instance();
+
+    // 打开访问日志文件并启动写线程，ringSize是每个线程的缓冲区字节数
+    bool Open(const char* path, FORMAT format = COMBINED, size_t ringSize = 1 << 20);
+
+    // 状态码为code的请求保留rate(0~1)的比例。code为1~5时设置整类(2表示2xx)，后设置的覆盖前面的。在Open之前调用
+    void SetSampling(int code, double rate);
+
+    bool Sample(int code);                                  // 是否记录这个状态码的请求，先调用它再准备Entry
+    void Write(const Entry& entry);
+
+    Stats GetStats() const;
+
+    static bool Enabled() { return isOpen_.load(std::memory_order_relaxed); }
+    static int64_t NowUs();                                 // 计算耗时用的单调时钟(微秒)
+
+private:
+    AccessLog();
+    virtual ~AccessLog();
+
+    struct TimeStamp {                                      // 每个线程缓存的当前这一秒
+        time_t sec;
+        char text[32];                                      // COMMON/COMBINED为"18/Oct/2026:18:40:23 +0800"，JSON为ISO 8601
+    };
+
+    const char* LocalTime_(time_t sec);                     // 当前线程缓存的sec这一秒格式化好的时间
+    LogRing* LocalRing_();
+    size_t WriteRings_();
+    void AsyncWrite_();
+
+    static const int MAX_CODE = 600;
+    static const int LINE_MAX_LEN = 4096;
+    static const int FIELD_MAX_LEN = 1024;                  // 路径、Referer、User-Agent最多输出的长度
+    static constexpr int FLUSH_INTERVAL_MS = 200;
+
+    static std::atomic<bool> isOpen_;
+
+    int fd_;
+    FORMAT format_;
+    size_t ringSize_;
+    uint64_t keep_[MAX_CODE];                               // 随机数(32位)小于它时保留，1<<32表示全部保留
+
+    std::mutex ringMtx_;
+    std::vector<std::shared_ptr<LogRing>> rings_;
+    std::unique_ptr<std::thread> writeThread_;
+    std::mutex condMtx_;
+    std::condition_variable cond_;
+    bool wakeup_;
+    bool isClosed_;
+
+    std::atomic<uint64_t> written_;
+    std::atomic<uint64_t> sampledOut_;
+    std::atomic<uint64_t> dropped_;
+};
+
+#endif //ACCESS_LOG_H
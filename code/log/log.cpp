@@ -3,189 +3,632 @@
     Date         : 2022-12-24
 */
 #include "log.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>           // IOV_MAX
 
 using namespace std;
 
+std::atomic<int> Log::gate_(Log::LEVEL_OFF);
+const int Log::DROP_FILL_PCT[3] = { 50, 75, 90 };
+
+namespace {
+// 线程退出时关闭它的环形缓冲区，写线程读空后回收
+struct LocalRing {
+    shared_ptr<LogRing> ring;
+    ~LocalRing() { if(ring) { ring->Close(); } }
+};
+}
+
 Log::Log() {
-    lineCount_ = 0;
+    fileBytes_ = 0;
+    fileBinary_ = false;
+    formatsWritten_ = 0;
+    fileIndex_ = 0;
+    toDay_ = 0;
+    isOpen_ = false;
+    level_ = 1;
     isAsync_ = false;
+    backend_ = RING_BACKEND;
+    isBinary_ = false;
+    queueCapacity_ = 0;
+    ringSize_ = 0;
+    fd_ = -1;
+    blockCount_ = 0;
     writeThread_ = nullptr;
-    deque_ = nullptr;
-    toDay_ = 0;
-    fp_ = nullptr;
+    wakeup_ = false;
+    isClosed_ = false;
+    archiver_.reset(new LogArchiver);
+    overflow_ = OVERFLOW_BLOCK;
+    for(int i = 0; i < 4; i++) {
+        dropped_[i] = 0;
+        reported_[i] = 0;
+    }
+    spilled_ = 0;
+    blocked_ = 0;
+    spillBytes_ = 0;
 }
 
 Log::~Log() {
     if(writeThread_ && writeThread_->joinable()) {
-        while(!deque_->empty()) {
-            deque_->flush();
-        };
-        deque_->Close();
+        {
+            lock_guard<mutex> locker(condMtx_);
+            isClosed_ = true;
+        }
+        cond_.notify_one();
         writeThread_->join();
     }
-    if(fp_) {
+    archiver_->Stop();                  // 压缩线程也会打日志，在关闭文件之前停掉；写线程已经不会再轮换文件
+    if(fd_ >= 0) {
         lock_guard<mutex> locker(mtx_);
-        flush();
-        fclose(fp_);
+        close(fd_);
+        fd_ = -1;
     }
 }
 
-// 获得日志等级
-int Log::GetLevel() {
-    lock_guard<mutex> locker(mtx_);
-    return level_;
-}
-
-// 设置日志等级
-void Log::SetLevel(int level) {
-    lock_guard<mutex> locker(mtx_);
-    level_ = level;
-}
-
 // 初始化日志对象
 void Log::init(int level = 1, const char* path, const char* suffix,
-    int maxQueueSize) {
-    isOpen_ = true;
+    int maxQueueSize, BACKEND backend, bool binary) {
     level_ = level;
+    queueCapacity_ = maxQueueSize;
     if(maxQueueSize > 0) {
-        isAsync_ = true;
-        if(!deque_) {
-            unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-            deque_ = move(newDeque);
-            
+        /* 至少能放下两行最长的日志 */
+        ringSize_ = max(static_cast<size_t>(maxQueueSize) * AVG_LINE_LEN, static_cast<size_t>(LINE_MAX_LEN) * 2);
+        if(backend == BLOCK_BACKEND) {
+            lock_guard<mutex> locker(blockMtx_);
+            while(blockCount_ < SPARE_BLOCKS) {
+                spareBlocks_.emplace_back(new Block);
+                blockCount_++;
+            }
+            if(!curBlock_) {
+                curBlock_ = move(spareBlocks_.back());
+                spareBlocks_.pop_back();
+            }
+        }
+        if(!writeThread_) {
             std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
             writeThread_ = move(NewThread);
         }
-    } else {
-        isAsync_ = false;
     }
 
-    lineCount_ = 0;
-
-    time_t timer = time(nullptr);
-    struct tm *sysTime = localtime(&timer);
-    struct tm t = *sysTime;
-    path_ = path;
-    suffix_ = suffix;
-    char fileName[LOG_NAME_LEN] = {0};
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", 
-            path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
-    toDay_ = t.tm_mday;
-
+    const struct tm& t = LocalTime_(time(nullptr)).t;
+    if(writeThread_) {
+        /* 重新初始化前已经打的日志留在原来的文件里 */
+        string spill = TakeSpill_();
+        WriteRings_(t);
+        WriteBlocks_(t);
+        WriteSpill_(t, spill);
+    }
     {
         lock_guard<mutex> locker(mtx_);
-        buff_.RetrieveAll();
-        if(fp_) { 
-            flush();
-            fclose(fp_); 
-        }
-
-        fp_ = fopen(fileName, "a");
-        if(fp_ == nullptr) {
-            mkdir(path_, 0777);
-            fp_ = fopen(fileName, "a");
-        } 
-        assert(fp_ != nullptr);
+        path_ = path;
+        suffix_ = suffix;
+        toDay_ = t.tm_mday;
+        fileDate_ = t;
+        fileIndex_ = 0;
+        fileBinary_ = binary;
+        OpenFile_();
     }
+    backend_ = backend;
+    isBinary_ = binary;
+    isAsync_ = maxQueueSize > 0;
+    isOpen_ = true;
+    gate_ = level;
 }
 
-// (如果开启异步方式)先向自己缓冲区写入日志信息，然后将缓冲区的日志数据封装成一个string字符串加入日志队列，由子线程取出写到文件中
+void Log::SetLevel(int level) {
+    level_.store(level, memory_order_relaxed);
+    if(IsOpen()) { gate_.store(level, memory_order_relaxed); }
+}
+
+void Log::SetArchive(bool compress, size_t maxFiles, uint64_t maxBytes) {
+    lock_guard<mutex> locker(mtx_);
+    if(!archiver_->IsStarted()) { archiver_->Start(path_, fileName_, compress, maxFiles, maxBytes); }
+}
+
+void Log::SetBackend(BACKEND backend, bool binary) {
+    init(GetLevel(), path_, suffix_, queueCapacity_, backend, binary);
+}
+
+// 时间戳、等级标签和内容格式化到线程自己的缓冲区，异步方式下整行交给写线程。
+// 二进制方式下只在这里格式化内容，作为一条BIN_TEXT记录
 void Log::write(int level, const char *format, ...) {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, nullptr);
-    time_t tSec = now.tv_sec;
-    struct tm *sysTime = localtime(&tSec);
-    struct tm t = *sysTime;
+    char* line = LocalBuffer_();
+    int64_t nowUs = TimeCache::RealUs();     // 事件循环线程读缓存，其他线程直接读时钟
+    va_list vaList;
+    va_start(vaList, format);
+    size_t n = FormatLine_(line, level, nowUs, format, vaList);
+    va_end(vaList);
+    PushRecord_(line, n, level, nowUs);
+}
+
+// 写线程自己的报告不经过缓冲区，缓冲区满的时候也能写出去
+void Log::WriteNow_(int level, const char* format, ...) {
+    char* line = LocalBuffer_();
+    int64_t nowUs = TimeCache::RealUs();
     va_list vaList;
+    va_start(vaList, format);
+    size_t n = FormatLine_(line, level, nowUs, format, vaList);
+    va_end(vaList);
+    WriteSync_(line, n, nowUs);
+}
 
-    /* 日志日期 日志行数 */
-    if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_  %  MAX_LINES == 0)))
-    {
-        unique_lock<mutex> locker(mtx_);
-        locker.unlock();
-        
-        char newFile[LOG_NAME_LEN];
-        char tail[36] = {0};
-        snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+size_t Log::FormatLine_(char* line, int level, int64_t nowUs, const char* format, va_list vaList) {
+    int n;
+    if(isBinary_.load(memory_order_relaxed)) {
+        line[4] = BIN_TEXT;
+        memcpy(line + 5, &nowUs, 8);
+        line[13] = static_cast<char>(level);
+        n = 14;
+    } else {
+        /* 同一秒内只复制缓存的日期时间，再填上微秒 */
+        memcpy(line, LocalTime_(nowUs / 1000000).text, 19);
+        line[19] = '.';
+        int us = nowUs % 1000000;
+        for(int i = 25; i >= 20; i--) {
+            line[i] = '0' + us % 10;
+            us /= 10;
+        }
+        line[26] = ' ';
+        memcpy(line + 27, LevelTitle_(level), 9);
+        n = 36;
+    }
 
-        if (toDay_ != t.tm_mday)
-        {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
-            toDay_ = t.tm_mday;
-            lineCount_ = 0;
+    int m = vsnprintf(line + n, LINE_MAX_LEN - n - 1, format, vaList);
+    if(m > 0) { n += min(m, LINE_MAX_LEN - n - 2); }    // 太长的截断，留一个字节给换行
+
+    if(isBinary_.load(memory_order_relaxed)) {
+        uint32_t len = n - 4;
+        memcpy(line, &len, 4);
+    } else {
+        line[n++] = '\n';
+    }
+    return n;
+}
+
+// 秒数变化时才调用localtime_r(要拿glibc的时区锁)和strftime，同一秒内的日志和轮换检查都用缓存
+const Log::TimeStamp& Log::LocalTime_(time_t sec) {
+    thread_local TimeStamp ts = { -1, {}, {} };
+    if(ts.sec != sec) {
+        localtime_r(&sec, &ts.t);
+        strftime(ts.text, sizeof(ts.text), "%Y-%m-%d %H:%M:%S", &ts.t);
+        ts.sec = sec;
+    }
+    return ts;
+}
+
+char* Log::LocalBuffer_() {
+    thread_local char buf[LINE_MAX_LEN];
+    return buf;
+}
+
+void Log::PutStr_(char*& p, char* end, const char* str, size_t len) {
+    if(end - p < 2) {
+        p = end;
+        return;
+    }
+    uint16_t n = min({ len, static_cast<size_t>(UINT16_MAX), static_cast<size_t>(end - p - 2) });
+    memcpy(p, &n, 2);
+    memcpy(p + 2, str, n);
+    p += 2 + n;
+}
+
+uint32_t Log::RegisterSite_(Site& site, const char* types) {
+    lock_guard<mutex> locker(fmtMtx_);
+    uint32_t id = site.id.load(memory_order_relaxed);
+    if(id != 0) { return id; }          // 别的线程刚登记过
+    id = formats_.size() + 1;
+    int32_t line = site.line;
+    string rec(4, '\0');
+    rec += BIN_FORMAT;
+    rec.append(reinterpret_cast<const char*>(&id), 4);
+    rec.append(reinterpret_cast<const char*>(&line), 4);
+    rec.append(site.file).append(1, '\0');
+    rec.append(site.format).append(1, '\0');
+    rec.append(types).append(1, '\0');
+    uint32_t len = rec.size() - 4;
+    memcpy(&rec[0], &len, 4);
+    formats_.push_back(move(rec));
+    site.id.store(id, memory_order_release);
+    return id;
+}
+
+void Log::PushRecord_(const char* rec, size_t len, int level, int64_t nowUs) {
+    if(isAsync_.load(memory_order_relaxed)) {
+        int policy = overflow_.load(memory_order_relaxed);
+        if(policy == OVERFLOW_SPILL && spillBytes_.load(memory_order_relaxed) > 0 && !isClosed_) {
+            /* 溢出缓冲区还没写出时后面的行也放进去，同一线程的日志不会乱序 */
+            Spill_(rec, len, level);
+            return;
         }
-        else {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_  / MAX_LINES), suffix_);
+        bool pushed = backend_.load(memory_order_relaxed) == BLOCK_BACKEND ?
+                      PushBlock_(rec, len, level, policy) : PushRing_(rec, len, level, policy);
+        if(pushed) { return; }
+    }
+    /* 同步方式，或者写线程已经退出 */
+    WriteSync_(rec, len, nowUs);
+}
+
+void Log::WriteSync_(const char* rec, size_t len, int64_t nowUs) {
+    const struct tm& t = LocalTime_(nowUs / 1000000).t;
+    lock_guard<mutex> locker(mtx_);
+    RotateIfNeeded_(t);
+    WriteFormats_();
+    struct iovec iov = { const_cast<char*>(rec), len };
+    WriteFile_(&iov, 1);
+}
+
+bool Log::PushRing_(const char* line, size_t len, int level, int policy) {
+    LogRing* ring = LocalRing_();
+    if(policy == OVERFLOW_DROP_LEVEL && level >= 0 && level < 3 &&
+       ring->Size() * 100 >= ring->Capacity() * DROP_FILL_PCT[level]) {
+        Drop_(level);
+        return true;
+    }
+    while(!ring->TryPush(line, len)) {
+        if(isClosed_) { return false; }
+        if(policy == OVERFLOW_SPILL) {
+            Spill_(line, len, level);
+            return true;
         }
-        
-        locker.lock();
-        flush();
-        fclose(fp_);
-        fp_ = fopen(newFile, "a");  // 以追加方式打开文件。如果文件不存在，那么创建一个新文件；如果文件存在，那么将写入的数据追加到文件的末尾（文件原有的内容保留）
-        assert(fp_ != nullptr);
+        if(policy != OVERFLOW_BLOCK) {
+            Drop_(level);
+            return true;
+        }
+        /* 写线程跟不上，叫醒它，等腾出空间 */
+        blocked_.fetch_add(1, memory_order_relaxed);
+        unique_lock<mutex> locker(condMtx_);
+        if(isClosed_) { return false; }
+        wakeup_ = true;
+        cond_.notify_one();
+        /* 在condMtx_下重新检查空位，写线程每次醒来腾出空间后也拿这把锁通知，不会漏掉唤醒 */
+        spaceCond_.wait_for(locker, chrono::milliseconds(FLUSH_INTERVAL_MS),
+                            [this, ring, len] { return isClosed_ || len <= ring->Capacity() - ring->Size(); });
     }
+    /* 刚超过一半时叫醒写线程，平时靠它定时醒来 */
+    size_t size = ring->Size();
+    if(size * 2 >= ring->Capacity() && (size - len) * 2 < ring->Capacity()) { WakeWriter_(); }
+    return true;
+}
 
-    {
-        unique_lock<mutex> locker(mtx_);
-        lineCount_++;
-        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-                    t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
-                    
-        buff_.HasWritten(n);
-        AppendLogLevelTitle_(level);
-
-        va_start(vaList, format);
-        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
-        va_end(vaList);
-
-        buff_.HasWritten(m);
-        buff_.Append("\n\0", 2);
-
-        if(isAsync_ && deque_ && !deque_->full()) {
-            deque_->push_back(buff_.RetrieveAllToStr());
+// 当前块放不下时把它放进写满的队列，换一个空块；块都在等写线程时等它还回来
+bool Log::PushBlock_(const char* line, size_t len, int level, int policy) {
+    unique_lock<mutex> locker(blockMtx_);
+    if(policy == OVERFLOW_DROP_LEVEL && level >= 0 && level < 3 &&
+       (blockCount_ - spareBlocks_.size()) * 100 >= MAX_BLOCKS * DROP_FILL_PCT[level]) {
+        locker.unlock();
+        Drop_(level);
+        return true;
+    }
+    while(curBlock_->len + len > BLOCK_SIZE) {
+        if(isClosed_) { return false; }
+        if(!spareBlocks_.empty() || blockCount_ < MAX_BLOCKS) {
+            fullBlocks_.push_back(move(curBlock_));
+            if(spareBlocks_.empty()) {
+                curBlock_.reset(new Block);
+                blockCount_++;
+            } else {
+                curBlock_ = move(spareBlocks_.back());
+                spareBlocks_.pop_back();
+            }
+            WakeWriter_();
+        } else if(policy == OVERFLOW_SPILL) {
+            locker.unlock();
+            Spill_(line, len, level);
+            return true;
+        } else if(policy != OVERFLOW_BLOCK) {
+            locker.unlock();
+            Drop_(level);
+            return true;
         } else {
-            fputs(buff_.Peek(), fp_);
+            blocked_.fetch_add(1, memory_order_relaxed);
+            WakeWriter_();
+            blockCond_.wait_for(locker, chrono::milliseconds(FLUSH_INTERVAL_MS));
         }
-        buff_.RetrieveAll();
     }
+    memcpy(curBlock_->data.get() + curBlock_->len, line, len);
+    curBlock_->len += len;
+    return true;
+}
+
+// 溢出缓冲区也满了时丢掉
+void Log::Spill_(const char* line, size_t len, int level) {
+    bool wake;
+    {
+        lock_guard<mutex> locker(spillMtx_);
+        if(spill_.size() + len > MAX_SPILL_BYTES) {
+            Drop_(level);
+            return;
+        }
+        wake = spill_.empty();
+        spill_.append(line, len);
+        spillBytes_.store(spill_.size(), memory_order_relaxed);
+    }
+    spilled_.fetch_add(1, memory_order_relaxed);
+    if(wake) { WakeWriter_(); }
+}
+
+void Log::Drop_(int level) {
+    dropped_[level >= 0 && level < 4 ? level : 1].fetch_add(1, memory_order_relaxed);
+}
+
+Log::OverflowStats Log::GetOverflowStats() {
+    OverflowStats stats;
+    for(int i = 0; i < 4; i++) { stats.dropped[i] = dropped_[i].load(memory_order_relaxed); }
+    stats.spilled = spilled_.load(memory_order_relaxed);
+    stats.blocked = blocked_.load(memory_order_relaxed);
+    stats.spillBytes = spillBytes_.load(memory_order_relaxed);
+    return stats;
 }
 
 // 追加日志等级标签
-void Log::AppendLogLevelTitle_(int level) {
+const char* Log::LevelTitle_(int level) {
     switch(level) {
     case 0:
-        buff_.Append("[debug]: ", 9);
-        break;
+        return "[debug]: ";
     case 1:
-        buff_.Append("[info] : ", 9);
-        break;
+        return "[info] : ";
     case 2:
-        buff_.Append("[warn] : ", 9);
-        break;
+        return "[warn] : ";
     case 3:
-        buff_.Append("[error]: ", 9);
-        break;
+        return "[error]: ";
     default:
-        buff_.Append("[info] : ", 9);
-        break;
+        return "[info] : ";
     }
 }
 
-// 唤醒一个子线程，把可能还在日志队列中的信息取出输出到文件中，调用fflush(stream)会将标准缓冲区中的内容清空并写到stream所指的文件中去
+// 同步方式下每行直接write，没有需要刷的缓冲
 void Log::flush() {
-    if(isAsync_) { 
-        deque_->flush(); // 唤醒消费者，把可能还在日志队列中的信息输出到文件中
+    if(writeThread_) { WakeWriter_(); }
+}
+
+LogRing* Log::LocalRing_() {
+    thread_local LocalRing local;
+    if(!local.ring) {
+        local.ring = make_shared<LogRing>(ringSize_);
+        lock_guard<mutex> locker(ringMtx_);
+        rings_.push_back(local.ring);
     }
-    fflush(fp_); // 调用fflush(stream)会将标准缓冲区中的内容清空并写到stream所指的文件中去.若stream为NULL，则会将所有打开的文件进行数据更新
+    return local.ring.get();
 }
 
-// 子线程执行，无限循环异步写日志，直到pop()函数中子线程关闭标志isClose_为真返回false
-void Log::AsyncWrite_() {
-    string str = "";
-    while(deque_->pop(str)) {
+void Log::WakeWriter_() {
+    lock_guard<mutex> locker(condMtx_);
+    wakeup_ = true;
+    cond_.notify_one();
+}
+
+// 每个环形缓冲区最多两段，全部放进一次writev；一个缓冲区里读到的都是整行，只在批次之间切换文件
+size_t Log::WriteRings_(const struct tm& t) {
+    vector<shared_ptr<LogRing>> rings;
+    {
+        lock_guard<mutex> locker(ringMtx_);
+        rings = rings_;
+    }
+    vector<struct iovec> iov;
+    vector<size_t> lens(rings.size());
+    size_t total = 0;
+    bool hasClosed = false;
+    {
         lock_guard<mutex> locker(mtx_);
-        fputs(str.c_str(), fp_); // str代表要输出的字符串的首地址,fp_代表输出文件流
+        for(size_t i = 0; i < rings.size(); i++) {
+            const char *p1, *p2;
+            size_t l1, l2;
+            lens[i] = rings[i]->Peek(&p1, &l1, &p2, &l2);
+            if(l1 > 0) { iov.push_back({ const_cast<char*>(p1), l1 }); }
+            if(l2 > 0) { iov.push_back({ const_cast<char*>(p2), l2 }); }
+            total += lens[i];
+            if(rings[i]->IsClosed()) { hasClosed = true; }
+        }
+        if(total > 0) {
+            RotateIfNeeded_(t);
+            WriteFormats_();                // 记录里用到的格式都在取数据之前登记过
+            WriteFile_(iov.data(), iov.size());
+            for(size_t i = 0; i < rings.size(); i++) { rings[i]->Consume(lens[i]); }
+        }
+    }
+    if(hasClosed) {
+        /* 线程已退出并且读空了的缓冲区不再需要 */
+        lock_guard<mutex> locker(ringMtx_);
+        for(size_t i = 0; i < rings_.size();) {
+            if(rings_[i]->IsClosed() && rings_[i]->Size() == 0) {
+                rings_[i] = rings_.back();
+                rings_.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+    return total;
+}
+
+// 取走写满的块，当前块有数据并且有空块可换时也一起取走，写完后还回去。
+// 整个过程持有mtx_，init时和写线程同时调用也不会打乱块的顺序
+size_t Log::WriteBlocks_(const struct tm& t) {
+    lock_guard<mutex> locker(mtx_);
+    vector<unique_ptr<Block>> batch;
+    {
+        lock_guard<mutex> blockLocker(blockMtx_);
+        if(!curBlock_) { return 0; }
+        batch.swap(fullBlocks_);
+        /* 溢出缓冲区有数据时当前块里的行更早，没有空块也要先写出去 */
+        if(curBlock_->len > 0 && (!spareBlocks_.empty() || spillBytes_.load(memory_order_relaxed) > 0)) {
+            batch.push_back(move(curBlock_));
+            if(spareBlocks_.empty()) {
+                curBlock_.reset(new Block);
+                blockCount_++;
+            } else {
+                curBlock_ = move(spareBlocks_.back());
+                spareBlocks_.pop_back();
+            }
+        }
+    }
+    if(batch.empty()) { return 0; }
+    vector<struct iovec> iov;
+    size_t total = 0;
+    for(auto& block : batch) {
+        iov.push_back({ block->data.get(), block->len });
+        total += block->len;
+    }
+    RotateIfNeeded_(t);
+    WriteFormats_();
+    WriteFile_(iov.data(), iov.size());
+    {
+        /* 只留SPARE_BLOCKS个空块，高峰时多分配的释放掉 */
+        lock_guard<mutex> blockLocker(blockMtx_);
+        for(auto& block : batch) {
+            if(spareBlocks_.size() < SPARE_BLOCKS) {
+                block->len = 0;
+                spareBlocks_.push_back(move(block));
+            } else {
+                blockCount_--;
+            }
+        }
+    }
+    blockCond_.notify_all();
+    return total;
+}
+
+// 已经存在的文件(同一天重启)写满了就接着往后找
+void Log::RotateIfNeeded_(const struct tm& t) {
+    if(toDay_ != t.tm_mday) {
+        toDay_ = t.tm_mday;
+        fileDate_ = t;
+        fileIndex_ = 0;
+        OpenFile_();
+    }
+    while(fileBytes_ >= MAX_FILE_BYTES) {
+        fileIndex_++;
+        OpenFile_();
+    }
+}
+
+// 二进制文件每次打开都先写BIN_MAGIC，解码时遇到它就清空格式表，重启后追加到同一个文件也能解开
+void Log::OpenFile_() {
+    char fileName[LOG_NAME_LEN] = {0};
+    const char* suffix = fileBinary_ ? ".bin" : suffix_;
+    if(fileIndex_ == 0) {
+        snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
+                path_, fileDate_.tm_year + 1900, fileDate_.tm_mon + 1, fileDate_.tm_mday, suffix);
+    } else {
+        snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d-%d%s",
+                path_, fileDate_.tm_year + 1900, fileDate_.tm_mon + 1, fileDate_.tm_mday, fileIndex_, suffix);
+    }
+    if(fd_ >= 0) { close(fd_); }
+    if(!fileName_.empty() && fileName_ != fileName) { archiver_->Rotated(fileName_, fileName); }
+    fileName_ = fileName;
+    // 以追加方式打开文件。如果文件不存在，那么创建一个新文件；如果文件存在，那么将写入的数据追加到文件的末尾（文件原有的内容保留）
+    fd_ = open(fileName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if(fd_ < 0) {
+        mkdir(path_, 0777);
+        fd_ = open(fileName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    }
+    assert(fd_ >= 0);
+    struct stat st;
+    fileBytes_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+    if(fileBinary_) {
+        struct iovec iov = { const_cast<char*>(BIN_MAGIC), BIN_MAGIC_LEN };
+        WriteFile_(&iov, 1);
+        formatsWritten_ = 0;
+    }
+}
+
+void Log::WriteFormats_() {
+    if(!fileBinary_) { return; }
+    string data;
+    {
+        lock_guard<mutex> locker(fmtMtx_);
+        for(; formatsWritten_ < formats_.size(); formatsWritten_++) { data += formats_[formatsWritten_]; }
+    }
+    if(data.empty()) { return; }
+    struct iovec iov = { &data[0], data.size() };
+    WriteFile_(&iov, 1);
+}
+
+// 处理writev只写了一部分的情况；磁盘出错时丢掉这一批，日志系统没有别的地方可以报错
+void Log::WriteFile_(struct iovec* iov, int cnt) {
+    while(cnt > 0) {
+        ssize_t n = writev(fd_, iov, min(cnt, IOV_MAX));
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            return;
+        }
+        fileBytes_ += n;
+        while(cnt > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if(cnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// 先取走溢出缓冲区：它里面每个线程的行都晚于这时已经在环形缓冲区和块里的行。
+// spillBytes_不清零，生产者继续往溢出缓冲区放，直到取走的这些写完
+string Log::TakeSpill_() {
+    string data;
+    lock_guard<mutex> locker(spillMtx_);
+    data.swap(spill_);
+    return data;
+}
+
+// 在环形缓冲区和块之后写；写完时溢出缓冲区没有新数据就恢复正常的放法
+size_t Log::WriteSpill_(const struct tm& t, string& data) {
+    if(!data.empty()) {
+        lock_guard<mutex> locker(mtx_);
+        RotateIfNeeded_(t);
+        WriteFormats_();
+        struct iovec iov = { &data[0], data.size() };
+        WriteFile_(&iov, 1);
+    }
+    lock_guard<mutex> locker(spillMtx_);
+    if(spill_.empty()) { spillBytes_.store(0, memory_order_relaxed); }
+    return data.size();
+}
+
+void Log::ReportDropped_() {
+    uint64_t delta[4], total = 0;
+    for(int i = 0; i < 4; i++) {
+        uint64_t dropped = dropped_[i].load(memory_order_relaxed);
+        delta[i] = dropped - reported_[i];
+        reported_[i] = dropped;
+        total += delta[i];
+    }
+    if(total == 0) { return; }
+    WriteNow_(2, "Log overflow: %llu lines dropped (debug %llu, info %llu, warn %llu, error %llu)",
+              (unsigned long long)total, (unsigned long long)delta[0], (unsigned long long)delta[1],
+              (unsigned long long)delta[2], (unsigned long long)delta[3]);
+}
+
+// 子线程执行：隔FLUSH_INTERVAL_MS，或者被环形缓冲区过半、块写满叫醒时，把缓冲的日志一次写出。
+// 轮换文件也只在这里(和同步方式的write里)做；退出前把缓冲区读空。丢弃数每DROP_REPORT_MS报告一次
+void Log::AsyncWrite_() {
+    int64_t reportMs = TimeCache::ReadNowMs();
+    while(true) {
+        const struct tm& t = LocalTime_(TimeCache::RealUs() / 1000000).t;
+        string spill = TakeSpill_();
+        size_t n = WriteRings_(t) + WriteBlocks_(t);
+        n += WriteSpill_(t, spill);
+        if(TimeCache::ReadNowMs() - reportMs >= DROP_REPORT_MS) {
+            ReportDropped_();
+            reportMs = TimeCache::ReadNowMs();
+        }
+        unique_lock<mutex> locker(condMtx_);
+        spaceCond_.notify_all();                    // 持锁通知，等空位的生产者检查完条件前不会错过
+        if(isClosed_) {
+            if(n == 0) {
+                locker.unlock();
+                ReportDropped_();
+                break;
+            }
+            continue;
+        }
+        cond_.wait_for(locker, chrono::milliseconds(FLUSH_INTERVAL_MS), [this] { return wakeup_ || isClosed_; });
+        wakeup_ = false;
     }
 }
 
@@ -196,6 +639,6 @@ Log* Log::Instance() {
 }
 
 // 子线程调用AsyncWrite_()无限循环异步写日志
-void Log::FlushLogThread() {    
+void Log::FlushLogThread() {
     Log::Instance()->AsyncWrite_();
-}
\ No newline at end of file
+}
@@ -6,76 +6,297 @@
 #define LOG_H
 
 #include <mutex>
+#include <condition_variable>
 #include <string>
 #include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <type_traits>
+#include <stdint.h>
 #include <sys/time.h>
+#include <sys/uio.h>          // writev
 #include <string.h>
 #include <stdarg.h>           // vastart va_end
 #include <assert.h>
 #include <sys/stat.h>         //mkdir
-#include "blockqueue.h"
+#include "logring.h"
+#include "logarchiver.h"
 #include "../buffer/buffer.h"
+#include "../timer/timecache.h"
+
+// 编译期的最低日志等级：低于它的LOG_DEBUG等语句连同参数求值一起被去掉，运行时再调低等级也不会输出。
+// 构建时用-DLOG_MIN_LEVEL=n指定，默认全部保留
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
 
 class Log {
 public:
+    enum BACKEND {                                          // 异步方式下日志行交给写线程的方式
+        RING_BACKEND = 0,                                   // 每个线程独占一个无锁环形缓冲区
+        BLOCK_BACKEND,                                      // 所有线程追加到同一个预分配的大块，写满后和空块交换
+    };
+
+    enum OVERFLOW_POLICY {                                  // 异步方式下缓冲区满时的处理
+        OVERFLOW_BLOCK = 0,                                 // 等写线程腾出空间，不丢日志
+        OVERFLOW_DROP_NEWEST,                               // 丢掉放不下的这一行
+        OVERFLOW_DROP_LEVEL,                                // 按缓冲区占用先丢低等级：超过一半丢DEBUG，3/4丢INFO，90%丢WARN，满了才丢ERROR
+        OVERFLOW_SPILL,                                     // 放进有上限的溢出缓冲区，它也满了才丢
+    };
+
+    struct OverflowStats {
+        uint64_t dropped[4];                                // 各等级丢掉的行数
+        uint64_t spilled;                                   // 放进溢出缓冲区的行数
+        uint64_t blocked;                                   // 生产者等待空间的次数
+        size_t spillBytes;                                  // 溢出缓冲区当前的字节数
+    };
+
+    struct Site {                                           // 二进制方式下一个打日志的位置，常量初始化的静态变量
+        const char* format;
+        const char* file;
+        int line;
+        std::atomic<uint32_t> id;                           // 登记后的格式编号，0表示还没登记
+    };
+
+    // 二进制日志文件：开头(每次打开文件都写)是BIN_MAGIC，后面是一条条记录：u32长度(不含自身) u8类型 内容。
+    // BIN_FORMAT: u32编号 i32行号 文件名\0 格式串\0 参数类型\0，用到某个编号的记录之前一定先写过它的描述；
+    // BIN_RECORD: u32编号 i64微秒时间戳 u8等级 参数，整数和浮点按类型码的宽度原样复制，字符串是u16长度加内容；
+    // BIN_TEXT: i64微秒时间戳 u8等级 已经格式化好的内容。记录被截断时后面的参数缺失
+    static constexpr char BIN_MAGIC[] = "WSBLOG1\n";
+    static const int BIN_MAGIC_LEN = 8;
+    static const char BIN_FORMAT = 'D';
+    static const char BIN_RECORD = 'R';
+    static const char BIN_TEXT = 'T';
+
     void init(int level, const char* path = "./log",        // 初始化日志对象
                 const char* suffix =".log",
-                int maxQueueCapacity = 1024);
+                int maxQueueCapacity = 1024,
+                BACKEND backend = RING_BACKEND,
+                bool binary = false);                       // 写二进制日志，文件后缀是.bin，用logdecode解码
+    // 用原来的路径、等级和队列容量重新打开日志，换成另一种方式。在开始处理请求之前调用
+    void SetBackend(BACKEND backend, bool binary);
+    // 开启轮换文件的后台压缩(compress)和保留策略：轮换下来的文件最多留maxFiles个、总共maxBytes字节，0表示不限制。
+    // 在init之后调用一次
+    void SetArchive(bool compress, size_t maxFiles, uint64_t maxBytes);
+    LogArchiver::Stats GetArchiveStats() { return archiver_->GetStats(); }         // 轮换和压缩的状态
+    // 缓冲区满时的处理方式。丢掉的行数由写线程每DROP_REPORT_MS在日志里报告一次
+    void SetOverflowPolicy(OVERFLOW_POLICY policy) { overflow_.store(policy, std::memory_order_relaxed); }
+    OverflowStats GetOverflowStats();
 
     static Log* Instance();                                 // 取得单例模式的实例
     static void FlushLogThread();                           // 调用AsyncWrite_()异步写日志
-    // (如果开启异步方式)先向自己缓冲区写入日志信息，然后将缓冲区的日志数据封装成一个string字符串加入日志队列，由子线程取出写到文件中
+    // 在本线程的缓冲区格式化一行。异步方式下交给写线程成批写到文件中，同步方式下直接write
     void write(int level, const char *format,...);
-    // 唤醒一个子线程，把可能还在日志队列中的信息取出输出到文件中，调用fflush(stream)会将标准缓冲区中的内容清空并写到stream所指的文件中去
+    // 二进制方式：调用点的格式串第一次使用时登记一次，之后只复制参数和时间戳，格式化留给离线解码工具
+    template<class... Args>
+    void writeBin(int level, Site& site, const Args&... args);
+    // 叫醒写线程，把已经缓冲的日志马上写到文件，不等待。平时缓冲区过半、块写满或者隔FLUSH_INTERVAL_MS写一次
     void flush();
 
-    int GetLevel();                                         // 获得日志等级
-    void SetLevel(int level);                               // 设置日志等级
-    bool IsOpen() { return isOpen_; }                       // 日志是否打开
-    
+    int GetLevel() { return level_.load(std::memory_order_relaxed); }             // 获得日志等级
+    void SetLevel(int level);                                                     // 设置日志等级
+    bool IsOpen() { return isOpen_.load(std::memory_order_relaxed); }             // 日志是否打开
+    bool IsBinary() { return isBinary_.load(std::memory_order_relaxed); }         // 是否写二进制日志
+    // 日志打开并且level不低于当前等级，打日志前只读一次这个原子变量，不用先取单例
+    static bool Enabled(int level) { return level >= gate_.load(std::memory_order_relaxed); }
+
 private:
+    struct TimeStamp {                                      // 每个线程缓存的当前这一秒
+        time_t sec;
+        struct tm t;                                        // 本地时间，轮换文件时按它判断换天
+        char text[20];                                      // "YYYY-MM-DD HH:MM:SS"
+    };
+
+    struct Block {                                          // 双缓冲方式下生产者追加的大块
+        std::unique_ptr<char[]> data;
+        size_t len;
+        Block(): data(new char[BLOCK_SIZE]), len(0) {}
+    };
+
     Log();
-    void AppendLogLevelTitle_(int level);                   // 追加日志等级标签
+    static const char* LevelTitle_(int level);              // 日志等级标签
+    static const TimeStamp& LocalTime_(time_t sec);         // 当前线程缓存的sec这一秒的本地时间
+    template<class T>
+    static constexpr char BinType_();                       // 参数的类型码
+    template<class T>
+    static void PutArg_(char*& p, char* end, const T& arg); // 按类型码复制一个参数，放不下时p置为end
+    static void PutStr_(char*& p, char* end, const char* str, size_t len);
+    static char* LocalBuffer_();                            // 当前线程格式化一行或拼一条二进制记录的缓冲区，LINE_MAX_LEN大小
+    uint32_t RegisterSite_(Site& site, const char* types);  // 登记格式描述，返回编号
+    // 时间戳、等级和内容格式化到line，返回长度
+    size_t FormatLine_(char* line, int level, int64_t nowUs, const char* format, va_list vaList);
+    void PushRecord_(const char* rec, size_t len, int level, int64_t nowUs);  // 交给写线程，同步方式下直接写
+    void WriteSync_(const char* rec, size_t len, int64_t nowUs);  // 加锁直接写到文件
+    void WriteNow_(int level, const char* format, ...);     // 格式化后直接写到文件，写线程报告丢弃数用
     virtual ~Log();
     void AsyncWrite_();                                     // 异步写日志
+    LogRing* LocalRing_();                                  // 当前线程的环形缓冲区，第一次使用时创建并登记
+    // 以下按溢出策略放进缓冲区或者丢掉，写线程已退出时返回false
+    bool PushRing_(const char* line, size_t len, int level, int policy);  // 追加到本线程的环形缓冲区
+    bool PushBlock_(const char* line, size_t len, int level, int policy); // 追加到当前块
+    void Spill_(const char* line, size_t len, int level);   // 放进溢出缓冲区
+    void Drop_(int level);                                  // 记一次丢弃
+    std::string TakeSpill_();                               // 取走溢出缓冲区的数据，在写环形缓冲区和块之前调用
+    size_t WriteSpill_(const struct tm& t, std::string& data);   // 写出取走的数据，返回字节数
+    void ReportDropped_();                                  // 上次报告以后有丢弃时写一行WARN
+    size_t WriteRings_(const struct tm& t);                 // 所有环形缓冲区里的数据一次writev写出，返回字节数
+    size_t WriteBlocks_(const struct tm& t);                // 写满的块和当前块一次writev写出，返回字节数
+    void WakeWriter_();                                     // 唤醒写线程
+    // 以下持有mtx_时调用
+    void RotateIfNeeded_(const struct tm& t);               // 换天或者当前文件超过MAX_FILE_BYTES时切换文件
+    void OpenFile_();                                       // 打开fileDate_这天的第fileIndex_个文件
+    void WriteFile_(struct iovec* iov, int cnt);            // 把iov全部写到文件
+    void WriteFormats_();                                   // 二进制文件里补上新登记的格式描述
 
 private:
     static const int LOG_PATH_LEN = 256;                    // 日志路径的长度
     static const int LOG_NAME_LEN = 256;                    // 日志文件的长度
-    static const int MAX_LINES = 50000;                     // 一个日志文件最多装多少行数据
+    static const size_t MAX_FILE_BYTES = 64 * 1024 * 1024;  // 一个日志文件写到多大就换下一个
+    static const int LINE_MAX_LEN = 4096;                   // 一行日志的最大长度，超出部分截断
+    static const int AVG_LINE_LEN = 128;                    // 按队列容量估算环形缓冲区大小用的平均行长
+    static const size_t BLOCK_SIZE = 4 * 1024 * 1024;       // 双缓冲方式下一块的大小
+    static const size_t SPARE_BLOCKS = 2;                   // 预分配并常驻的块数
+    static const size_t MAX_BLOCKS = 16;                    // 块最多的数量，都在等写线程时生产者等待
+    static constexpr int FLUSH_INTERVAL_MS = 500;           // 写线程没被叫醒时最长多久写一次
+    static const int LEVEL_OFF = 4;                         // 日志没打开时gate_的值，比所有等级都高
+    static const int DROP_FILL_PCT[3];                      // OVERFLOW_DROP_LEVEL下DEBUG/INFO/WARN开始丢弃的占用百分比
+    static const size_t MAX_SPILL_BYTES = 64 * 1024 * 1024; // 溢出缓冲区的上限
+    static const int DROP_REPORT_MS = 5000;                 // 报告丢弃数的间隔
 
-    const char* path_;                                      // 日志路径
-    const char* suffix_;                                    // 前缀
+    static std::atomic<int> gate_;                          // 打开时等于level_，没打开时是LEVEL_OFF
 
-    int MAX_LINES_;                                         // 一个日志文件最多装多少行数据
+    const char* path_;                                      // 日志路径
+    const char* suffix_;                                    // 后缀
 
-    int lineCount_;                                         // 当前日志文件写了多少行
+    size_t fileBytes_;                                      // 当前日志文件的大小
+    bool fileBinary_;                                       // 当前文件是不是二进制格式
+    size_t formatsWritten_;                                 // 当前二进制文件里已经写了几个格式描述
+    int fileIndex_;                                         // 当天第几个日志文件
     int toDay_;                                             // 今天日期
+    struct tm fileDate_;                                    // 当前文件的日期
+    std::string fileName_;                                  // 当前文件的路径
 
-    bool isOpen_;                                           // 日志是否打开
- 
-    Buffer buff_;                                           // 存日志数据的缓冲区
-    int level_;                                             // 日志级别
-    bool isAsync_;                                          // 日志是否异步的标志
+    std::atomic<bool> isOpen_;                              // 日志是否打开
+    std::atomic<int> level_;                                // 日志级别
+    std::atomic<bool> isAsync_;                             // 日志是否异步的标志
+    std::atomic<int> backend_;                              // 异步方式下用哪种BACKEND
+    std::atomic<bool> isBinary_;                            // 是否写二进制日志
+    int queueCapacity_;                                     // init时的队列容量
+    size_t ringSize_;                                       // 每个线程的环形缓冲区大小
 
-    FILE* fp_;                                              // 操控日志文件的指针
-    std::unique_ptr<BlockDeque<std::string>> deque_;        // 阻塞队列的指针
+    int fd_;                                                // 日志文件
+    std::mutex mtx_;                                        // 保护文件和上面的文件状态
+    std::mutex ringMtx_;                                    // 保护rings_，只在线程第一次打日志时加
+    std::vector<std::shared_ptr<LogRing>> rings_;           // 所有线程的环形缓冲区
+    std::mutex blockMtx_;                                   // 保护下面的块
+    std::condition_variable blockCond_;                     // 块都用完时生产者在这里等
+    std::unique_ptr<Block> curBlock_;                       // 正在追加的块
+    std::vector<std::unique_ptr<Block>> fullBlocks_;        // 写满等待写出的块
+    std::vector<std::unique_ptr<Block>> spareBlocks_;       // 写完还回来的空块
+    size_t blockCount_;                                     // 已分配的块数
     std::unique_ptr<std::thread> writeThread_;              // 执行写日志的子线程指针
-    std::mutex mtx_;                                        // 互斥锁
+    std::mutex condMtx_;                                    // 保护wakeup_，修改isClosed_时也要加
+    std::condition_variable cond_;                          // 唤醒写线程
+    std::condition_variable spaceCond_;                     // 环形缓冲区满时生产者在这里等
+    bool wakeup_;                                           // 有生产者要求写线程马上工作
+    std::atomic<bool> isClosed_;                            // 写线程退出标志
+    std::mutex fmtMtx_;                                     // 保护formats_
+    std::vector<std::string> formats_;                      // 登记过的格式描述记录，下标加1是编号
+    std::unique_ptr<LogArchiver> archiver_;                 // 压缩和清理轮换下来的文件
+
+    std::atomic<int> overflow_;                             // 溢出策略
+    std::atomic<uint64_t> dropped_[4];                      // 各等级丢掉的行数
+    std::atomic<uint64_t> spilled_;                         // 放进溢出缓冲区的行数
+    std::atomic<uint64_t> blocked_;                         // 生产者等待空间的次数
+    uint64_t reported_[4];                                  // 写线程上次报告时的dropped_
+    std::mutex spillMtx_;                                   // 保护spill_
+    std::string spill_;                                     // 溢出缓冲区，写线程在环形缓冲区和块之后写出
+    std::atomic<size_t> spillBytes_;                        // spill_的大小，不为0时所有行都进溢出缓冲区，保持每个线程内的顺序
 };
 
+template<class T>
+constexpr char Log::BinType_() {
+    typedef typename std::decay<T>::type U;
+    if constexpr(std::is_same<U, char*>::value || std::is_same<U, const char*>::value ||
+                 std::is_same<U, std::string>::value) { return 's'; }
+    else if constexpr(std::is_enum<U>::value) { return BinType_<typename std::underlying_type<U>::type>(); }
+    else if constexpr(std::is_floating_point<U>::value) { return 'f'; }
+    else if constexpr(std::is_pointer<U>::value) { return 'p'; }
+    else {
+        static_assert(std::is_integral<U>::value, "unsupported log argument type");
+        if constexpr(sizeof(U) <= 4) { return std::is_signed<U>::value ? 'i' : 'u'; }
+        else { return std::is_signed<U>::value ? 'l' : 'L'; }
+    }
+}
+
+template<class T>
+void Log::PutArg_(char*& p, char* end, const T& arg) {
+    constexpr char type = BinType_<T>();
+    typedef typename std::decay<T>::type U;
+    if constexpr(type == 's') {
+        if constexpr(std::is_same<U, std::string>::value) { PutStr_(p, end, arg.data(), arg.size()); }
+        else if constexpr(std::is_array<T>::value) { PutStr_(p, end, arg, strnlen(arg, sizeof(T))); }
+        else {
+            const char* str = arg ? arg : "(null)";
+            PutStr_(p, end, str, strlen(str));
+        }
+    } else {
+        /* 整数统一成4或8字节，浮点统一成double，指针按8字节整数 */
+        typedef typename std::conditional<type == 'i', int32_t,
+                typename std::conditional<type == 'u', uint32_t,
+                typename std::conditional<type == 'l', int64_t,
+                typename std::conditional<type == 'f', double, uint64_t>::type>::type>::type>::type V;
+        V value;
+        if constexpr(type == 'p') { value = reinterpret_cast<uintptr_t>(arg); }
+        else { value = static_cast<V>(arg); }
+        if(end - p < static_cast<ptrdiff_t>(sizeof(V))) {
+            p = end;
+            return;
+        }
+        memcpy(p, &value, sizeof(V));
+        p += sizeof(V);
+    }
+}
+
+template<class... Args>
+void Log::writeBin(int level, Site& site, const Args&... args) {
+    static constexpr char types[] = { BinType_<Args>()..., '\0' };
+    uint32_t id = site.id.load(std::memory_order_acquire);
+    if(id == 0) { id = RegisterSite_(site, types); }
+    int64_t nowUs = TimeCache::RealUs();
+    char* rec = LocalBuffer_();
+    char* p = rec + 4;
+    char* end = rec + LINE_MAX_LEN;
+    *p++ = BIN_RECORD;
+    memcpy(p, &id, 4);
+    memcpy(p + 4, &nowUs, 8);
+    p[12] = static_cast<char>(level);
+    p += 13;
+    (PutArg_(p, end, args), ...);
+    (void)end;                          // 没有参数时用不到
+    uint32_t len = p - rec - 4;
+    memcpy(rec, &len, 4);
+    PushRecord_(rec, p - rec, level, nowUs);
+}
+
 #define LOG_BASE(level, format, ...) \
     do {\
-        Log* log = Log::Instance();\
-        if (log->IsOpen() && log->GetLevel() <= level) {\
-            log->write(level, format, ##__VA_ARGS__); \
-            log->flush();\
+        if ((level) >= LOG_MIN_LEVEL && Log::Enabled(level)) {\
+            Log* log = Log::Instance();\
+            if (log->IsBinary()) {\
+                static constinit Log::Site logSite_ = { format, __FILE__, __LINE__, {0} };\
+                log->writeBin(level, logSite_, ##__VA_ARGS__);\
+            } else {\
+                log->write(level, format, ##__VA_ARGS__); \
+            }\
         }\
     } while(0);
 
-#define LOG_DEBUG(format, ...) do {LOG_BASE(0, format, ##__VA_ARGS__)} while(0);
-#define LOG_INFO(format, ...) do {LOG_BASE(1, format, ##__VA_ARGS__)} while(0);
-#define LOG_WARN(format, ...) do {LOG_BASE(2, format, ##__VA_ARGS__)} while(0);
-#define LOG_ERROR(format, ...) do {LOG_BASE(3, format, ##__VA_ARGS__)} while(0);
+// 等级是常量，低于LOG_MIN_LEVEL时if constexpr丢掉整条语句，不生成任何代码
+#define LOG_DEBUG(format, ...) do {if constexpr(0 >= LOG_MIN_LEVEL) {LOG_BASE(0, format, ##__VA_ARGS__)}} while(0);
+#define LOG_INFO(format, ...) do {if constexpr(1 >= LOG_MIN_LEVEL) {LOG_BASE(1, format, ##__VA_ARGS__)}} while(0);
+#define LOG_WARN(format, ...) do {if constexpr(2 >= LOG_MIN_LEVEL) {LOG_BASE(2, format, ##__VA_ARGS__)}} while(0);
+#define LOG_ERROR(format, ...) do {if constexpr(3 >= LOG_MIN_LEVEL) {LOG_BASE(3, format, ##__VA_ARGS__)}} while(0);
 
-#endif //LOG_H
\ No newline at end of file
+#endif //LOG_H
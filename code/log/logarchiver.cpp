@@ -0,0 +1,235 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "logarchiver.h"
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>            // AT_FDCWD
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>     // setpriority
+#include <sys/syscall.h>
+#include <zlib.h>
+#include "log.h"
+
+using namespace std;
+
+LogArchiver::LogArchiver(): compress_(false), maxFiles_(0), maxBytes_(0),
+        dirty_(false), isClosed_(false), stats_() {}
+
+LogArchiver::~LogArchiver() {
+    Stop();
+}
+
+// 没压缩完的文件留着，下次启动时重新排队
+void LogArchiver::Stop() {
+    if(thread_ && thread_->joinable()) {
+        {
+            lock_guard<mutex> locker(mtx_);
+            isClosed_ = true;
+        }
+        cond_.notify_one();
+        thread_->join();
+    }
+}
+
+void LogArchiver::Start(const string& dir, const string& current, bool compress, size_t maxFiles, uint64_t maxBytes) {
+    assert(!thread_);
+    dir_ = dir;
+    current_ = current;
+    compress_ = compress;
+    maxFiles_ = maxFiles;
+    maxBytes_ = maxBytes;
+    if(DIR* d = opendir(dir_.c_str())) {
+        vector<string> names;
+        while(struct dirent* ent = readdir(d)) {
+            if(IsLogFile_(ent->d_name)) { names.push_back(ent->d_name); }
+        }
+        closedir(d);
+        sort(names.begin(), names.end());
+        for(const string& name : names) {
+            string file = dir_ + "/" + name;
+            size_t len = name.size();
+            if(len > 7 && name.compare(len - 7, 7, ".gz.tmp") == 0) {
+                unlink(file.c_str());       // 上次压缩到一半退出
+            } else if(compress_ && file != current_ && (len < 3 || name.compare(len - 3, 3, ".gz") != 0)) {
+                pending_.push_back(file);
+            }
+        }
+    }
+    stats_.pending = pending_.size();
+    dirty_ = true;
+    thread_.reset(new thread(&LogArchiver::Run_, this));
+}
+
+void LogArchiver::Rotated(const string& oldFile, const string& newFile) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        stats_.rotations++;
+        current_ = newFile;
+        if(!thread_) { return; }
+        if(compress_) {
+            pending_.push_back(oldFile);
+            stats_.pending = pending_.size();
+        }
+        dirty_ = true;
+    }
+    cond_.notify_one();
+}
+
+LogArchiver::Stats LogArchiver::GetStats() {
+    lock_guard<mutex> locker(mtx_);
+    return stats_;
+}
+
+bool LogArchiver::Compress(const string& src, const string& dst, uint64_t* bytesIn, uint64_t* bytesOut) {
+    struct stat srcSt;
+    FILE* in = fopen(src.c_str(), "rb");
+    if(!in) { return false; }
+    if(fstat(fileno(in), &srcSt) != 0) {
+        fclose(in);
+        return false;
+    }
+    string tmp = dst + ".tmp";
+    gzFile out = gzopen(tmp.c_str(), "wb6");
+    if(!out) {
+        fclose(in);
+        return false;
+    }
+    unique_ptr<char[]> buf(new char[CHUNK_SIZE]);
+    size_t n;
+    bool ok = true;
+    *bytesIn = 0;
+    while(ok && (n = fread(buf.get(), 1, CHUNK_SIZE, in)) > 0) {
+        ok = gzwrite(out, buf.get(), n) == static_cast<int>(n);
+        *bytesIn += n;
+    }
+    ok = ok && !ferror(in);
+    fclose(in);
+    ok = gzclose(out) == Z_OK && ok;
+    struct stat st;
+    if(ok && stat(dst.c_str(), &st) == 0) {
+        /* 同名的压缩文件已经存在(重启后又写了同一个文件)，把新的gzip成员接在后面 */
+        FILE* from = fopen(tmp.c_str(), "rb");
+        FILE* to = fopen(dst.c_str(), "ab");
+        ok = from && to;
+        while(ok && (n = fread(buf.get(), 1, CHUNK_SIZE, from)) > 0) { ok = fwrite(buf.get(), 1, n, to) == n; }
+        if(from) { fclose(from); }
+        if(to) { ok = fclose(to) == 0 && ok; }
+        unlink(tmp.c_str());
+    } else if(ok) {
+        ok = rename(tmp.c_str(), dst.c_str()) == 0;
+    }
+    if(!ok) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    /* 保留原文件的修改时间，保留策略按它排新旧 */
+    struct timespec times[2] = { srcSt.st_atim, srcSt.st_mtim };
+    utimensat(AT_FDCWD, dst.c_str(), times, 0);
+    *bytesOut = stat(dst.c_str(), &st) == 0 ? st.st_size : 0;
+    unlink(src.c_str());
+    return true;
+}
+
+bool LogArchiver::IsLogFile_(const char* name) {
+    static const char PATTERN[] = "dddd_dd_dd";
+    for(int i = 0; PATTERN[i]; i++) {
+        if(PATTERN[i] == 'd' ? !isdigit(static_cast<unsigned char>(name[i])) : name[i] != PATTERN[i]) { return false; }
+    }
+    return true;
+}
+
+// 按修改时间从旧到新删，直到个数和总大小都不超过上限
+void LogArchiver::Enforce_() {
+    struct FileInfo {
+        string path;
+        time_t mtime;
+        uint64_t size;
+    };
+    vector<FileInfo> files;
+    string current;
+    {
+        lock_guard<mutex> locker(mtx_);
+        current = current_;
+    }
+    if(DIR* d = opendir(dir_.c_str())) {
+        while(struct dirent* ent = readdir(d)) {
+            if(!IsLogFile_(ent->d_name)) { continue; }
+            string path = dir_ + "/" + ent->d_name;
+            struct stat st;
+            if(path == current || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) { continue; }
+            if(path.size() > 7 && path.compare(path.size() - 7, 7, ".gz.tmp") == 0) { continue; }
+            files.push_back({ path, st.st_mtime, static_cast<uint64_t>(st.st_size) });
+        }
+        closedir(d);
+    }
+    sort(files.begin(), files.end(), [](const FileInfo& a, const FileInfo& b) {
+        return a.mtime != b.mtime ? a.mtime < b.mtime : a.path < b.path;
+    });
+    uint64_t total = 0;
+    for(const FileInfo& f : files) { total += f.size; }
+    size_t first = 0, removed = 0;
+    while(first < files.size() && ((maxFiles_ > 0 && files.size() - first > maxFiles_) ||
+                                   (maxBytes_ > 0 && total > maxBytes_))) {
+        if(unlink(files[first].path.c_str()) == 0) {
+            LOG_INFO("Log file %s removed", files[first].path.c_str());
+            removed++;
+        }
+        total -= files[first].size;
+        first++;
+    }
+    lock_guard<mutex> locker(mtx_);
+    stats_.removed += removed;
+    stats_.files = files.size() - first;
+    stats_.totalBytes = total;
+}
+
+// 每次压缩一个文件，压完一个就检查一次保留策略
+void LogArchiver::Run_() {
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);    // Linux上只作用于当前线程
+#ifdef SYS_ioprio_set
+    syscall(SYS_ioprio_set, 1, 0, 3 << 13);                 // IOPRIO_WHO_PROCESS(当前线程)，IOPRIO_CLASS_IDLE
+#endif
+    unique_lock<mutex> locker(mtx_);
+    while(true) {
+        cond_.wait(locker, [this] { return isClosed_ || dirty_ || !pending_.empty(); });
+        if(isClosed_) { break; }
+        if(dirty_) {
+            /* 先删，要删掉的文件就不用再压缩了 */
+            dirty_ = false;
+            locker.unlock();
+            Enforce_();
+            locker.lock();
+        }
+        if(!pending_.empty()) {
+            string file = pending_.front();
+            locker.unlock();
+            uint64_t bytesIn = 0, bytesOut = 0;
+            bool ok = Compress(file, file + ".gz", &bytesIn, &bytesOut);
+            bool removed = !ok && access(file.c_str(), F_OK) != 0;     // 排队时已经按保留策略删掉了
+            if(ok) {
+                LOG_INFO("Log file %s compressed, %llu -> %llu bytes", file.c_str(),
+                         (unsigned long long)bytesIn, (unsigned long long)bytesOut);
+            } else if(!removed) {
+                LOG_WARN("Log file %s compress error!", file.c_str());
+            }
+            locker.lock();
+            pending_.pop_front();
+            stats_.pending = pending_.size();
+            if(ok) {
+                stats_.compressed++;
+                stats_.bytesIn += bytesIn;
+                stats_.bytesOut += bytesOut;
+            } else if(!removed) {
+                stats_.failed++;
+            }
+            dirty_ = true;
+        }
+    }
+}
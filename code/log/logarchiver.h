@@ -0,0 +1,69 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef LOG_ARCHIVER_H
+#define LOG_ARCHIVER_H
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <string>
+#include <memory>
+#include <stdint.h>
+
+// 轮换下来的日志文件交给低优先级(nice 19，空闲IO)的后台线程压缩成gzip，并按个数和总大小删除最旧的文件。
+// 只处理日志目录里按日期命名(YYYY_MM_DD开头)的文件，正在写的文件不动
+class LogArchiver {
+public:
+    struct Stats {
+        uint64_t rotations;                                 // 轮换的次数
+        size_t pending;                                     // 等待压缩的文件数
+        uint64_t compressed;                                // 压缩完成的文件数
+        uint64_t failed;                                    // 压缩失败的文件数
+        uint64_t removed;                                   // 按保留策略删除的文件数
+        uint64_t bytesIn;                                   // 压缩前的总字节数
+        uint64_t bytesOut;                                  // 压缩后的总字节数
+        size_t files;                                       // 上次检查时目录里轮换下来的文件数
+        uint64_t totalBytes;                                // 同上，这些文件的总字节数
+    };
+
+    LogArchiver();
+    ~LogArchiver();
+
+    // 启动后台线程，dir是日志目录，current是正在写的文件。maxFiles、maxBytes为0表示不限制。
+    // 启动时把目录里上次没来得及压缩的文件排进队列
+    void Start(const std::string& dir, const std::string& current, bool compress, size_t maxFiles, uint64_t maxBytes);
+    bool IsStarted() const { return thread_ != nullptr; }
+    void Stop();                                            // 停掉后台线程，正在压缩的文件压完为止
+
+    void Rotated(const std::string& oldFile, const std::string& newFile);  // 写线程切换文件后调用
+    Stats GetStats();
+
+    // 把src压缩到dst(已存在时追加一个gzip成员，zcat和gzread都能连着读)，成功后删除src
+    static bool Compress(const std::string& src, const std::string& dst, uint64_t* bytesIn, uint64_t* bytesOut);
+
+private:
+    static bool IsLogFile_(const char* name);               // 是否按日期命名的日志文件
+    void Run_();
+    void Enforce_();                                        // 按保留策略删除最旧的文件，更新files_和totalBytes_
+
+    static const int CHUNK_SIZE = 128 * 1024;
+
+    std::string dir_;
+    std::string current_;                                   // 正在写的文件，不压缩不删除
+    bool compress_;
+    size_t maxFiles_;
+    uint64_t maxBytes_;
+
+    std::mutex mtx_;                                        // 保护下面的成员
+    std::condition_variable cond_;
+    std::deque<std::string> pending_;                       // 等待压缩的文件
+    bool dirty_;                                            // 有新轮换的文件，需要重新检查保留策略
+    bool isClosed_;
+    Stats stats_;
+    std::unique_ptr<std::thread> thread_;
+};
+
+#endif //LOG_ARCHIVER_H
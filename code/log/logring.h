@@ -0,0 +1,70 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+#include <assert.h>
+
+// 单生产者单消费者的字节环形缓冲区：每个打日志的线程独占一个，只往里追加整行，
+// 写日志线程是唯一的读者。读写位置只增不减，各自独占一个缓存行，不用锁
+class LogRing {
+public:
+    explicit LogRing(size_t capacity): buf_(new char[RoundUp_(capacity)]),
+            mask_(RoundUp_(capacity) - 1), head_(0), tail_(0), isClosed_(false) {}
+
+    LogRing(const LogRing&) = delete;
+    LogRing& operator=(const LogRing&) = delete;
+
+    // 生产者调用，剩余空间放不下len字节时返回false，不会只写一部分
+    bool TryPush(const char* data, size_t len) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if(len > Capacity() - (tail - head_.load(std::memory_order_acquire))) { return false; }
+        size_t pos = tail & mask_;
+        size_t first = std::min(len, Capacity() - pos);
+        memcpy(buf_.get() + pos, data, first);
+        memcpy(buf_.get(), data + first, len - first);
+        tail_.store(tail + len, std::memory_order_release);
+        return true;
+    }
+
+    // 消费者调用，取出当前可读的数据，跨过缓冲区末尾时分成两段；读完后调用Consume
+    size_t Peek(const char** p1, size_t* l1, const char** p2, size_t* l2) const {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t len = tail_.load(std::memory_order_acquire) - head;
+        size_t pos = head & mask_;
+        *p1 = buf_.get() + pos;
+        *l1 = std::min(len, Capacity() - pos);
+        *p2 = buf_.get();
+        *l2 = len - *l1;
+        return len;
+    }
+
+    void Consume(size_t len) { head_.store(head_.load(std::memory_order_relaxed) + len, std::memory_order_release); }
+
+    size_t Size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+    size_t Capacity() const { return mask_ + 1; }
+
+    void Close() { isClosed_.store(true, std::memory_order_release); }      // 所属线程退出，读空后可以回收
+    bool IsClosed() const { return isClosed_.load(std::memory_order_acquire); }
+
+private:
+    static size_t RoundUp_(size_t n) {
+        size_t size = 1;
+        while(size < n) { size <<= 1; }
+        return size;
+    }
+
+    std::unique_ptr<char[]> buf_;
+    const size_t mask_;
+    alignas(64) std::atomic<size_t> head_;                  // 消费者的读位置
+    alignas(64) std::atomic<size_t> tail_;                  // 生产者的写位置
+    std::atomic<bool> isClosed_;
+};
+
+#endif //LOG_RING_H
@@ -12,7 +12,23 @@ int main() {
     WebServer server(
         1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
         3306, "root", "root", "webserver", /* Mysql配置 */
-        12, 6, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 6, true, 1, 1024,              /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        WebServer::SHARED_QUEUE, 4, 0);    /* 线程池模式: SHARED_QUEUE 单队列, WORK_STEALING 工作窃取, AFFINITY(_PINNED) 连接亲和, COROUTINE 协程
+                                              数据库线程池数量(0表示在IO线程里直接查数据库)
+                                              异步数据库连接数(0表示不用，用户需为mysql_native_password认证) */
+    server.SetLogBackend(Log::RING_BACKEND, false);             /* 日志方式: RING_BACKEND 每线程环形缓冲区, BLOCK_BACKEND 双缓冲大块; 是否写二进制日志 */
+    server.SetLogOverflow(Log::OVERFLOW_BLOCK);                 /* 日志缓冲区满时: OVERFLOW_BLOCK 等待, DROP_NEWEST 丢新行, DROP_LEVEL 按占用先丢低等级, SPILL 溢出缓冲区 */
+    //server.SetLogArchive(true, 100, 1024);                    /* 轮换下来的日志是否压缩 最多保留文件数 最多保留总大小(MB)，0表示不限制 */
+    //server.SetAccessSampling(2, 0.01);                        /* 访问日志采样：状态码(1~5表示整类) 保留比例，这里2xx只留1%，其余全留 */
+    //server.SetAccessLog("./log/access.log", AccessLog::COMBINED, 1 << 20);  /* 访问日志文件 格式COMMON/COMBINED/JSON 每线程缓冲区字节数；不调用即关闭 */
+    server.SetOverloadPolicy(WebServer::OVERLOAD_NONE, 0, 0);  /* 过载策略 队列深度上限 排队时间上限(ms) */
+    //server.SetAdaptivePool(16, 16, 20, 30000);                /* 线程池上限 数据库线程池上限 排队时间目标(ms) 空闲收缩(ms) */
+    //server.SetLocalUserStore("./users.db", 2);                /* 不用MySQL时(连接池数量填0)改用本地用户存储：日志文件 攒批刷盘间隔(ms) */
+    //server.SetRegisterBatch(5, 64);                           /* 注册攒批等待时间(ms) 一批最多行数 */
+    server.SetSqlPool(4, 3000, 30000, 60000);                   /* 数据库连接池最少连接数 取连接超时(ms) 空闲多久先ping(ms) 多余连接空闲多久关闭(ms) */
+    //server.SetUserCache(100000, 60000, 5000);                 /* 凭据缓存条目上限 有效期(ms) 不存在用户的有效期(ms) */
+    //server.SetUserFilter(1 << 20, 0.01);                      /* 用户名过滤器内存(字节) 误判率 */
+    //server.SetMetrics(true, "127.0.0.1");                      /* 开启指标统计和 GET /metrics(Prometheus文本格式) 允许抓取的地址 */
     server.Start();
 } 
   
\ No newline at end of file
@@ -0,0 +1,481 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "asyncsqlpool.h"
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include "sha1.h"
+#include "../timer/timecache.h"
+
+using namespace std;
+
+/* 协议常量 */
+static const uint32_t CLIENT_LONG_PASSWORD = 0x00000001;
+static const uint32_t CLIENT_CONNECT_WITH_DB = 0x00000008;
+static const uint32_t CLIENT_PROTOCOL_41 = 0x00000200;
+static const uint32_t CLIENT_TRANSACTIONS = 0x00002000;
+static const uint32_t CLIENT_SECURE_CONNECTION = 0x00008000;
+static const uint32_t CLIENT_PLUGIN_AUTH = 0x00080000;
+static const uint8_t COM_QUERY = 0x03;
+static const uint8_t CHARSET_UTF8MB4 = 45;
+static const size_t MAX_PACKET = 0xffffff;                  // 单个包的最大长度，大于它的包要拆分，这里的查询用不到
+static const char NATIVE_PASSWORD[] = "mysql_native_password";
+
+static bool IsEof(const char* data, size_t len) {          // 没有CLIENT_DEPRECATE_EOF时结果集用EOF包分隔
+    return len < 9 && static_cast<uint8_t>(data[0]) == 0xfe;
+}
+
+// 长度编码的整数，返回读掉的字节数，数据不够返回0
+static size_t ReadLenenc(const char* data, size_t len, uint64_t* value) {
+    if(len == 0) { return 0; }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    size_t n = 0;
+    if(p[0] < 0xfb) { *value = p[0]; return 1; }
+    else if(p[0] == 0xfc) { n = 2; }
+    else if(p[0] == 0xfd) { n = 3; }
+    else if(p[0] == 0xfe) { n = 8; }
+    else { return 0; }
+    if(len < n + 1) { return 0; }
+    *value = 0;
+    for(size_t i = 0; i < n; i++) { *value |= static_cast<uint64_t>(p[1 + i]) << (8 * i); }
+    return n + 1;
+}
+
+static void AppendInt(string& out, uint64_t value, size_t bytes) {     // 小端整数
+    for(size_t i = 0; i < bytes; i++) { out.push_back(static_cast<char>((value >> (8 * i)) & 0xff)); }
+}
+
+AsyncSqlPool::AsyncSqlPool(Epoller* epoller, size_t maxPending, int queryTimeoutMs): epoller_(epoller),
+        maxPending_(maxPending), queryTimeoutMs_(queryTimeoutMs), outstanding_(0), lastFailMs_(0) {
+    assert(epoller_);
+    memset(&addr_, 0, sizeof(addr_));
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(wakeFd_ >= 0);
+    epoller_->AddFd(wakeFd_, EPOLLIN);
+}
+
+AsyncSqlPool::~AsyncSqlPool() {
+    for(auto& conn : conns_) {
+        if(conn->fd >= 0) {
+            epoller_->DelFd(conn->fd);
+            close(conn->fd);
+        }
+    }
+    epoller_->DelFd(wakeFd_);
+    close(wakeFd_);
+}
+
+bool AsyncSqlPool::Init(const char* host, int port, const char* user, const char* pwd,
+                        const char* dbName, int connSize) {
+    assert(connSize > 0);
+    struct addrinfo hints, *res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, nullptr, &hints, &res) != 0 || !res) {
+        LOG_ERROR("AsyncSqlPool resolve %s error!", host);
+        return false;
+    }
+    addr_ = *reinterpret_cast<sockaddr_in*>(res->ai_addr);
+    addr_.sin_port = htons(port);
+    freeaddrinfo(res);
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
+    for(int i = 0; i < connSize; i++) {
+        conns_.emplace_back(new Conn);
+        Connect_(*conns_.back());
+    }
+    return true;
+}
+
+// 任意线程调用，放进收件箱后唤醒事件循环，回调不会在这里同步执行
+void AsyncSqlPool::Query(string sql, SqlCallback cb) {
+    bool rejected = outstanding_.fetch_add(1, memory_order_relaxed) >= maxPending_;
+    {
+        lock_guard<mutex> locker(mtx_);
+        inbox_.push_back(Request{ std::move(sql), std::move(cb), rejected, 0 });
+    }
+    uint64_t one = 1;
+    ssize_t ret = write(wakeFd_, &one, sizeof(one));
+    (void)ret;
+}
+
+size_t AsyncSqlPool::ReadyCount() const {
+    size_t n = 0;
+    for(auto& conn : conns_) { n += conn->state >= READY; }
+    return n;
+}
+
+bool AsyncSqlPool::OnEvent(int fd, uint32_t events) {
+    if(fd == wakeFd_) {
+        DrainInbox_();
+        Dispatch_();
+        return true;
+    }
+    auto it = fdConns_.find(fd);
+    if(it == fdConns_.end()) { return false; }
+    Conn& conn = *it->second;
+    if(events & EPOLLERR) {
+        Close_(conn, "socket error");
+    } else {
+        if(events & EPOLLOUT) { OnWritable_(conn); }
+        if(conn.fd >= 0 && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) { OnReadable_(conn); }
+    }
+    Dispatch_();
+    return true;
+}
+
+void AsyncSqlPool::DrainInbox_() {
+    uint64_t cnt;
+    while(read(wakeFd_, &cnt, sizeof(cnt)) > 0) {}
+    vector<Request> reqs;
+    {
+        lock_guard<mutex> locker(mtx_);
+        reqs.swap(inbox_);
+    }
+    int64_t deadline = TimeCache::NowMs() + queryTimeoutMs_;
+    for(auto& req : reqs) {
+        req.deadlineMs = deadline;
+        if(req.rejected) {
+            LOG_WARN("AsyncSqlPool busy, query rejected!");
+            Complete_(req, SqlResult{ false, "too many pending queries", 0, {} });
+        } else {
+            pending_.push_back(std::move(req));
+        }
+    }
+}
+
+// 服务器不回应时查询不会自己结束，连接的HeapTimer可能先关掉客户端，所以每个查询都要有期限。
+// 在途的查询没法从协议中途撤回，只能关闭连接，Close_会回调失败
+int AsyncSqlPool::Tick() {
+    int64_t now = TimeCache::NowMs();
+    int64_t next = -1;
+    for(auto& ptr : conns_) {
+        Conn& conn = *ptr;
+        if(conn.state <= READY) { continue; }
+        if(conn.req.deadlineMs <= now) {
+            Close_(conn, "query timeout");
+            continue;
+        }
+        if(next < 0 || conn.req.deadlineMs < next) { next = conn.req.deadlineMs; }
+    }
+    while(!pending_.empty() && pending_.front().deadlineMs <= now) {    // 按进入的顺序排，期限也是有序的
+        Request req = std::move(pending_.front());
+        pending_.pop_front();
+        LOG_WARN("AsyncSqlPool query timeout in queue!");
+        Complete_(req, SqlResult{ false, "query timeout", 0, {} });
+    }
+    if(!pending_.empty() && (next < 0 || pending_.front().deadlineMs < next)) { next = pending_.front().deadlineMs; }
+    Dispatch_();
+    return next < 0 ? -1 : static_cast<int>(next - now);
+}
+
+// 把排队的查询交给空闲连接，断开的连接在有查询等待时重连，所有连接都不可用时让等待的查询失败
+void AsyncSqlPool::Dispatch_() {
+    bool alive = false;
+    int64_t now = TimeCache::NowMs();
+    for(auto& ptr : conns_) {
+        Conn& conn = *ptr;
+        if(!pending_.empty()) {
+            if(conn.state == READY) {
+                conn.req = std::move(pending_.front());
+                pending_.pop_front();
+                conn.result = SqlResult{ true, "", 0, {} };
+                conn.state = QUERY_HEAD;
+                conn.seq = 0;
+                LOG_DEBUG("%s", conn.req.sql.c_str());
+                string payload(1, static_cast<char>(COM_QUERY));
+                payload += conn.req.sql;
+                SendPacket_(conn, payload);
+            }
+            else if(conn.state == CLOSED && now - lastFailMs_ >= RECONNECT_MS) {
+                Connect_(conn);
+            }
+        }
+        alive = alive || conn.state != CLOSED;
+    }
+    if(!alive) {
+        while(!pending_.empty()) {
+            Request req = std::move(pending_.front());
+            pending_.pop_front();
+            Complete_(req, SqlResult{ false, "mysql unavailable", 0, {} });
+        }
+    }
+}
+
+void AsyncSqlPool::Connect_(Conn& conn) {
+    assert(conn.fd < 0);
+    conn.readBuff.RetrieveAll();
+    conn.writeBuff.RetrieveAll();
+    conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(conn.fd < 0) {
+        lastFailMs_ = TimeCache::NowMs();
+        LOG_ERROR("AsyncSqlPool create socket error!");
+        return;
+    }
+    int one = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    conn.state = CONNECTING;
+    fdConns_[conn.fd] = &conn;
+    int ret = connect(conn.fd, reinterpret_cast<sockaddr*>(&addr_), sizeof(addr_));
+    if(ret < 0 && errno != EINPROGRESS) {
+        Close_(conn, "connect error");
+        return;
+    }
+    epoller_->AddFd(conn.fd, EPOLLOUT | EPOLLRDHUP);
+}
+
+// 关闭连接，在途的查询回调失败，连接阶段失败会推迟重连
+void AsyncSqlPool::Close_(Conn& conn, const string& why) {
+    LOG_WARN("AsyncSqlPool conn[%d] closed: %s", conn.fd, why.c_str());
+    if(conn.fd >= 0) {
+        epoller_->DelFd(conn.fd);
+        close(conn.fd);
+        fdConns_.erase(conn.fd);
+        conn.fd = -1;
+    }
+    STATE state = conn.state;
+    conn.state = CLOSED;
+    conn.readBuff.RetrieveAll();
+    conn.writeBuff.RetrieveAll();
+    if(state < READY) {
+        lastFailMs_ = TimeCache::NowMs();
+    }
+    else if(state > READY) {
+        Request req = std::move(conn.req);
+        Complete_(req, SqlResult{ false, why, 0, {} });
+    }
+}
+
+void AsyncSqlPool::OnWritable_(Conn& conn) {
+    if(conn.state == CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if(getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            Close_(conn, strerror(err));
+            return;
+        }
+        conn.state = HANDSHAKE;             // 服务器先发握手包
+        epoller_->ModFd(conn.fd, EPOLLIN | EPOLLRDHUP);
+        return;
+    }
+    while(conn.writeBuff.ReadableBytes() > 0) {
+        ssize_t len = send(conn.fd, conn.writeBuff.Peek(), conn.writeBuff.ReadableBytes(), MSG_NOSIGNAL);
+        if(len < 0) {
+            if(errno == EAGAIN) { return; }
+            Close_(conn, strerror(errno));
+            return;
+        }
+        conn.writeBuff.Retrieve(len);
+    }
+    epoller_->ModFd(conn.fd, EPOLLIN | EPOLLRDHUP);
+}
+
+// 读出所有完整的包交给状态机
+void AsyncSqlPool::OnReadable_(Conn& conn) {
+    int readErrno = 0;
+    ssize_t ret = conn.readBuff.ReadFd(conn.fd, &readErrno);
+    if(ret == 0 || (ret < 0 && readErrno != EAGAIN)) {
+        Close_(conn, ret == 0 ? "closed by server" : strerror(readErrno));
+        return;
+    }
+    while(conn.fd >= 0 && conn.readBuff.ReadableBytes() >= 4) {
+        const uint8_t* head = reinterpret_cast<const uint8_t*>(conn.readBuff.Peek());
+        size_t len = head[0] | (head[1] << 8) | (head[2] << 16);
+        if(conn.readBuff.ReadableBytes() < len + 4) { break; }
+        conn.seq = head[3] + 1;
+        if(len == 0 || len == MAX_PACKET) {
+            Close_(conn, "unexpected packet");
+            return;
+        }
+        /* 先拷出来再取走，状态机里的回调可能提交新查询 */
+        string packet(conn.readBuff.Peek() + 4, len);
+        conn.readBuff.Retrieve(len + 4);
+        if(!HandlePacket_(conn, packet.data(), packet.size())) { return; }
+    }
+}
+
+bool AsyncSqlPool::HandlePacket_(Conn& conn, const char* data, size_t len) {
+    switch(conn.state) {
+    case HANDSHAKE:
+        return HandleHandshake_(conn, data, len);
+    case AUTH:
+        return HandleAuth_(conn, data, len);
+    case QUERY_HEAD:
+    case QUERY_COLUMNS:
+    case QUERY_ROWS:
+        HandleResult_(conn, data, len);
+        return true;
+    default:
+        Close_(conn, "unexpected packet");
+        return false;
+    }
+}
+
+// 解析Handshake V10，回复HandshakeResponse41
+bool AsyncSqlPool::HandleHandshake_(Conn& conn, const char* data, size_t len) {
+    if(static_cast<uint8_t>(data[0]) == 0xff) {
+        Close_(conn, len > 3 ? string(data + 3, len - 3) : "handshake error");
+        return false;
+    }
+    if(data[0] != 10) {
+        Close_(conn, "unsupported protocol version");
+        return false;
+    }
+    const char* end = data + len;
+    const char* p = static_cast<const char*>(memchr(data + 1, 0, len - 1));    // 跳过服务器版本字符串
+    if(!p || end - p < 1 + 4 + 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10 + 12) {
+        Close_(conn, "bad handshake");
+        return false;
+    }
+    p += 1 + 4;                             // 连接id
+    string scramble(p, 8);
+    p += 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10;    // 能力标志、字符集、状态等
+    scramble.append(p, 12);                 // auth-plugin-data-part-2的前12字节，后面是结尾的0
+
+    string payload;
+    AppendInt(payload, CLIENT_LONG_PASSWORD | CLIENT_CONNECT_WITH_DB | CLIENT_PROTOCOL_41 |
+                       CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION | CLIENT_PLUGIN_AUTH, 4);
+    AppendInt(payload, MAX_PACKET, 4);
+    payload.push_back(static_cast<char>(CHARSET_UTF8MB4));
+    payload.append(23, '\0');
+    payload.append(user_.c_str(), user_.size() + 1);
+    string auth = NativePassword(pwd_, scramble);
+    payload.push_back(static_cast<char>(auth.size()));
+    payload += auth;
+    payload.append(dbName_.c_str(), dbName_.size() + 1);
+    payload.append(NATIVE_PASSWORD, sizeof(NATIVE_PASSWORD));
+    conn.state = AUTH;
+    SendPacket_(conn, payload);
+    return conn.fd >= 0;
+}
+
+// 认证结果：OK进入空闲，服务器要求换成mysql_native_password时重新计算，其他插件不支持
+bool AsyncSqlPool::HandleAuth_(Conn& conn, const char* data, size_t len) {
+    uint8_t type = static_cast<uint8_t>(data[0]);
+    if(type == 0x00) {
+        conn.state = READY;
+        LOG_INFO("AsyncSqlPool conn[%d] ready", conn.fd);
+        return true;
+    }
+    if(type == 0xfe) {
+        const char* p = static_cast<const char*>(memchr(data + 1, 0, len - 1));
+        string plugin(data + 1, p ? p - data - 1 : len - 1);
+        if(plugin != NATIVE_PASSWORD || !p || data + len - (p + 1) < 20) {
+            Close_(conn, "unsupported auth plugin " + plugin);
+            return false;
+        }
+        SendPacket_(conn, NativePassword(pwd_, string(p + 1, 20)));
+        return conn.fd >= 0;
+    }
+    Close_(conn, type == 0xff && len > 9 ? string(data + 9, len - 9) : "auth error");
+    return false;
+}
+
+// 查询结果：OK包、ERR包，或者列数、列定义、EOF、数据行、EOF组成的结果集
+void AsyncSqlPool::HandleResult_(Conn& conn, const char* data, size_t len) {
+    uint8_t type = static_cast<uint8_t>(data[0]);
+    if(conn.state != QUERY_COLUMNS && type == 0xff) {
+        conn.result.ok = false;
+        conn.result.error = len > 9 ? string(data + 9, len - 9) : "query error";
+        Finish_(conn);
+        return;
+    }
+    if(conn.state == QUERY_HEAD) {
+        if(type == 0x00) {
+            ReadLenenc(data + 1, len - 1, &conn.result.affectedRows);
+            Finish_(conn);
+        } else if(ReadLenenc(data, len, &conn.columns) == 0 || type == 0xfb) {
+            conn.result.ok = false;             // LOCAL INFILE等请求不支持
+            conn.result.error = "unsupported result";
+            Finish_(conn);
+        } else {
+            conn.state = QUERY_COLUMNS;
+        }
+        return;
+    }
+    if(conn.state == QUERY_COLUMNS) {
+        if(IsEof(data, len)) { conn.state = QUERY_ROWS; }  // 不需要列定义，只数到EOF
+        return;
+    }
+    if(IsEof(data, len)) {
+        Finish_(conn);
+        return;
+    }
+    vector<string> row;
+    row.reserve(conn.columns);
+    size_t off = 0;
+    for(uint64_t i = 0; i < conn.columns && off < len; i++) {
+        if(static_cast<uint8_t>(data[off]) == 0xfb) {  // NULL
+            row.emplace_back();
+            off++;
+            continue;
+        }
+        uint64_t n = 0;
+        size_t used = ReadLenenc(data + off, len - off, &n);
+        if(used == 0 || off + used + n > len) { break; }
+        row.emplace_back(data + off + used, n);
+        off += used + n;
+    }
+    conn.result.rows.push_back(std::move(row));
+}
+
+void AsyncSqlPool::SendPacket_(Conn& conn, const string& payload) {
+    assert(payload.size() < MAX_PACKET);
+    char head[4] = { static_cast<char>(payload.size() & 0xff), static_cast<char>((payload.size() >> 8) & 0xff),
+                     static_cast<char>((payload.size() >> 16) & 0xff), static_cast<char>(conn.seq++) };
+    bool idle = conn.writeBuff.ReadableBytes() == 0;
+    conn.writeBuff.Append(head, 4);
+    conn.writeBuff.Append(payload);
+    if(idle) {
+        OnWritable_(conn);                  // 先直接写，写不完再注册EPOLLOUT
+        if(conn.fd >= 0 && conn.writeBuff.ReadableBytes() > 0) {
+            epoller_->ModFd(conn.fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+        }
+    }
+}
+
+void AsyncSqlPool::Complete_(Request& req, const SqlResult& result) {
+    outstanding_.fetch_sub(1, memory_order_relaxed);
+    if(req.cb) { req.cb(result); }
+}
+
+void AsyncSqlPool::Finish_(Conn& conn) {
+    conn.state = READY;
+    Request req = std::move(conn.req);
+    SqlResult result = std::move(conn.result);
+    Complete_(req, result);
+}
+
+// 和mysql_real_escape_string一样转义，假定没有开NO_BACKSLASH_ESCAPES
+string AsyncSqlPool::Escape(const string& str) {
+    string out;
+    out.reserve(str.size());
+    for(char c : str) {
+        switch(c) {
+        case '\0': out += "\\0"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\\': out += "\\\\"; break;
+        case '\'': out += "\\'"; break;
+        case '"': out += "\\\""; break;
+        case '\032': out += "\\Z"; break;
+        default: out.push_back(c); break;
+        }
+    }
+    return out;
+}
+
+// SHA1(pwd) XOR SHA1(scramble + SHA1(SHA1(pwd)))，空密码发送空串
+string AsyncSqlPool::NativePassword(const string& pwd, const string& scramble) {
+    if(pwd.empty()) { return ""; }
+    string stage1 = Sha1(pwd);
+    string stage2 = Sha1(scramble + Sha1(stage1));
+    for(size_t i = 0; i < stage1.size(); i++) { stage1[i] ^= stage2[i]; }
+    return stage1;
+}
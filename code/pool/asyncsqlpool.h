@@ -0,0 +1,119 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef ASYNC_SQLCONNPOOL_H
+#define ASYNC_SQLCONNPOOL_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <netinet/in.h>
+#include "../buffer/buffer.h"
+#include "../server/epoller.h"
+#include "../log/log.h"
+
+struct SqlResult {
+    bool ok;                                                // 语句是否执行成功
+    std::string error;                                      // 失败原因
+    uint64_t affectedRows;                                  // INSERT/UPDATE影响的行数
+    std::vector<std::vector<std::string>> rows;             // SELECT的结果，文本协议，NULL为空串
+};
+
+typedef std::function<void(const SqlResult&)> SqlCallback;
+
+// 非阻塞的MySQL连接池：自己实现MySQL客户端/服务器协议(握手、mysql_native_password认证、COM_QUERY和文本结果集)，
+// 连接的socket注册在事件循环的Epoller上，一个线程就能让很多查询同时在途，不用为每次往返占住一个工作线程。
+// 任意线程都可以调用Query，回调总是在事件循环线程中执行
+class AsyncSqlPool {
+public:
+    // queryTimeoutMs是查询从进入事件循环到收到结果的期限，超过时回调失败结果
+    explicit AsyncSqlPool(Epoller* epoller, size_t maxPending = 1024, int queryTimeoutMs = 3000);
+    ~AsyncSqlPool();
+
+    // 解析地址并开始非阻塞连接，不等待连接完成
+    bool Init(const char* host, int port, const char* user, const char* pwd,
+              const char* dbName, int connSize);
+
+    void Query(std::string sql, SqlCallback cb);            // 排队的查询超过上限时回调失败结果
+    bool OnEvent(int fd, uint32_t events);                  // 事件循环线程调用，fd属于连接池时返回true
+    // 事件循环线程每轮调用：超过期限的查询回调失败，在途的超时查询关闭连接。返回到下一个期限的毫秒数，没有查询时返回-1
+    int Tick();
+
+    size_t ReadyCount() const;                              // 完成认证的连接数
+    size_t Outstanding() const { return outstanding_.load(std::memory_order_relaxed); }
+
+    static std::string Escape(const std::string& str);      // 转义字符串，拼进单引号里
+    static std::string NativePassword(const std::string& pwd, const std::string& scramble);  // mysql_native_password认证数据
+
+private:
+    enum STATE {                                            // 连接的状态
+        CLOSED = 0,
+        CONNECTING,                                         // 等待TCP连接建立
+        HANDSHAKE,                                          // 等待服务器的握手包
+        AUTH,                                               // 等待认证结果
+        READY,                                              // 空闲
+        QUERY_HEAD,                                         // 等待查询结果的第一个包
+        QUERY_COLUMNS,                                      // 读列定义
+        QUERY_ROWS,                                         // 读数据行
+    };
+
+    struct Request {
+        std::string sql;
+        SqlCallback cb;
+        bool rejected;                                      // 提交时已超过上限，直接回调失败
+        int64_t deadlineMs;                                 // 进入事件循环时设置的期限
+    };
+
+    struct Conn {
+        int fd = -1;
+        STATE state = CLOSED;
+        uint8_t seq = 0;                                    // 下一个包的序号
+        Buffer readBuff;
+        Buffer writeBuff;
+        Request req;                                        // 在途的查询
+        SqlResult result;
+        uint64_t columns = 0;                               // 结果集的列数
+    };
+
+    static const int RECONNECT_MS = 1000;                   // 连接失败后多久再重连
+
+    void Connect_(Conn& conn);
+    void Close_(Conn& conn, const std::string& why);
+    void OnWritable_(Conn& conn);
+    void OnReadable_(Conn& conn);
+    bool HandlePacket_(Conn& conn, const char* data, size_t len);   // 返回false时关闭连接
+    bool HandleHandshake_(Conn& conn, const char* data, size_t len);
+    bool HandleAuth_(Conn& conn, const char* data, size_t len);
+    void HandleResult_(Conn& conn, const char* data, size_t len);
+    void SendPacket_(Conn& conn, const std::string& payload);
+    void Complete_(Request& req, const SqlResult& result);
+    void Finish_(Conn& conn);                               // 当前查询完成，连接回到空闲
+    void Dispatch_();                                       // 把排队的查询交给空闲连接
+    void DrainInbox_();
+
+    Epoller* epoller_;
+    int wakeFd_;                                            // 其他线程提交查询时写eventfd唤醒事件循环
+    size_t maxPending_;                                     // 最多排队和在途的查询数
+    int queryTimeoutMs_;                                    // 查询的期限
+    std::atomic<size_t> outstanding_;                       // 排队和在途的查询数
+
+    sockaddr_in addr_;                                      // 数据库地址
+    std::string user_;
+    std::string pwd_;
+    std::string dbName_;
+    int64_t lastFailMs_;                                    // 上次连接失败的时间
+
+    std::vector<std::unique_ptr<Conn>> conns_;
+    std::unordered_map<int, Conn*> fdConns_;                // 文件描述符到连接
+    std::deque<Request> pending_;                           // 等待空闲连接的查询，只在事件循环线程中访问
+    std::mutex mtx_;                                        // 保护inbox_
+    std::vector<Request> inbox_;                            // 其他线程提交的查询
+};
+
+#endif // ASYNC_SQLCONNPOOL_H
@@ -0,0 +1,77 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <string>
+#include <atomic>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <assert.h>
+
+// 布隆过滤器：位数组按给定内存分配，哈希函数个数由目标误判率决定。
+// 位数组由原子的64位字组成，多个线程可以同时Add和MayContain，不用加锁
+class BloomFilter {
+public:
+    BloomFilter(size_t memoryBytes, double fpRate): count_(0) {
+        assert(memoryBytes > 0 && fpRate > 0 && fpRate < 1);
+        words_ = (memoryBytes + 7) / 8;
+        bits_ = words_ * 64;
+        bitmap_.reset(new std::atomic<uint64_t>[words_]);
+        for(size_t i = 0; i < words_; i++) { bitmap_[i].store(0, std::memory_order_relaxed); }
+        hashCount_ = std::max(1, static_cast<int>(std::lround(-std::log2(fpRate))));
+        capacity_ = static_cast<size_t>(bits_ * std::log(2.0) / hashCount_);
+    }
+
+    void Add(const std::string& key) {
+        uint64_t h1, h2;
+        Hash_(key, &h1, &h2);
+        for(int i = 0; i < hashCount_; i++) {
+            uint64_t bit = (h1 + i * h2) % bits_;
+            bitmap_[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+        }
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool MayContain(const std::string& key) const {         // 返回false时一定没有加入过
+        uint64_t h1, h2;
+        Hash_(key, &h1, &h2);
+        for(int i = 0; i < hashCount_; i++) {
+            uint64_t bit = (h1 + i * h2) % bits_;
+            if(!(bitmap_[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t Count() const { return count_.load(std::memory_order_relaxed); }   // 加入的次数(含重复)
+    size_t Capacity() const { return capacity_; }           // 保持目标误判率最多能放的元素数
+    size_t MemoryBytes() const { return words_ * 8; }
+    int HashCount() const { return hashCount_; }
+
+private:
+    // 双重哈希：两个独立的哈希组合出k个位置，h2取奇数避免步长为0
+    static void Hash_(const std::string& key, uint64_t* h1, uint64_t* h2) {
+        *h1 = std::hash<std::string>()(key);
+        uint64_t h = 14695981039346656037ULL;               // FNV-1a
+        for(unsigned char c : key) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        *h2 = h | 1;
+    }
+
+    size_t words_;                                          // 64位字的个数
+    size_t bits_;                                           // 总位数
+    int hashCount_;                                         // 哈希函数个数
+    size_t capacity_;
+    std::unique_ptr<std::atomic<uint64_t>[]> bitmap_;
+    std::atomic<size_t> count_;
+};
+
+#endif //BLOOM_FILTER_H
@@ -0,0 +1,98 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <assert.h>
+
+// 有界无锁多生产者多消费者环形队列(Dmitry Vyukov的算法)，
+// 每个槽位带一个序号，生产者和消费者各自CAS自己的位置，不用锁也不分配内存
+template<class T>
+class MpmcQueue {
+public:
+    explicit MpmcQueue(size_t capacity = 4096): cells_(new Cell[RoundUp_(capacity)]),
+            mask_(RoundUp_(capacity) - 1), enqueuePos_(0), dequeuePos_(0) {
+        for(size_t i = 0; i <= mask_; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    // 队列满返回false，此时item不会被移走
+    bool TryPush(T&& item) {
+        Cell* cell;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(diff == 0) {
+                if(enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+            }
+            else if(diff < 0) { return false; }         // 槽位还没被消费，队列满
+            else { pos = enqueuePos_.load(std::memory_order_relaxed); }
+        }
+        cell->data = std::move(item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空返回false
+    bool TryPop(T& item) {
+        Cell* cell;
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if(diff == 0) {
+                if(dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+            }
+            else if(diff < 0) { return false; }         // 槽位还没被生产，队列空
+            else { pos = dequeuePos_.load(std::memory_order_relaxed); }
+        }
+        item = std::move(cell->data);
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {                               // 近似大小，只用于统计和判断负载
+        size_t enq = enqueuePos_.load(std::memory_order_relaxed);
+        size_t deq = dequeuePos_.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;                        // 槽位序号，表示该槽位当前可以被生产还是被消费
+        T data;
+    };
+
+    static size_t RoundUp_(size_t n) {                  // 向上取2的幂
+        assert(n > 0);
+        size_t cap = 1;
+        while(cap < n) { cap <<= 1; }
+        return cap;
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    const size_t mask_;
+    char pad0_[64];                                     // 生产者位置和消费者位置放在不同的缓存行
+    std::atomic<size_t> enqueuePos_;
+    char pad1_[64];
+    std::atomic<size_t> dequeuePos_;
+    char pad2_[64];
+};
+
+#endif //MPMC_QUEUE_H
@@ -0,0 +1,47 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <string>
+#include <stdint.h>
+
+// SHA1摘要，返回20字节的二进制串。MySQL的native_password认证和凭据缓存的校验值都用它
+inline std::string Sha1(const std::string& data) {
+    auto Rol = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    std::string msg = data;
+    uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+    msg.push_back(static_cast<char>(0x80));
+    while(msg.size() % 64 != 56) { msg.push_back('\0'); }
+    for(int i = 7; i >= 0; i--) { msg.push_back(static_cast<char>((bits >> (i * 8)) & 0xff)); }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(msg.data());
+    for(size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[80];
+        for(int i = 0; i < 16; i++) {
+            w[i] = (uint32_t(p[off + 4 * i]) << 24) | (uint32_t(p[off + 4 * i + 1]) << 16) |
+                   (uint32_t(p[off + 4 * i + 2]) << 8) | uint32_t(p[off + 4 * i + 3]);
+        }
+        for(int i = 16; i < 80; i++) { w[i] = Rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1); }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if(i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+            else if(i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+            else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+            uint32_t t = Rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = Rol(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    std::string out;
+    for(int i = 0; i < 5; i++) {
+        for(int j = 3; j >= 0; j--) { out.push_back(static_cast<char>((h[i] >> (j * 8)) & 0xff)); }
+    }
+    return out;
+}
+
+#endif //SHA1_H
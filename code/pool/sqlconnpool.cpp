@@ -3,11 +3,26 @@
     Date         : 2022-12-24
 */
 #include "sqlconnpool.h"
+#include <chrono>
+#include <algorithm>
+#include "../timer/timecache.h"
 using namespace std;
 
 SqlConnPool::SqlConnPool() {
+    MAX_CONN_ = 0;
+    minConn_ = 0;
+    waitTimeoutMs_ = 3000;
+    pingIdleMs_ = 30000;
+    shrinkIdleMs_ = 60000;
+    openCount_ = 0;
     useCount_ = 0;
-    freeCount_ = 0;
+    isClosed_ = false;
+    acquires_ = 0;
+    waits_ = 0;
+    waitMsTotal_ = 0;
+    maxWaitMs_ = 0;
+    timeouts_ = 0;
+    reconnects_ = 0;
 }
 
 SqlConnPool* SqlConnPool::Instance() {
@@ -15,71 +30,336 @@ SqlConnPool* SqlConnPool::Instance() {
     return &connPool;
 }
 
-// 初始化mysql连接池，默认10个连接，放入connQue_可用数据库连接队列中，信号量开始为10
+// 初始化mysql连接池，connSize个连接同时建立，建立失败的留给后台线程补上
 void SqlConnPool::Init(const char* host, int port,
             const char* user,const char* pwd, const char* dbName,
-            int connSize = 10) {
+            int connSize, const vector<string>& stmts) {
     assert(connSize > 0);
+    host_ = host;
+    port_ = port;
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
+    stmtSqls_ = stmts;
     for (int i = 0; i < connSize; i++) {
-        MYSQL *sql = nullptr;
-        sql = mysql_init(sql);
-        if (!sql) {
-            LOG_ERROR("MySql init error!");
-            assert(sql);
+        conns_.emplace_back(new MYSQL);
+        stmts_[conns_.back().get()].assign(stmtSqls_.size(), nullptr);
+        inited_[conns_.back().get()] = false;
+    }
+    MAX_CONN_ = connSize;
+    minConn_ = connSize;
+
+    /* 并行建立连接，启动只等一次连接的耗时。多个线程同时mysql_init之前要先初始化库 */
+    mysql_library_init(0, nullptr, nullptr);
+    vector<char> connected(connSize, 0);
+    vector<thread> threads;
+    for (int i = 0; i < connSize; i++) {
+        threads.emplace_back([this, i, &connected] {
+            connected[i] = Open_(conns_[i].get());
+            mysql_thread_end();
+        });
+    }
+    for (auto& t : threads) { t.join(); }
+
+    int64_t now = TimeCache::ReadNowMs();
+    for (int i = 0; i < connSize; i++) {
+        if (connected[i]) {
+            connQue_.push_back({conns_[i].get(), now, now});
+            openCount_++;
+        } else {
+            spare_.push_back(conns_[i].get());
         }
-        sql = mysql_real_connect(sql, host,
-                                 user, pwd,
-                                 dbName, port, nullptr, 0);
-        if (!sql) {
-            LOG_ERROR("MySql Connect error!");
+    }
+    if (openCount_ < connSize) {
+        LOG_ERROR("MySql Connect error! %d of %d connected", openCount_, connSize);
+    }
+    maintainer_ = thread(&SqlConnPool::Maintain_, this);
+}
+
+void SqlConnPool::SetPolicy(int minConnSize, int waitTimeoutMs, int pingIdleMs, int shrinkIdleMs) {
+    lock_guard<mutex> locker(mtx_);
+    minConn_ = max(0, min(minConnSize, MAX_CONN_));
+    waitTimeoutMs_ = waitTimeoutMs;
+    pingIdleMs_ = pingIdleMs;
+    shrinkIdleMs_ = shrinkIdleMs;
+}
+
+// 在连接池持有的MYSQL对象上初始化并连接，然后准备所有语句，准备失败的留到GetStmt时再试
+bool SqlConnPool::Connect_(MYSQL* conn) {
+    if (!mysql_init(conn)) {
+        LOG_ERROR("MySql init error!");
+        return false;
+    }
+    inited_.at(conn) = true;
+    if (!mysql_real_connect(conn, host_.c_str(), user_.c_str(), pwd_.c_str(),
+                            dbName_.c_str(), port_, nullptr, 0)) {
+        return false;
+    }
+    for (size_t i = 0; i < stmtSqls_.size(); i++) {
+        GetStmt(conn, i);
+    }
+    return true;
+}
+
+bool SqlConnPool::Open_(MYSQL* conn) {
+    if (Connect_(conn)) { return true; }
+    if (inited_.at(conn)) { LOG_ERROR("MySql Connect error: %s", mysql_error(conn)); }
+    Close_(conn);
+    return false;
+}
+
+// mysql_init失败的对象里没有可释放的东西，mysql_close会读到未初始化的内存
+void SqlConnPool::Close_(MYSQL* conn) {
+    if (!inited_.at(conn)) { return; }
+    CloseStmts_(conn);
+    mysql_close(conn);
+    inited_.at(conn) = false;
+}
+
+MYSQL_STMT* SqlConnPool::GetStmt(MYSQL* conn, size_t id) {
+    vector<MYSQL_STMT*>& stmts = stmts_.at(conn);
+    assert(id < stmts.size());
+    if (!stmts[id] && inited_.at(conn)) {
+        MYSQL_STMT* stmt = mysql_stmt_init(conn);
+        if (stmt && mysql_stmt_prepare(stmt, stmtSqls_[id].c_str(), stmtSqls_[id].size()) != 0) {
+            LOG_ERROR("MySql prepare error: %s", mysql_stmt_error(stmt));
+            mysql_stmt_close(stmt);
+            stmt = nullptr;
         }
-        connQue_.push(sql);
+        stmts[id] = stmt;
     }
-    MAX_CONN_ = connSize;
-    sem_init(&semId_, 0, MAX_CONN_);
+    return stmts[id];
 }
 
-// 从连接池队列获得一个可用mysql连接
-MYSQL* SqlConnPool::GetConn() {
-    MYSQL *sql = nullptr;
-    if(connQue_.empty()){
-        LOG_WARN("SqlConnPool busy!");
-        return nullptr;
+// 断开后服务器端的语句句柄都失效了，关掉旧连接和语句，在同一个MYSQL对象上重新连接和准备
+bool SqlConnPool::Reconnect(MYSQL* conn) {
+    assert(conn);
+    Close_(conn);
+    if (!Connect_(conn)) {
+        LOG_ERROR("MySql reconnect error!");
+        Close_(conn);
+        return false;
     }
-    sem_wait(&semId_);
+    LOG_INFO("MySql reconnected");
+    lock_guard<mutex> locker(mtx_);
+    reconnects_++;
+    return true;
+}
+
+void SqlConnPool::CloseStmts_(MYSQL* conn) {
+    for (auto& stmt : stmts_.at(conn)) {
+        if (stmt) {
+            mysql_stmt_close(stmt);
+            stmt = nullptr;
+        }
+    }
+}
+
+bool SqlConnPool::Validate_(MYSQL* conn) {
+    if (!inited_.at(conn)) { return Reconnect(conn); }
+    if (mysql_ping(conn) == 0) { return true; }
+    LOG_WARN("MySql ping error: %s", mysql_error(conn));
+    return Reconnect(conn);
+}
+
+void SqlConnPool::Release_(MYSQL* conn) {
+    Close_(conn);
+    lock_guard<mutex> locker(mtx_);
+    openCount_--;
+    useCount_--;
+    spare_.push_back(conn);
+    cond_.notify_all();                         // 关闭时ClosePool也在等
+}
+
+MYSQL* SqlConnPool::GetConn() {
+    int timeoutMs;
     {
         lock_guard<mutex> locker(mtx_);
-        sql = connQue_.front();
-        connQue_.pop();
+        timeoutMs = waitTimeoutMs_;
+    }
+    return GetConn(timeoutMs);
+}
+
+// 优先取最近放回的空闲连接，没有空闲的就在上限内新建一个，都不行就等别人放回，超时返回nullptr
+MYSQL* SqlConnPool::GetConn(int timeoutMs) {
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(max(timeoutMs, 0));
+    int64_t start = TimeCache::ReadNowMs();
+    bool waited = false;
+    unique_lock<mutex> locker(mtx_);
+    while (!isClosed_) {
+        if (!connQue_.empty() || (openCount_ < MAX_CONN_ && !spare_.empty())) {
+            int64_t now = TimeCache::ReadNowMs();
+            acquires_++;
+            if (waited) {
+                waits_++;
+                waitMsTotal_ += now - start;
+                maxWaitMs_ = max(maxWaitMs_, now - start);
+            }
+            useCount_++;
+            if (!connQue_.empty()) {
+                IdleConn idle = connQue_.back();
+                connQue_.pop_back();
+                bool check = now - idle.checkedMs > pingIdleMs_;
+                locker.unlock();
+                if (!check || Validate_(idle.conn)) { return idle.conn; }
+                Release_(idle.conn);            // 重连不上，名额空出来，下一轮新建连接
+                locker.lock();
+                continue;
+            }
+            /* 按需新建连接 */
+            MYSQL* conn = spare_.back();
+            spare_.pop_back();
+            openCount_++;
+            locker.unlock();
+            if (Open_(conn)) { return conn; }
+            locker.lock();
+            openCount_--;
+            useCount_--;
+            spare_.push_back(conn);
+            return nullptr;                         // 数据库连不上，不再等待
+        }
+        if (!waited) {
+            LOG_WARN("SqlConnPool busy!");
+            waited = true;
+        }
+        if (timeoutMs < 0) {
+            cond_.wait(locker);
+        } else if (cond_.wait_until(locker, deadline) == cv_status::timeout &&
+                   connQue_.empty() && !(openCount_ < MAX_CONN_ && !spare_.empty())) {
+            timeouts_++;
+            LOG_WARN("SqlConnPool wait timeout!");
+            return nullptr;
+        }
     }
-    return sql;
+    return nullptr;
 }
 
-// 释放一个连接，放入到队列里，注意不是关闭连接，而是释放掉重新用
+// 释放一个连接，放回空闲队列的尾部，注意不是关闭连接，而是释放掉重新用。
+// 使用中重连失败的连接已经关掉，不放回空闲队列，归还名额；连接池关闭后归还的连接直接关闭
 void SqlConnPool::FreeConn(MYSQL* sql) {
     assert(sql);
+    int64_t now = TimeCache::ReadNowMs();
     lock_guard<mutex> locker(mtx_);
-    connQue_.push(sql);
-    sem_post(&semId_);
+    useCount_--;
+    if (isClosed_) {
+        Close_(sql);                            // 连接池已关闭，归还的连接直接关掉，ClosePool在等它
+        cond_.notify_all();
+        return;
+    }
+    if (inited_.at(sql)) {
+        connQue_.push_back({sql, now, now});
+    } else {
+        openCount_--;
+        spare_.push_back(sql);
+    }
+    cond_.notify_one();
+}
+
+// 后台线程：关闭超过下限且空闲太久的连接，ping空闲太久的连接，连接数不足下限时补上。
+// 网络操作都在锁外进行，正在检查的连接暂时不在空闲队列里
+void SqlConnPool::Maintain_() {
+    unique_lock<mutex> locker(mtx_);
+    while (true) {
+        closeCond_.wait_for(locker, chrono::milliseconds(CHECK_INTERVAL_MS), [this] { return isClosed_; });
+        if (isClosed_) { break; }
+        int64_t now = TimeCache::ReadNowMs();
+        vector<MYSQL*> shrink;
+        while (!connQue_.empty() && openCount_ > minConn_ &&
+               now - connQue_.front().idleSinceMs > shrinkIdleMs_) {   // 队头是最久没用的
+            shrink.push_back(connQue_.front().conn);
+            connQue_.pop_front();
+            openCount_--;
+        }
+        vector<IdleConn> check;
+        for (auto it = connQue_.begin(); it != connQue_.end();) {
+            if (now - it->checkedMs > pingIdleMs_) {
+                check.push_back(*it);
+                it = connQue_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        vector<MYSQL*> grow;
+        while (openCount_ < minConn_ && !spare_.empty()) {
+            grow.push_back(spare_.back());
+            spare_.pop_back();
+            openCount_++;
+        }
+        if (shrink.empty() && check.empty() && grow.empty()) { continue; }
+        locker.unlock();
+
+        for (MYSQL* conn : shrink) { Close_(conn); }
+        vector<char> checkOk, growOk;
+        for (auto& idle : check) {
+            checkOk.push_back(Validate_(idle.conn));
+            if (!checkOk.back()) { Close_(idle.conn); }
+        }
+        for (MYSQL* conn : grow) { growOk.push_back(Open_(conn)); }
+        if (!shrink.empty()) { LOG_INFO("SqlConnPool closed %zu idle connections", shrink.size()); }
+
+        locker.lock();
+        now = TimeCache::ReadNowMs();
+        spare_.insert(spare_.end(), shrink.begin(), shrink.end());
+        for (size_t i = 0; i < check.size(); i++) {
+            if (checkOk[i]) {
+                connQue_.push_front({check[i].conn, check[i].idleSinceMs, now});   // 放回冷端，不打乱收缩的顺序
+            } else {
+                spare_.push_back(check[i].conn);
+                openCount_--;
+            }
+        }
+        for (size_t i = 0; i < grow.size(); i++) {
+            if (growOk[i]) {
+                connQue_.push_front({grow[i], now, now});
+            } else {
+                spare_.push_back(grow[i]);
+                openCount_--;
+            }
+        }
+        cond_.notify_all();
+    }
+    locker.unlock();
+    mysql_thread_end();
 }
 
-// 关闭数据库连接池，即把所有的数据库连接都关闭了
+// 关闭数据库连接池：空闲连接现在关闭，取出去的连接由FreeConn在归还时关闭。
+// 等取出去的连接都还回来再释放连接对象和语句缓存，等不到就留着，还在用的线程不会碰到释放掉的对象
 void SqlConnPool::ClosePool() {
-    lock_guard<mutex> locker(mtx_);
-    while(!connQue_.empty()) {
-        auto item = connQue_.front();
-        connQue_.pop();
-        mysql_close(item);
+    {
+        lock_guard<mutex> locker(mtx_);
+        if (conns_.empty() || isClosed_) { return; }
+        isClosed_ = true;
+    }
+    closeCond_.notify_all();
+    cond_.notify_all();
+    if (maintainer_.joinable()) { maintainer_.join(); }
+
+    unique_lock<mutex> locker(mtx_);
+    for (auto& idle : connQue_) { Close_(idle.conn); }
+    connQue_.clear();
+    spare_.clear();
+    if (!cond_.wait_for(locker, chrono::milliseconds(CLOSE_WAIT_MS), [this] { return useCount_ <= 0; })) {
+        LOG_WARN("SqlConnPool closed with %d connections in use", useCount_);
+        return;
     }
+    conns_.clear();
+    stmts_.clear();
+    inited_.clear();
     mysql_library_end();
 }
 
-// 得到队列大小,即可用的数据库连接数量
+// 得到空闲队列大小,即可用的数据库连接数量
 int SqlConnPool::GetFreeConnCount() {
     lock_guard<mutex> locker(mtx_);
     return connQue_.size();
 }
 
+SqlConnPool::Stats SqlConnPool::GetStats() {
+    lock_guard<mutex> locker(mtx_);
+    return { openCount_, useCount_, static_cast<int>(connQue_.size()), acquires_, waits_,
+             waitMsTotal_, maxWaitMs_, timeouts_, reconnects_ };
+}
+
 SqlConnPool::~SqlConnPool() {
     ClosePool();
 }
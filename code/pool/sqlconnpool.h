@@ -7,37 +7,107 @@
 
 #include <mysql/mysql.h>
 #include <string>
-#include <queue>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_map>
 #include <mutex>
-#include <semaphore.h>
+#include <condition_variable>
 #include <thread>
 #include "../log/log.h"
 
+// 连接数在[最少连接数, connSize]之间伸缩：没有空闲连接时按需新建，多余的连接空闲太久后关闭。
+// 取连接时最多等待一段时间；空闲太久的连接交出去之前先mysql_ping，断开的自动重连，后台线程也定期检查
 class SqlConnPool {
 public:
+    struct Stats {                                  // 连接池的运行指标
+        int open;                                   // 已建立的连接数
+        int busy;                                   // 被取出使用中的连接数
+        int idle;                                   // 空闲连接数
+        uint64_t acquires;                          // 取连接的次数(不含超时)
+        uint64_t waits;                             // 其中需要等待的次数
+        int64_t waitMsTotal;                        // 等待的总时间(毫秒)
+        int64_t maxWaitMs;                          // 最长的一次等待
+        uint64_t timeouts;                          // 等待超时的次数
+        uint64_t reconnects;                        // 检查出断开后重连的次数
+    };
+
     static SqlConnPool* Instance();                 // 单例模式中的懒汉模式
 
-    MYSQL* GetConn();                               // 从连接池队列获得一个可用mysql连接
-    void FreeConn(MYSQL* conn);                     // 释放一个连接，放入到队列里，注意不是关闭连接，而是释放掉重新用
+    MYSQL* GetConn();                               // 从连接池获得一个可用mysql连接，按设置的超时等待，超时返回nullptr
+    MYSQL* GetConn(int timeoutMs);                  // 最多等待timeoutMs毫秒，负数表示一直等
+    void FreeConn(MYSQL* conn);                     // 释放一个连接，放回连接池，注意不是关闭连接，而是释放掉重新用
     int GetFreeConnCount();
 
     void Init(const char* host, int port,
-              const char* user,const char* pwd, 
-              const char* dbName, int connSize);    // 初始化mysql连接池，默认10个连接，放入connQue_可用数据库连接队列中，信号量开始为10
-    void ClosePool();                               // 关闭数据库连接池，即把所有的数据库连接都关闭了
+              const char* user,const char* pwd,
+              const char* dbName, int connSize,
+              const std::vector<std::string>& stmts = {});  // 初始化mysql连接池，connSize是连接数上限，开始时并行建立全部连接，
+                                                            // stmts是每个连接上预处理的语句，之后按下标取
+    // 连接数下限、取连接的等待超时、空闲多久要先ping、多余的连接空闲多久关闭，Init之后随时可以调整
+    void SetPolicy(int minConnSize, int waitTimeoutMs, int pingIdleMs, int shrinkIdleMs);
+    void ClosePool();                               // 关闭数据库连接池，空闲的连接马上关闭，取出去的归还时关闭
+
+    MYSQL_STMT* GetStmt(MYSQL* conn, size_t id);    // 取连接上第id条预处理语句，还没准备好(比如准备失败过)时现在准备
+    bool Reconnect(MYSQL* conn);                    // 连接断开后在原来的MYSQL对象上重连，并重新准备语句，调用者必须持有这个连接；
+                                                    // 失败时对象已经关掉，放回时归还名额
+
+    Stats GetStats();
 
 private:
     SqlConnPool();
     ~SqlConnPool();
 
+    struct IdleConn {                               // 空闲连接和它的时间戳
+        MYSQL* conn;
+        int64_t idleSinceMs;                        // 放回连接池的时间
+        int64_t checkedMs;                          // 上次确认连接可用的时间
+    };
+
+    static constexpr int CHECK_INTERVAL_MS = 1000;  // 后台检查的周期
+    static constexpr int CLOSE_WAIT_MS = 3000;      // 关闭时最多等取出去的连接还回来多久
+
+    bool Connect_(MYSQL* conn);                     // 建立连接并准备所有语句
+    bool Open_(MYSQL* conn);                        // 在备用的MYSQL对象上建立连接，失败时释放掉
+    void Close_(MYSQL* conn);                       // 关闭连接和语句，没初始化过的对象直接跳过
+    void CloseStmts_(MYSQL* conn);                  // 关闭连接上的预处理语句
+    bool Validate_(MYSQL* conn);                    // ping一下，断开了就重连
+    void Release_(MYSQL* conn);                     // 连接坏了又重连不上，关掉并归还名额
+    void Maintain_();                               // 后台线程：检查空闲连接、收缩多余连接、补足下限
+
     int MAX_CONN_;                                  // 最大数据库连接数
+    int minConn_;                                   // 最少保持的连接数
+    int waitTimeoutMs_;                             // 取连接默认的等待时间
+    int pingIdleMs_;                                // 空闲超过这个时间的连接使用前先ping
+    int shrinkIdleMs_;                              // 超过下限的连接空闲这么久后关闭
+    int openCount_;                                 // 已建立和正在建立的连接数
     int useCount_;                                  // 已经使用数据库连接数
-    int freeCount_;                                 // 空闲的数据库连接数
+    bool isClosed_;
 
-    std::queue<MYSQL *> connQue_;                   // 可用数据库连接队列
+    std::deque<IdleConn> connQue_;                  // 空闲连接，后进先出，队头是最久没用的
+    std::vector<MYSQL*> spare_;                     // 还没建立连接的MYSQL对象
+    std::vector<std::unique_ptr<MYSQL>> conns_;     // 连接对象由连接池持有，重连时地址不变，已取出的指针仍然有效
+    std::unordered_map<MYSQL*, std::vector<MYSQL_STMT*>> stmts_;    // 每个连接的语句缓存，Init后不再增删键，只有持有连接的线程访问对应的值
+    std::unordered_map<MYSQL*, bool> inited_;       // mysql_init成功且还没关闭，为假的对象不能close和ping，访问规则同stmts_
+    std::vector<std::string> stmtSqls_;             // 预处理语句的文本
+
+    std::string host_;                              // 重连用的连接参数
+    int port_;
+    std::string user_;
+    std::string pwd_;
+    std::string dbName_;
     std::mutex mtx_;                                // 互斥锁
-    sem_t semId_;                                   // 信号量
+    std::condition_variable cond_;                  // 有连接放回或名额空出来时唤醒等待者
+    std::condition_variable closeCond_;             // 关闭时唤醒后台线程
+    std::thread maintainer_;
+
+    uint64_t acquires_;                             // 指标，都在mtx_保护下更新
+    uint64_t waits_;
+    int64_t waitMsTotal_;
+    int64_t maxWaitMs_;
+    uint64_t timeouts_;
+    uint64_t reconnects_;
 };
 
 
-#endif // SQLCONNPOOL_H
\ No newline at end of file
+#endif // SQLCONNPOOL_H
@@ -0,0 +1,114 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef TASK_H
+#define TASK_H
+
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+#include <assert.h>
+
+// 只能移动的任务类型，小于INLINE_SIZE的可调用对象直接放在对象内部，不分配堆内存。
+// WebServer提交的[this, client]和std::bind(&WebServer::OnRead_, this, client)都放得下
+class Task {
+public:
+    static const size_t INLINE_SIZE = 48;                   // 内部存储的字节数
+
+    Task() noexcept: ops_(nullptr) {}
+
+    template<class F, class Fn = typename std::decay<F>::type,
+             class = typename std::enable_if<!std::is_same<Fn, Task>::value>::type>
+    Task(F&& f): ops_(nullptr) {
+        if(IsInline<Fn>()) {
+            new (&storage_) Fn(std::forward<F>(f));
+            ops_ = &InlineOps<Fn>::ops;
+        } else {
+            *reinterpret_cast<Fn**>(&storage_) = new Fn(std::forward<F>(f));
+            ops_ = &HeapOps<Fn>::ops;
+        }
+    }
+
+    Task(Task&& other) noexcept: ops_(other.ops_) {
+        if(ops_) {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other) {
+            reset();
+            if(other.ops_) {
+                ops_ = other.ops_;
+                ops_->move(&storage_, &other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    void operator()() {
+        assert(ops_);
+        ops_->invoke(&storage_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void reset() {                                          // 析构保存的可调用对象，释放它捕获的资源
+        if(ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    template<class Fn>
+    static constexpr bool IsInline() {                      // Fn是否能放进内部存储
+        return sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* self);
+        void (*move)(void* dst, void* src);                 // 移动构造到dst，并析构src
+        void (*destroy)(void* self);
+    };
+
+    template<class Fn>
+    struct InlineOps {
+        static void Invoke(void* self) { (*static_cast<Fn*>(self))(); }
+        static void Move(void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void Destroy(void* self) { static_cast<Fn*>(self)->~Fn(); }
+        static const Ops ops;
+    };
+
+    template<class Fn>
+    struct HeapOps {                                        // 太大的可调用对象退回到堆上
+        static void Invoke(void* self) { (**static_cast<Fn**>(self))(); }
+        static void Move(void* dst, void* src) { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); }
+        static void Destroy(void* self) { delete *static_cast<Fn**>(self); }
+        static const Ops ops;
+    };
+
+    typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type storage_;
+    const Ops* ops_;
+};
+
+template<class Fn>
+const Task::Ops Task::InlineOps<Fn>::ops = { &Invoke, &Move, &Destroy };
+
+template<class Fn>
+const Task::Ops Task::HeapOps<Fn>::ops = { &Invoke, &Move, &Destroy };
+
+#endif //TASK_H
@@ -7,63 +7,301 @@
 
 #include <mutex>
 #include <condition_variable>
-#include <queue>
 #include <thread>
-#include <functional>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include "task.h"
+#include "mpmcqueue.h"
+#include "../timer/timecache.h"
+
+// 任务放在有界无锁环形队列里，任务类型是小对象优化的Task，
+// 提交任务不分配内存，只有在有工作线程休眠时才去拿锁唤醒。
+// 亲和模式下每个工作线程有自己的有界队列，同一个key(连接的fd)的任务总是交给同一个线程，
+// 连接的缓冲区和解析状态留在同一个核的缓存里；还可以把工作线程绑定到CPU
 class ThreadPool {
 public:
-    explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()) {
+    struct Stats {                                          // 线程池的运行指标
+        size_t threads;                                     // 当前工作线程数
+        size_t queueSize;                                   // 排队任务数
+        int64_t waitMs;                                     // 控制回路看到的排队时间(毫秒)
+        uint64_t grows;                                     // 自适应扩容的线程数
+        uint64_t shrinks;                                   // 空闲退出的线程数
+    };
+
+    explicit ThreadPool(size_t threadCount = 8, size_t queueCapacity = 4096,
+                        bool affinity = false, bool pinCpu = false):
+            pool_(std::make_shared<Pool>(affinity ? threadCount : 1,
+                                         affinity ? (queueCapacity + threadCount - 1) / threadCount : queueCapacity)) {
             assert(threadCount > 0);
+            pool_->affinity = affinity;
+            pool_->pinCpu = pinCpu;
+            pool_->threads = threadCount;
+            pool_->minThreads = threadCount;
             for(size_t i = 0; i < threadCount; i++) {
-                std::thread([pool = pool_] {
-                    std::unique_lock<std::mutex> locker(pool->mtx);
-                    while(true) {
-                        if(!pool->tasks.empty()) {
-                            auto task = std::move(pool->tasks.front());
-                            pool->tasks.pop();
-                            locker.unlock();
-                            task();
-                            locker.lock();
-                        } 
-                        else if(pool->isClosed) break;
-                        else pool->cond.wait(locker);
-                    }
-                }).detach();
+                pool_->Enter();
+                std::thread(Worker_, pool_, i).detach();
             }
     }
 
     ThreadPool() = default;
 
     ThreadPool(ThreadPool&&) = default;
-    
+
     ~ThreadPool() {
         if(static_cast<bool>(pool_)) {
             {
-                std::lock_guard<std::mutex> locker(pool_->mtx);
-                pool_->isClosed = true;
+                std::lock_guard<std::mutex> locker(pool_->monitorMtx);
+                pool_->monitorClosed = true;
             }
-            pool_->cond.notify_all();
+            pool_->monitorCond.notify_all();
+            for(auto& slot : pool_->slots) {
+                {
+                    std::lock_guard<std::mutex> locker(slot->mtx);
+                    slot->isClosed = true;
+                }
+                slot->cond.notify_all();
+            }
+            /* 等所有线程执行完剩下的任务退出，析构返回后任务里用到的对象可以安全销毁 */
+            std::unique_lock<std::mutex> locker(pool_->exitMtx);
+            pool_->exitCond.wait(locker, [this] { return pool_->alive == 0; });
         }
     }
 
+    // 队列满时返回false，任务不会被执行
+    template<class F>
+    bool TryAddTask(F&& task) {
+        return TryAddTask(pool_->next.fetch_add(1, std::memory_order_relaxed), std::forward<F>(task));
+    }
+
+    // 亲和模式下key相同的任务交给同一个工作线程，共享队列模式下忽略key
+    template<class F>
+    bool TryAddTask(size_t key, F&& task) {
+        Slot& slot = pool_->SlotOf(key);
+        Job item{Task(std::forward<F>(task)), TimeCache::ReadNowMs()};
+        if(!slot.tasks.TryPush(std::move(item))) { return false; }
+        slot.Wake();
+        return true;
+    }
+
+    // 队列满时让出CPU直到有空位
     template<class F>
     void AddTask(F&& task) {
-        {
-            std::lock_guard<std::mutex> locker(pool_->mtx);
-            pool_->tasks.emplace(std::forward<F>(task));
+        AddTask(pool_->next.fetch_add(1, std::memory_order_relaxed), std::forward<F>(task));
+    }
+
+    template<class F>
+    void AddTask(size_t key, F&& task) {
+        Slot& slot = pool_->SlotOf(key);
+        Job item{Task(std::forward<F>(task)), TimeCache::ReadNowMs()};
+        while(!slot.tasks.TryPush(std::move(item))) {
+            std::this_thread::yield();
         }
-        pool_->cond.notify_one();
+        slot.Wake();
+    }
+
+    size_t QueueSize() const {                              // 近似的排队任务数
+        size_t n = 0;
+        for(auto& slot : pool_->slots) { n += slot->tasks.size(); }
+        return n;
+    }
+
+    int64_t QueueWaitMs() const {                           // 最近一个出队任务在队列里等待的时间(毫秒)
+        return pool_->waitMs.load(std::memory_order_relaxed);
+    }
+
+    // 开启自适应线程数：排队时间超过targetWaitMs时向maxThreads扩容，
+    // 工作线程空闲超过idleMs后退出，最少保留构造时的线程数。亲和模式下线程和队列一一对应，不支持
+    void EnableAdaptive(size_t maxThreads, int targetWaitMs, int idleMs) {
+        assert(!pool_->affinity && targetWaitMs > 0 && idleMs > 0);
+        if(pool_->affinity || pool_->adaptive.load()) { return; }
+        pool_->maxThreads = std::max(maxThreads, pool_->minThreads);
+        pool_->targetWaitMs = targetWaitMs;
+        pool_->idleMs = idleMs;
+        pool_->adaptive.store(true, std::memory_order_release);
+        pool_->Enter();
+        std::thread(Monitor_, pool_).detach();
+    }
+
+    Stats GetStats() const {
+        return { pool_->threads.load(std::memory_order_relaxed), QueueSize(),
+                 pool_->ctrlWaitMs.load(std::memory_order_relaxed),
+                 pool_->grows.load(std::memory_order_relaxed), pool_->shrinks.load(std::memory_order_relaxed) };
     }
 
 private:
-    struct Pool {
+    struct Job {                                            // 队列元素：任务和入队时间
+        Task task;
+        int64_t enqueueMs;
+    };
+
+    struct Slot {                                           // 一个有界队列和在它上面休眠的工作线程
+        explicit Slot(size_t capacity): tasks(capacity), isClosed(false), idle(0) {}
+
+        // 有线程在休眠才去拿锁唤醒，繁忙时提交任务不碰互斥锁
+        void Wake() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(idle.load(std::memory_order_seq_cst) > 0) {
+                { std::lock_guard<std::mutex> locker(mtx); }
+                cond.notify_one();
+            }
+        }
+
+        MpmcQueue<Job> tasks;
         std::mutex mtx;
         std::condition_variable cond;
         bool isClosed;
-        std::queue<std::function<void()>> tasks;
+        std::atomic<int> idle;                              // 休眠中的工作线程数
+    };
+
+    struct Pool {
+        Pool(size_t slotCount, size_t capacity): affinity(false), pinCpu(false), next(0), waitMs(0),
+                dequeued(0), threads(0), minThreads(0), maxThreads(0), adaptive(false),
+                targetWaitMs(0), idleMs(0), ctrlWaitMs(0), grows(0), shrinks(0), monitorClosed(false), alive(0) {
+            for(size_t i = 0; i < slotCount; i++) {
+                slots.emplace_back(new Slot(capacity));
+            }
+        }
+
+        Slot& SlotOf(size_t key) {
+            return *slots[slots.size() == 1 ? 0 : key % slots.size()];
+        }
+
+        void Enter() {                                      // 创建线程前登记
+            std::lock_guard<std::mutex> locker(exitMtx);
+            alive++;
+        }
+
+        void Leave() {                                      // 线程退出前注销
+            std::lock_guard<std::mutex> locker(exitMtx);
+            alive--;
+            exitCond.notify_all();
+        }
+
+        std::vector<std::unique_ptr<Slot>> slots;           // 共享队列模式只有一个，亲和模式每个工作线程一个
+        bool affinity;                                      // 是否亲和模式
+        bool pinCpu;                                        // 是否绑定CPU
+        std::atomic<size_t> next;                           // 没有key的任务轮流分配
+        std::atomic<int64_t> waitMs;                        // 最近一个出队任务的排队时间
+        std::atomic<uint64_t> dequeued;                     // 出队任务总数，控制回路用来判断工作线程是否全被阻塞
+
+        /* 自适应线程数 */
+        std::atomic<size_t> threads;                        // 当前工作线程数
+        size_t minThreads;                                  // 最少线程数
+        size_t maxThreads;                                  // 最多线程数
+        std::atomic<bool> adaptive;                         // 是否开启自适应
+        int targetWaitMs;                                   // 排队时间目标
+        int idleMs;                                         // 空闲多久退出
+        std::atomic<int64_t> ctrlWaitMs;                    // 控制回路最近一次看到的排队时间
+        std::atomic<uint64_t> grows;                        // 扩容的线程数
+        std::atomic<uint64_t> shrinks;                      // 空闲退出的线程数
+        std::mutex monitorMtx;                              // 控制回路单独休眠，不和工作线程共用条件变量，
+        std::condition_variable monitorCond;                // 否则提交任务的notify_one可能叫醒控制回路而不是工作线程
+        bool monitorClosed;
+        std::mutex exitMtx;                                 // 析构时等线程退出
+        std::condition_variable exitCond;
+        size_t alive;                                       // 还没退出的工作线程和控制回路
     };
+
+    static constexpr int MONITOR_INTERVAL_MS = 20;          // 控制回路的检查周期
+
+    // 工作线程，i是线程编号，亲和模式下对应自己的队列
+    static void Worker_(std::shared_ptr<Pool> pool, size_t i) {
+        if(pool->pinCpu) { PinCpu_(i); }
+        Slot& slot = *pool->slots[pool->affinity ? i : 0];
+        Job job;
+        while(true) {
+            if(slot.tasks.TryPop(job)) {
+                /* 记录这个任务在队列里等了多久，入队和出队读同一个时钟，不用事件循环的缓存 */
+                pool->waitMs.store(TimeCache::ReadNowMs() - job.enqueueMs, std::memory_order_relaxed);
+                pool->dequeued.fetch_add(1, std::memory_order_relaxed);
+                job.task();
+                job.task.reset();
+                continue;
+            }
+            /* 先登记休眠再检查队列，和Wake()配合不会丢唤醒 */
+            std::unique_lock<std::mutex> locker(slot.mtx);
+            slot.idle.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool timeout = false;
+            while(slot.tasks.empty() && !slot.isClosed && !timeout) {
+                if(pool->adaptive.load(std::memory_order_acquire)) {
+                    timeout = slot.cond.wait_for(locker, std::chrono::milliseconds(pool->idleMs))
+                                == std::cv_status::timeout;
+                } else {
+                    slot.cond.wait(locker);
+                }
+            }
+            slot.idle.fetch_sub(1, std::memory_order_relaxed);
+            if(slot.isClosed && slot.tasks.empty()) { break; }
+            if(timeout && slot.tasks.empty() && TryRetire_(*pool)) { break; }
+        }
+        pool->Leave();
+    }
+
+    // 空闲超时的线程在线程数大于下限时退出
+    static bool TryRetire_(Pool& pool) {
+        size_t n = pool.threads.load(std::memory_order_relaxed);
+        while(n > pool.minThreads) {
+            if(pool.threads.compare_exchange_weak(n, n - 1, std::memory_order_relaxed)) {
+                pool.shrinks.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 控制回路：排队时间超过目标就扩容。所有线程都阻塞(比如等MySQL)时没有任务出队，
+    // 最近出队的排队时间不会变，所以队列不空且没有出队时按停滞的时长累计
+    static void Monitor_(std::shared_ptr<Pool> pool) {
+        Slot& slot = *pool->slots[0];
+        uint64_t lastDequeued = pool->dequeued.load(std::memory_order_relaxed);
+        int64_t stalledMs = 0;
+        while(true) {
+            {
+                std::unique_lock<std::mutex> locker(pool->monitorMtx);
+                if(pool->monitorCond.wait_for(locker, std::chrono::milliseconds(MONITOR_INTERVAL_MS),
+                                              [&pool] { return pool->monitorClosed; })) {
+                    break;
+                }
+            }
+            uint64_t dequeued = pool->dequeued.load(std::memory_order_relaxed);
+            bool pending = !slot.tasks.empty();
+            stalledMs = (pending && dequeued == lastDequeued) ? stalledMs + MONITOR_INTERVAL_MS : 0;
+            lastDequeued = dequeued;
+            int64_t wait = pending ? std::max(pool->waitMs.load(std::memory_order_relaxed), stalledMs) : 0;
+            pool->ctrlWaitMs.store(wait, std::memory_order_relaxed);
+            if(wait <= pool->targetWaitMs) { continue; }
+
+            /* 每次最多扩容当前线程数的四分之一，至少一个 */
+            size_t n = pool->threads.load(std::memory_order_relaxed);
+            size_t add = std::min(pool->maxThreads - std::min(n, pool->maxThreads), std::max<size_t>(1, n / 4));
+            for(size_t k = 0; k < add; k++) {
+                pool->threads.fetch_add(1, std::memory_order_relaxed);
+                pool->grows.fetch_add(1, std::memory_order_relaxed);
+                pool->Enter();
+                std::thread(Worker_, pool, n + k).detach();
+            }
+        }
+        pool->Leave();
+    }
+
+    static void PinCpu_(size_t i) {                         // 把当前线程绑定到第i % 核数个CPU
+        unsigned int cpus = std::thread::hardware_concurrency();
+        if(cpus == 0) { return; }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(i % cpus, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
     std::shared_ptr<Pool> pool_;
 };
 
 
-#endif //THREADPOOL_H
\ No newline at end of file
+#endif //THREADPOOL_H
@@ -0,0 +1,254 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <assert.h>
+
+// Chase-Lev无锁双端队列：只有所属的工作线程在bottom端push/pop，其他线程在top端偷任务
+template<class T>
+class ChaseLevDeque {
+public:
+    explicit ChaseLevDeque(size_t capacity = 1024): top_(0), bottom_(0), buf_(capacity), mask_(capacity - 1) {
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0);   // 容量必须是2的幂
+    }
+
+    // 所属线程调用，队列满返回false，由调用者放入全局队列
+    bool push(T* item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        if(b - t >= static_cast<int64_t>(buf_.size())) { return false; }
+        buf_[b & mask_].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 所属线程调用，从bottom端取任务(后进先出，缓存更热)
+    T* pop() {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        T* item = nullptr;
+        if(t <= b) {
+            item = buf_[b & mask_].load(std::memory_order_relaxed);
+            if(t == b) {
+                /* 只剩最后一个，和偷取者竞争 */
+                if(!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    item = nullptr;
+                }
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 其他线程调用，从top端偷任务(先进先出)，竞争失败返回nullptr
+    T* steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if(t < b) {
+            T* item = buf_[t & mask_].load(std::memory_order_relaxed);
+            if(top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return item;
+            }
+        }
+        return nullptr;
+    }
+
+    bool empty() const {
+        return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed);
+    }
+
+    size_t size() const {
+        int64_t n = bottom_.load(std::memory_order_relaxed) - top_.load(std::memory_order_relaxed);
+        return n > 0 ? static_cast<size_t>(n) : 0;
+    }
+
+private:
+    std::atomic<int64_t> top_;                              // 偷取端
+    char pad_[64];                                          // 让top_和bottom_落在不同缓存行
+    std::atomic<int64_t> bottom_;                           // 所属线程端
+    std::vector<std::atomic<T*>> buf_;                      // 环形数组
+    int64_t mask_;
+};
+
+// 工作窃取线程池：每个工作线程一个Chase-Lev队列，外部线程(事件循环)提交到全局注入队列，
+// 工作线程一次从注入队列批量搬任务到本地队列，空闲时先自旋偷任务，再休眠，只在有线程休眠时才notify
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Task;
+
+    explicit WorkStealingPool(size_t threadCount = 8): pool_(std::make_shared<Pool>(threadCount)) {
+        assert(threadCount > 0);
+        for(size_t i = 0; i < threadCount; i++) {
+            threads_.emplace_back([pool = pool_, i] { pool->Run(i); });
+        }
+    }
+
+    WorkStealingPool() = default;
+
+    WorkStealingPool(WorkStealingPool&&) = default;
+
+    ~WorkStealingPool() {
+        if(static_cast<bool>(pool_)) {
+            {
+                std::lock_guard<std::mutex> locker(pool_->parkMtx);
+                pool_->isClosed = true;
+            }
+            pool_->parkCond.notify_all();
+        }
+        for(auto& t : threads_) { t.join(); }              // 等工作线程执行完剩下的任务退出
+    }
+
+    template<class F>
+    void AddTask(F&& task) {
+        Task* item = new Task(std::forward<F>(task));
+        /* 本池的工作线程提交任务直接进自己的队列 */
+        if(TlsPool_() == pool_.get() && pool_->workers[TlsIndex_()]->push(item)) {
+            pool_->pending.fetch_add(1, std::memory_order_seq_cst);
+        } else {
+            {
+                std::lock_guard<std::mutex> locker(pool_->injectMtx);
+                pool_->inject.push_back(item);
+            }
+            pool_->pending.fetch_add(1, std::memory_order_seq_cst);
+        }
+        pool_->Wake();
+    }
+
+    size_t QueueSize() const {                              // 近似的排队任务数
+        int64_t n = pool_->pending.load(std::memory_order_relaxed);
+        return n > 0 ? static_cast<size_t>(n) : 0;
+    }
+
+private:
+    static const size_t LOCAL_CAPACITY = 1024;              // 每个工作线程本地队列容量
+    static const size_t INJECT_BATCH = 32;                  // 一次从全局队列搬走的最大任务数
+    static const int SPIN_ROUNDS = 64;                      // 休眠前自旋找任务的轮数
+
+    struct Pool {
+        explicit Pool(size_t n): isClosed(false), pending(0), sleepers(0) {
+            for(size_t i = 0; i < n; i++) {
+                workers.emplace_back(new ChaseLevDeque<Task>(LOCAL_CAPACITY));
+            }
+        }
+
+        ~Pool() {
+            for(Task* t : inject) { delete t; }
+            for(auto& w : workers) {
+                while(Task* t = w->steal()) { delete t; }
+            }
+        }
+
+        // 有线程在休眠才去拿锁唤醒，繁忙时提交任务不碰条件变量
+        void Wake() {
+            if(sleepers.load(std::memory_order_seq_cst) > 0) {
+                { std::lock_guard<std::mutex> locker(parkMtx); }
+                parkCond.notify_one();
+            }
+        }
+
+        // 从全局队列搬一批到自己的本地队列，返回其中一个
+        Task* FromInject(size_t self) {
+            std::lock_guard<std::mutex> locker(injectMtx);
+            if(inject.empty()) { return nullptr; }
+            Task* first = inject.front();
+            inject.pop_front();
+            size_t batch = std::min(inject.size(), INJECT_BATCH - 1);
+            batch = std::min(batch, inject.size() / workers.size() + 1);
+            for(size_t k = 0; k < batch && !inject.empty(); k++) {
+                if(!workers[self]->push(inject.front())) { break; }
+                inject.pop_front();
+            }
+            return first;
+        }
+
+        // 从其他工作线程偷一个任务
+        Task* Steal(size_t self, size_t& seed) {
+            size_t n = workers.size();
+            for(size_t k = 1; k < n; k++) {
+                seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+                size_t victim = (self + 1 + (seed >> 33) % (n - 1)) % n;
+                if(Task* t = workers[victim]->steal()) { return t; }
+            }
+            return nullptr;
+        }
+
+        Task* Find(size_t self, size_t& seed) {
+            Task* t = workers[self]->pop();
+            if(!t) { t = FromInject(self); }
+            if(!t) { t = Steal(self, seed); }
+            return t;
+        }
+
+        void Run(size_t self) {
+            TlsPool_() = this;
+            TlsIndex_() = self;
+            size_t seed = self + 1;
+            while(true) {
+                Task* t = nullptr;
+                for(int spin = 0; spin < SPIN_ROUNDS && !t; spin++) {
+                    t = Find(self, seed);
+                    if(!t) {
+                        if(pending.load(std::memory_order_relaxed) <= 0) { break; }
+                        std::this_thread::yield();
+                    }
+                }
+                if(t) {
+                    pending.fetch_sub(1, std::memory_order_relaxed);
+                    (*t)();
+                    delete t;
+                    continue;
+                }
+                /* 休眠：先登记再检查，和Wake()配合不会丢唤醒 */
+                std::unique_lock<std::mutex> locker(parkMtx);
+                sleepers.fetch_add(1, std::memory_order_seq_cst);
+                while(pending.load(std::memory_order_seq_cst) <= 0 && !isClosed) {
+                    parkCond.wait(locker);
+                }
+                sleepers.fetch_sub(1, std::memory_order_relaxed);
+                if(isClosed && pending.load(std::memory_order_seq_cst) <= 0) { break; }
+            }
+            TlsPool_() = nullptr;
+        }
+
+        bool isClosed;
+        std::atomic<int64_t> pending;                       // 已提交还没取走的任务数
+        std::atomic<int> sleepers;                          // 休眠中的工作线程数
+        std::vector<std::unique_ptr<ChaseLevDeque<Task>>> workers;
+        std::mutex injectMtx;                               // 保护全局注入队列
+        std::deque<Task*> inject;                           // 全局注入队列
+        std::mutex parkMtx;                                 // 休眠用的锁
+        std::condition_variable parkCond;
+    };
+
+    static Pool*& TlsPool_() {                              // 当前线程所属的池，非工作线程为nullptr
+        static thread_local Pool* pool = nullptr;
+        return pool;
+    }
+
+    static size_t& TlsIndex_() {                            // 当前工作线程的下标
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    std::shared_ptr<Pool> pool_;
+    std::vector<std::thread> threads_;
+};
+
+#endif //WORK_STEALING_POOL_H
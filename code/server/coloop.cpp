@@ -0,0 +1,80 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "coloop.h"
+
+CoLoop::CoLoop(Epoller* epoller, HeapTimer* timer): epoller_(epoller), timer_(timer) {
+    assert(epoller_ && timer_);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(wakeFd_ >= 0);
+    epoller_->AddFd(wakeFd_, EPOLLIN);
+}
+
+CoLoop::~CoLoop() {
+    epoller_->DelFd(wakeFd_);
+    close(wakeFd_);
+}
+
+// 注册事件和超时，协程挂起后由OnEvent或OnTimeout_恢复
+void CoLoop::Wait_(EventAwaiter* awaiter) {
+    int fd = awaiter->fd;
+    assert(fd >= 0);
+    if(static_cast<size_t>(fd) >= waiters_.size()) {
+        waiters_.resize(fd + 1, nullptr);
+    }
+    assert(waiters_[fd] == nullptr);
+    waiters_[fd] = awaiter;
+    if(awaiter->timeoutMs > 0) {
+        timer_->add(fd, awaiter->timeoutMs, [this, fd] { OnTimeout_(fd); });
+    }
+    epoller_->ModFd(fd, awaiter->events);
+}
+
+// 事件循环线程调用，恢复等待fd的协程
+bool CoLoop::OnEvent(int fd, uint32_t events) {
+    if(fd == wakeFd_) {
+        RunPosted_();
+        return true;
+    }
+    if(fd < 0 || static_cast<size_t>(fd) >= waiters_.size() || !waiters_[fd]) {
+        return false;
+    }
+    EventAwaiter* awaiter = waiters_[fd];
+    waiters_[fd] = nullptr;
+    if(awaiter->timeoutMs > 0) { timer_->remove(fd); }
+    awaiter->result = events;
+    awaiter->handle.resume();
+    return true;
+}
+
+// 定时器回调，超时恢复等待fd的协程，结果为0
+void CoLoop::OnTimeout_(int fd) {
+    if(static_cast<size_t>(fd) >= waiters_.size() || !waiters_[fd]) { return; }
+    EventAwaiter* awaiter = waiters_[fd];
+    waiters_[fd] = nullptr;
+    awaiter->result = 0;
+    awaiter->handle.resume();
+}
+
+// 任意线程调用，把协程交回事件循环线程
+void CoLoop::Post(std::coroutine_handle<> h) {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        posted_.push_back(h);
+    }
+    uint64_t one = 1;
+    ssize_t ret = write(wakeFd_, &one, sizeof(one));
+    (void)ret;
+}
+
+void CoLoop::RunPosted_() {
+    uint64_t cnt;
+    while(read(wakeFd_, &cnt, sizeof(cnt)) > 0) {}
+    std::vector<std::coroutine_handle<>> ready;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        ready.swap(posted_);
+    }
+    for(auto h : ready) { h.resume(); }
+}
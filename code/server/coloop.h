@@ -0,0 +1,148 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef COLOOP_H
+#define COLOOP_H
+
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <coroutine>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include "epoller.h"
+#include "coroutine.h"
+#include "../timer/heaptimer.h"
+
+// 建在Epoller上的协程调度：协程co_await某个fd的可读/可写(带超时)，或者直接co_await一次读写，
+// 事件循环线程收到事件或定时器到期时恢复对应的协程；其他线程通过Post把协程交回事件循环线程恢复
+class CoLoop {
+public:
+    CoLoop(Epoller* epoller, HeapTimer* timer);
+    ~CoLoop();
+
+    struct EventAwaiter {                                   // 等待fd上的事件，返回发生的事件，0表示超时
+        CoLoop* loop;
+        int fd;
+        uint32_t events;                                    // 注册到epoll的完整事件(包括EPOLLONESHOT等)
+        int timeoutMs;                                      // 小于等于0表示不超时
+        uint32_t result;
+        std::coroutine_handle<> handle;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { handle = h; loop->Wait_(this); }
+        uint32_t await_resume() const noexcept { return result; }
+    };
+
+    struct IoResult {                                       // 一次读写的结果
+        ssize_t n;                                          // io的返回值
+        int err;                                            // io带回的errno，等待超时为ETIMEDOUT，对端关闭或出错为ECONNRESET
+    };
+
+    template<class Io>
+    struct IoAwaiter {                                      // 在fd上读写一次，io是ssize_t(int* err)，比如HttpConn的read/write。
+        EventAwaiter wait;                                  // tryFirst时先直接调用io，不是EAGAIN就不挂起；
+        Io io;                                              // 否则等fd就绪(带超时)后再调用
+        bool tryFirst;
+        IoResult res;
+
+        bool await_ready() { return tryFirst && Call_(); }
+        void await_suspend(std::coroutine_handle<> h) { wait.await_suspend(h); }
+        IoResult await_resume() {
+            if(!wait.handle) { return res; }                // 没有挂起
+            if(wait.result == 0) { return { -1, ETIMEDOUT }; }
+            uint32_t hangup = EPOLLHUP | EPOLLERR | ((wait.events & EPOLLIN) ? static_cast<uint32_t>(EPOLLRDHUP) : 0u);
+            if(wait.result & hangup) { return { -1, ECONNRESET }; }
+            Call_();
+            return res;
+        }
+        bool Call_() {
+            res.err = 0;
+            res.n = io(&res.err);
+            return !(res.n < 0 && res.err == EAGAIN);
+        }
+    };
+
+    template<class Pool, class F>
+    struct OffloadAwaiter {                                 // 把阻塞的调用交给线程池执行，完成后回到事件循环线程继续，
+        CoLoop* loop;                                       // 线程池队列满时不挂起，结果为false
+        Pool* pool;
+        F fn;
+        bool ok;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) {
+            ok = pool->TryAddTask([this, h] {
+                fn();
+                loop->Post(h);
+            });
+            return ok;
+        }
+        bool await_resume() const noexcept { return ok; }
+    };
+
+    template<class Start>
+    struct CallbackAwaiter {                                // 把回调式的异步接口变成可等待的，回调必须在事件循环线程中执行，
+        Start start;                                        // start(resume)发起操作，完成时调用resume
+        std::coroutine_handle<> handle;
+        bool suspended;
+        bool done;                                          // 回调在start里同步执行了，不需要挂起
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            start(std::function<void()>([this] {
+                if(suspended) { handle.resume(); }
+                else { done = true; }
+            }));
+            suspended = !done;
+            return suspended;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    EventAwaiter WaitEvent(int fd, uint32_t events, int timeoutMs) {
+        return EventAwaiter{ this, fd, events, timeoutMs, 0, nullptr };
+    }
+
+    // 等fd可读后读一次；请求之间通常还没有数据，先等再读，省掉一次读到EAGAIN的系统调用
+    template<class Io>
+    IoAwaiter<Io> Read(int fd, uint32_t events, int timeoutMs, Io io) {
+        return IoAwaiter<Io>{ WaitEvent(fd, events | EPOLLIN, timeoutMs), std::move(io), false, { 0, 0 } };
+    }
+
+    // 先直接写，内核缓冲区满(EAGAIN)时才等可写再写
+    template<class Io>
+    IoAwaiter<Io> Write(int fd, uint32_t events, int timeoutMs, Io io) {
+        return IoAwaiter<Io>{ WaitEvent(fd, events | EPOLLOUT, timeoutMs), std::move(io), true, { 0, 0 } };
+    }
+
+    template<class Pool, class F>
+    OffloadAwaiter<Pool, F> Offload(Pool& pool, F fn) {
+        return OffloadAwaiter<Pool, F>{ this, &pool, std::move(fn), false };
+    }
+
+    template<class Start>
+    CallbackAwaiter<Start> Callback(Start start) {
+        return CallbackAwaiter<Start>{ std::move(start), nullptr, false, false };
+    }
+
+    bool OnEvent(int fd, uint32_t events);                  // 事件循环线程调用，fd由协程接管时返回true
+    void Post(std::coroutine_handle<> h);                   // 任意线程调用，让事件循环线程恢复协程
+
+private:
+    void Wait_(EventAwaiter* awaiter);                      // 注册事件和超时
+    void OnTimeout_(int fd);                                // 超时恢复等待fd的协程
+    void RunPosted_();                                      // 恢复其他线程交回来的协程
+
+    Epoller* epoller_;
+    HeapTimer* timer_;
+    int wakeFd_;                                            // 其他线程Post时写eventfd唤醒epoll_wait
+    std::vector<EventAwaiter*> waiters_;                    // 下标是文件描述符，值是等待它的协程
+    std::mutex mtx_;                                        // 保护posted_
+    std::vector<std::coroutine_handle<>> posted_;           // 其他线程交回来等待恢复的协程
+};
+
+#endif //COLOOP_H
@@ -0,0 +1,181 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <assert.h>
+
+// 协程帧的池化分配器：按64字节分档的线程局部空闲链表，连接反复建立断开时帧内存直接复用，不进malloc。
+// 每个线程最多缓存MAX_CACHED_BYTES，连接高峰过后多出来的帧还给malloc；线程退出时缓存的帧全部释放
+class FramePool {
+public:
+    static void* Alloc(size_t size) {
+        size_t cls = Class_(size);
+        if(cls >= CLASS_COUNT) { return ::operator new(size); }
+        Cache& cache = Cache_();
+        FreeNode* node = cache.heads[cls];
+        if(node) {
+            cache.heads[cls] = node->next;
+            cache.bytes -= ClassSize_(cls);
+            return node;
+        }
+        return ::operator new(ClassSize_(cls));
+    }
+
+    static void Free(void* ptr, size_t size) {
+        size_t cls = Class_(size);
+        if(cls >= CLASS_COUNT) {
+            ::operator delete(ptr);
+            return;
+        }
+        Cache& cache = Cache_();
+        if(cache.bytes + ClassSize_(cls) > MAX_CACHED_BYTES) {
+            ::operator delete(ptr);
+            return;
+        }
+        FreeNode* node = static_cast<FreeNode*>(ptr);
+        node->next = cache.heads[cls];
+        cache.heads[cls] = node;
+        cache.bytes += ClassSize_(cls);
+    }
+
+    static size_t CachedBytes() { return Cache_().bytes; }  // 本线程缓存的空闲帧字节数
+
+    static const size_t MAX_CACHED_BYTES = 1 << 20;         // 每个线程最多缓存的空闲帧字节数
+
+private:
+    static const size_t GRANULE = 64;                       // 分档粒度
+    static const size_t CLASS_COUNT = 32;                   // 最大池化2KB的帧，更大的直接走operator new
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct Cache {                                          // 每个线程一组空闲链表，帧在哪个线程释放就放回哪个线程
+        FreeNode* heads[CLASS_COUNT] = { nullptr };
+        size_t bytes = 0;
+        ~Cache() {
+            for(FreeNode*& head : heads) {
+                while(head) {
+                    FreeNode* node = head;
+                    head = node->next;
+                    ::operator delete(node);
+                }
+            }
+        }
+    };
+
+    static size_t Class_(size_t size) { return (size + GRANULE - 1) / GRANULE - 1; }
+    static size_t ClassSize_(size_t cls) { return (cls + 1) * GRANULE; }
+
+    static Cache& Cache_() {
+        static thread_local Cache cache;
+        return cache;
+    }
+};
+
+// 协程promise的公共部分：帧从FramePool分配
+struct PooledPromise {
+    static void* operator new(size_t size) { return FramePool::Alloc(size); }
+    static void operator delete(void* ptr, size_t size) { FramePool::Free(ptr, size); }
+};
+
+// 不被等待的顶层协程(每个连接一个)，创建后立即运行，结束时自动销毁帧
+struct CoDetached {
+    struct promise_type: PooledPromise {
+        CoDetached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// 可以被co_await的惰性协程，完成后对称转移回等待者，用于把一段异步流程拆成子协程(比如异步查数据库)
+template<class T = void>
+class CoTask;
+
+namespace detail {
+
+template<class Promise>
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+        std::coroutine_handle<> cont = h.promise().continuation;
+        return cont ? cont : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+};
+
+struct CoTaskPromiseBase: PooledPromise {
+    std::coroutine_handle<> continuation;                   // 等待这个协程的上层协程
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { std::terminate(); }
+};
+
+} // namespace detail
+
+template<class T>
+class CoTask {
+public:
+    struct promise_type: detail::CoTaskPromiseBase {
+        T value;
+        CoTask get_return_object() noexcept {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        detail::FinalAwaiter<promise_type> final_suspend() noexcept { return {}; }
+        void return_value(T v) { value = std::move(v); }
+    };
+
+    explicit CoTask(std::coroutine_handle<promise_type> h): handle_(h) {}
+    CoTask(CoTask&& other) noexcept: handle_(std::exchange(other.handle_, nullptr)) {}
+    CoTask(const CoTask&) = delete;
+    ~CoTask() { if(handle_) { handle_.destroy(); } }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+        handle_.promise().continuation = cont;
+        return handle_;
+    }
+    T await_resume() { return std::move(handle_.promise().value); }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template<>
+class CoTask<void> {
+public:
+    struct promise_type: detail::CoTaskPromiseBase {
+        CoTask get_return_object() noexcept {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        detail::FinalAwaiter<promise_type> final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+    };
+
+    explicit CoTask(std::coroutine_handle<promise_type> h): handle_(h) {}
+    CoTask(CoTask&& other) noexcept: handle_(std::exchange(other.handle_, nullptr)) {}
+    CoTask(const CoTask&) = delete;
+    ~CoTask() { if(handle_) { handle_.destroy(); } }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+        handle_.promise().continuation = cont;
+        return handle_;
+    }
+    void await_resume() noexcept {}
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+#endif //COROUTINE_H
@@ -0,0 +1,163 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "metrics.h"
+#include <algorithm>
+#include <stdio.h>
+#include <assert.h>
+
+using namespace std;
+
+std::atomic<int> Metrics::nextShard_(0);
+std::atomic<bool> Metrics::enabled_(false);
+in_addr_t Metrics::allow_ = INADDR_ANY;
+
+namespace {
+void AppendValue(string& out, double v) {
+    char num[32];
+    out.append(num, snprintf(num, sizeof(num), "%.15g", v));
+}
+
+void AppendValue(string& out, uint64_t v) {
+    char num[24];
+    out.append(num, snprintf(num, sizeof(num), "%llu", static_cast<unsigned long long>(v)));
+}
+
+// name{labels,extra} 或 name{extra}，都为空时不加花括号
+void AppendName(string& out, const string& name, const char* suffix, const string& labels, const string& extra) {
+    out += name;
+    out += suffix;
+    if(!labels.empty() || !extra.empty()) {
+        out += '{';
+        out += labels;
+        if(!labels.empty() && !extra.empty()) { out += ','; }
+        out += extra;
+        out += '}';
+    }
+    out += ' ';
+}
+}
+
+uint64_t Metrics::Counter::Value() const {
+    uint64_t sum = 0;
+    for(const Cell& cell : cells_) { sum += cell.value.load(memory_order_relaxed); }
+    return sum;
+}
+
+Metrics::Histogram::Histogram(const vector<double>& bounds): bounds_(bounds), rows_(new Row[SHARDS]()) {
+    assert(bounds_.size() <= MAX_BUCKETS && is_sorted(bounds_.begin(), bounds_.end()));
+}
+
+void Metrics::Histogram::Observe(double value) {
+    size_t i = lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();    // le是小于等于
+    Row& row = rows_[Shard_()];
+    row.buckets[i].fetch_add(1, memory_order_relaxed);
+    row.sum.fetch_add(value, memory_order_relaxed);
+}
+
+void Metrics::Histogram::Collect(vector<uint64_t>* buckets, double* sum) const {
+    buckets->assign(bounds_.size() + 1, 0);
+    *sum = 0;
+    for(int s = 0; s < SHARDS; s++) {
+        for(size_t i = 0; i <= bounds_.size(); i++) { (*buckets)[i] += rows_[s].buckets[i].load(memory_order_relaxed); }
+        *sum += rows_[s].sum.load(memory_order_relaxed);
+    }
+}
+
+Metrics::Metrics(): sealed_(false) {}
+
+Metrics* Metrics::Instance() {
+    static Metrics inst;
+    return &inst;
+}
+
+void Metrics::Enable(in_addr_t allow) {
+    allow_ = allow;
+    Instance()->Seal();
+    enabled_.store(true, memory_order_release);
+}
+
+Metrics::Series& Metrics::Add_(const string& name, const string& help, TYPE type, const string& labels) {
+    assert(!sealed_.load(memory_order_relaxed));
+    auto it = index_.find(name);
+    if(it == index_.end()) {
+        it = index_.emplace(name, families_.size()).first;
+        families_.push_back({ name, help, type, {} });
+    }
+    Family& family = families_[it->second];
+    assert(family.type == type);
+    family.series.emplace_back();
+    family.series.back().labels = labels;
+    return family.series.back();
+}
+
+Metrics::Counter* Metrics::AddCounter(const string& name, const string& help, const string& labels) {
+    lock_guard<mutex> locker(mtx_);
+    Series& series = Add_(name, help, COUNTER, labels);
+    series.counter.reset(new Counter());
+    return series.counter.get();
+}
+
+Metrics::Histogram* Metrics::AddHistogram(const string& name, const string& help,
+                                          const vector<double>& bounds, const string& labels) {
+    lock_guard<mutex> locker(mtx_);
+    Series& series = Add_(name, help, HISTOGRAM, labels);
+    series.histogram.reset(new Histogram(bounds));
+    return series.histogram.get();
+}
+
+void Metrics::AddGauge(const string& name, const string& help, function<double()> fn, const string& labels) {
+    lock_guard<mutex> locker(mtx_);
+    Add_(name, help, GAUGE, labels).fn = std::move(fn);
+}
+
+void Metrics::AddCounterFunc(const string& name, const string& help, function<double()> fn, const string& labels) {
+    lock_guard<mutex> locker(mtx_);
+    Add_(name, help, COUNTER, labels).fn = std::move(fn);
+}
+
+// 直方图按Prometheus的约定输出累计的_bucket、_sum和_count。
+// Seal之后注册表不再变化，抓取不加锁，各个工作线程的抓取互不等待，读统计的函数也不在锁里调用
+string Metrics::Render() {
+    static const char* TYPE_NAME[] = { "counter", "gauge", "histogram" };
+    string out;
+    vector<uint64_t> buckets;
+    unique_lock<mutex> locker(mtx_, defer_lock);
+    if(!sealed_.load(memory_order_acquire)) { locker.lock(); }
+    for(const Family& family : families_) {
+        out += "# HELP " + family.name + " " + family.help + "\n";
+        out += "# TYPE " + family.name + " " + TYPE_NAME[family.type] + "\n";
+        for(const Series& series : family.series) {
+            if(series.histogram) {
+                double sum;
+                series.histogram->Collect(&buckets, &sum);
+                const vector<double>& bounds = series.histogram->Bounds();
+                uint64_t count = 0;
+                for(size_t i = 0; i < buckets.size(); i++) {
+                    count += buckets[i];
+                    string le = "le=\"+Inf\"";
+                    if(i < bounds.size()) {
+                        le = "le=\"";
+                        AppendValue(le, bounds[i]);
+                        le += '"';
+                    }
+                    AppendName(out, family.name, "_bucket", series.labels, le);
+                    AppendValue(out, count);
+                    out += '\n';
+                }
+                AppendName(out, family.name, "_sum", series.labels, "");
+                AppendValue(out, sum);
+                out += '\n';
+                AppendName(out, family.name, "_count", series.labels, "");
+                AppendValue(out, count);
+            } else {
+                AppendName(out, family.name, "", series.labels, "");
+                if(series.counter) { AppendValue(out, series.counter->Value()); }
+                else { AppendValue(out, series.fn()); }
+            }
+            out += '\n';
+        }
+    }
+    return out;
+}
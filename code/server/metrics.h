@@ -0,0 +1,107 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <stdint.h>
+#include <netinet/in.h>
+
+// 指标注册表，按Prometheus文本格式输出。计数器和直方图按线程分片，每个线程只加自己的分片(各占一个缓存行)，
+// 请求路径上只有一次不竞争的原子加法，抓取时才把分片加起来；已有的统计(线程池、连接池、日志的GetStats)
+// 注册成函数，抓取时调用。注册在开始处理请求之前完成，注册的对象一直有效；Seal之后注册表只读，抓取不再加锁
+class Metrics {
+public:
+    static const int SHARDS = 32;                           // 分片数，线程多于它时按顺序共用
+    static const int MAX_BUCKETS = 24;                      // 直方图最多的桶数(不含+Inf)
+    static constexpr char PATH[] = "/metrics";              // 抓取的路径
+    static constexpr char CONTENT_TYPE[] = "text/plain; version=0.0.4";
+
+    class Counter {                                         // 只增不减的计数
+    public:
+        Counter(): cells_() {}
+        void Inc(uint64_t n = 1) { cells_[Shard_()].value.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t Value() const;                             // 所有分片的和
+    private:
+        struct alignas(64) Cell { std::atomic<uint64_t> value; };
+        Cell cells_[SHARDS];
+    };
+
+    class Histogram {                                       // 固定上界的分布，le是桶的上界
+    public:
+        explicit Histogram(const std::vector<double>& bounds);
+        void Observe(double value);
+        // 汇总所有分片，buckets是各桶(最后一个是+Inf)的非累计个数
+        void Collect(std::vector<uint64_t>* buckets, double* sum) const;
+        const std::vector<double>& Bounds() const { return bounds_; }
+    private:
+        struct alignas(64) Row {
+            std::atomic<uint64_t> buckets[MAX_BUCKETS + 1];
+            std::atomic<double> sum;
+        };
+        std::vector<double> bounds_;
+        std::unique_ptr<Row[]> rows_;
+    };
+
+    Metrics();
+    static Metrics* Instance();
+
+    // 同名的指标放在一起输出，labels是这一条的标签，如 code="2xx"，不带花括号
+    Counter* AddCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Histogram* AddHistogram(const std::string& name, const std::string& help,
+                            const std::vector<double>& bounds, const std::string& labels = "");
+    void AddGauge(const std::string& name, const std::string& help,
+                  std::function<double()> fn, const std::string& labels = "");
+    void AddCounterFunc(const std::string& name, const std::string& help,   // 已有的只增计数，抓取时调用fn
+                        std::function<double()> fn, const std::string& labels = "");
+
+    std::string Render();                                   // 汇总所有指标，生成抓取的响应体
+    void Seal() { sealed_.store(true, std::memory_order_release); }  // 注册完成，之后不能再注册
+
+    // 全局注册表注册完成后打开/metrics，只接受来自allow的抓取，INADDR_ANY表示不限制(网络字节序)
+    static void Enable(in_addr_t allow);
+    static bool Enabled() { return enabled_.load(std::memory_order_acquire); }
+    static bool Allowed(in_addr_t peer) { return allow_ == INADDR_ANY || peer == allow_; }
+
+private:
+    enum TYPE { COUNTER = 0, GAUGE, HISTOGRAM };
+
+    struct Series {                                         // 一条带标签的指标，三个来源只用一个
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Histogram> histogram;
+        std::function<double()> fn;
+    };
+
+    struct Family {                                         // 同名指标，共用HELP和TYPE
+        std::string name;
+        std::string help;
+        TYPE type;
+        std::vector<Series> series;
+    };
+
+    Series& Add_(const std::string& name, const std::string& help, TYPE type, const std::string& labels);
+    static int Shard_() {                                   // 线程第一次使用时按顺序分配的分片
+        thread_local int shard = nextShard_.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+        return shard;
+    }
+
+    static std::atomic<int> nextShard_;
+    static std::atomic<bool> enabled_;
+    static in_addr_t allow_;                                // 允许抓取的地址，Enable之前写好
+
+    std::mutex mtx_;                                        // 保护注册表，Seal之前抓取时也持有
+    std::atomic<bool> sealed_;                              // 注册表是否已经只读
+    std::vector<Family> families_;                          // 按注册顺序输出
+    std::unordered_map<std::string, size_t> index_;         // 名字到families_下标
+};
+
+#endif //METRICS_H
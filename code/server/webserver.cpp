@@ -6,21 +6,48 @@
 
 using namespace std;
 
+const char WebServer::BUSY_RESPONSE[] =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Retry-After: 1\r\n"
+        "Connection: close\r\n"
+        "Content-length: 0\r\n\r\n";
+
 WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
+            bool openLog, int logLevel, int logQueSize, int poolMode, int dbThreadNum, int asyncSqlNum):
             port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+            timer_(new HeapTimer()), epoller_(new Epoller()), poolMode_(poolMode),
+            overloadPolicy_(OVERLOAD_NONE), maxQueueDepth_(0), maxQueueWaitMs_(0),
+            isOverloaded_(false), listenPaused_(false),
+            rejectCount_(0), pauseCount_(0), acceptPauseCount_(0), acceptCount_(nullptr)
     {
+    if(poolMode == WORK_STEALING) { stealPool_.reset(new WorkStealingPool(threadNum)); }
+    else {
+        bool affinity = (poolMode == AFFINITY || poolMode == AFFINITY_PINNED);
+        threadpool_.reset(new ThreadPool(threadNum, 4096, affinity, poolMode == AFFINITY_PINNED));
+    }
     // /home/liudou/WebServer-master/resources/
     srcDir_ = getcwd(nullptr, 256);
     assert(srcDir_);
     strncat(srcDir_, "/resources/", 16);
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
-    SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
+    if(dbThreadNum > 0) {
+        dbpool_.reset(new ThreadPool(dbThreadNum, DB_QUEUE_SIZE));
+    }
+    if(poolMode == COROUTINE) { coLoop_.reset(new CoLoop(epoller_.get(), timer_.get())); }
+    if(connPoolNum > 0) {
+        SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum, MySqlUserStore::SQL_STMTS);
+        userStore_.reset(new MySqlUserStore());
+    }
+    HttpRequest::userStore = userStore_.get();
+    if(asyncSqlNum > 0) {
+        asyncSql_.reset(new AsyncSqlPool(epoller_.get()));
+        if(!asyncSql_->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, asyncSqlNum)) { asyncSql_.reset(); }
+    }
+    HttpRequest::deferVerify = dbpool_ || coLoop_ || asyncSql_;    // 协程模式下数据库验证总是交给线程池或异步连接池，不阻塞事件循环
 
     // 初始化事件的模式
     InitEventMode_(trigMode);
@@ -37,16 +64,31 @@ WebServer::WebServer(
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
             LOG_INFO("LogSys level: %d", logLevel);
+            if(logLevel < LOG_MIN_LEVEL) { LOG_WARN("Log level %d below LOG_MIN_LEVEL %d, lower lines are compiled out", logLevel, LOG_MIN_LEVEL); }
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d, mode: %s", connPoolNum, threadNum,
+                            PoolModeName_(poolMode));
+            LOG_INFO("DbPool num: %d, AsyncSqlPool num: %d", dbThreadNum, asyncSql_ ? asyncSqlNum : 0);
         }
     }
+    if(userStore_) {
+        HttpRequest::uniqueNames = userStore_->HasUniqueNames();
+        if(!HttpRequest::uniqueNames) { LOG_WARN("No unique key on user.username, register always checks for duplicates"); }
+    }
 }
 
 WebServer::~WebServer() {
+    /* 先等工作线程退出，没有线程还在查用户表，再销毁用户存储和连接池。
+       IO线程池的任务会提交到数据库线程池，所以数据库线程池最后停 */
+    threadpool_.reset();
+    stealPool_.reset();
+    dbpool_.reset();
     close(listenFd_);
     isClose_ = true;
     free(srcDir_);
+    HttpRequest::userStore = nullptr;
+    HttpRequest::uniqueNames = false;
+    userStore_.reset();                         // 先提交排队的注册，再关闭连接池
     SqlConnPool::Instance()->ClosePool();
 }
 
@@ -79,6 +121,7 @@ void WebServer::InitEventMode_(int trigMode) {
 void WebServer::Start() {
     int timeMS = -1;  // timeMS将传递给epoll_wait中第四个参数timeout
     if(!isClose_) { LOG_INFO("========== Server start =========="); }
+    TimeCache::Update();
     while(!isClose_) {
         // 在每一次循环里先清除掉超时的通信
         if(timeoutMS_ > 0) {
@@ -88,7 +131,17 @@ void WebServer::Start() {
         // timeout == 0时不管有无事件发生都直接返回
         // timeout > 0时有事件发生直接返回，无事件发生最多等待timeout时间返回
         // 指定timeMS时间，如果无事件发生最多等待timeMS时间，然后直接下一次循环清除掉超时的通信
+        if(asyncSql_) {
+            /* 异步查询的期限也要按时检查 */
+            int sqlMS = asyncSql_->Tick();
+            if(sqlMS >= 0 && (timeMS < 0 || sqlMS < timeMS)) { timeMS = sqlMS; }
+        }
+        if(isOverloaded_) {
+            // 过载时不能一直阻塞，定期检查负载是否降下来，恢复暂停的读事件或accept
+            timeMS = (timeMS < 0 || timeMS > PAUSE_POLL_MS) ? PAUSE_POLL_MS : timeMS;
+        }
         int eventCnt = epoller_->Wait(timeMS);
+        TimeCache::Update();                // 每次唤醒只读一次时钟，本批事件的定时器、日志、Date头共用
         for(int i = 0; i < eventCnt; i++) {
             /* 处理事件 */
             int fd = epoller_->GetEventFd(i);
@@ -96,6 +149,12 @@ void WebServer::Start() {
             if(fd == listenFd_) {
                 DealListen_();              // 这个函数中会加入一个新的定时器
             }
+            else if(asyncSql_ && asyncSql_->OnEvent(fd, events)) {
+                                            // 异步数据库连接的读写，回调里完成验证
+            }
+            else if(coLoop_) {
+                coLoop_->OnEvent(fd, events);   // 恢复等待这个fd的协程
+            }
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 assert(users_.count(fd) > 0);
                 CloseConn_(&users_[fd]);
@@ -111,9 +170,280 @@ void WebServer::Start() {
                 LOG_ERROR("Unexpected event");
             }
         }
+        if(isOverloaded_) {
+            ResumePaused_();
+        }
+    }
+}
+
+void WebServer::SetLogBackend(int backend, bool binary) {
+    if(!Log::Instance()->IsOpen()) { return; }
+    Log::Instance()->SetBackend(static_cast<Log::BACKEND>(backend), binary);
+    LOG_INFO("Log backend: %s, binary: %s", backend == Log::BLOCK_BACKEND ? "block" : "ring", binary ? "true" : "false");
+}
+
+void WebServer::SetLogOverflow(int policy) {
+    if(!Log::Instance()->IsOpen()) { return; }
+    Log::Instance()->SetOverflowPolicy(static_cast<Log::OVERFLOW_POLICY>(policy));
+    LOG_INFO("Log overflow policy: %d", policy);
+}
+
+void WebServer::SetLogArchive(bool compress, size_t maxFiles, size_t maxMB) {
+    if(!Log::Instance()->IsOpen()) { return; }
+    Log::Instance()->SetArchive(compress, maxFiles, static_cast<uint64_t>(maxMB) * 1024 * 1024);
+    LOG_INFO("Log archive: compress %s, max files: %zu, max size: %zuMB", compress ? "true" : "false", maxFiles, maxMB);
+}
+
+void WebServer::SetAccessSampling(int code, double rate) {
+    AccessLog::Instance()->SetSampling(code, rate);
+    LOG_INFO("Access log sampling: %d%s keep %.4f", code, code >= 1 && code <= 5 ? "xx" : "", rate);
+}
+
+bool WebServer::SetAccessLog(const char* path, int format, size_t ringSize) {
+    if(!AccessLog::Instance()->Open(path, static_cast<AccessLog::FORMAT>(format), ringSize)) {
+        LOG_ERROR("Access log %s open error!", path);
+        return false;
+    }
+    LOG_INFO("Access log: %s, format: %d", path, format);
+    return true;
+}
+
+void WebServer::SetOverloadPolicy(int policy, size_t maxQueueDepth, int maxQueueWaitMs) {
+    overloadPolicy_ = policy;
+    maxQueueDepth_ = maxQueueDepth;
+    maxQueueWaitMs_ = maxQueueWaitMs;
+    LOG_INFO("Overload policy: %d, max queue depth: %zu, max queue wait: %dms",
+                    policy, maxQueueDepth, maxQueueWaitMs);
+}
+
+void WebServer::SetAdaptivePool(size_t maxThreads, size_t maxDbThreads, int targetWaitMs, int idleMs) {
+    if(poolMode_ == SHARED_QUEUE) {
+        threadpool_->EnableAdaptive(maxThreads, targetWaitMs, idleMs);
+    } else {
+        LOG_WARN("Adaptive pool needs SHARED_QUEUE mode, keep %s fixed", PoolModeName_(poolMode_));
+    }
+    if(dbpool_) {
+        dbpool_->EnableAdaptive(maxDbThreads, targetWaitMs, idleMs);
+    }
+    LOG_INFO("Adaptive pool max: %zu, db max: %zu, target wait: %dms, idle: %dms",
+                    maxThreads, maxDbThreads, targetWaitMs, idleMs);
+}
+
+void WebServer::SetUserCache(size_t capacity, int ttlMs, int negativeTtlMs) {
+    UserCache::Instance()->Init(capacity, ttlMs, negativeTtlMs);
+    LOG_INFO("UserCache capacity: %zu, ttl: %dms, negative ttl: %dms", capacity, ttlMs, negativeTtlMs);
+}
+
+bool WebServer::SetLocalUserStore(const char* path, int syncIntervalMs) {
+    std::unique_ptr<LocalUserStore> store(new LocalUserStore());
+    if(!store->Init(path, syncIntervalMs)) {
+        LOG_ERROR("LocalUserStore init error, keep %s", userStore_ ? userStore_->Name() : "none");
+        return false;
+    }
+    userStore_ = std::move(store);
+    HttpRequest::userStore = userStore_.get();
+    HttpRequest::uniqueNames = userStore_->HasUniqueNames();
+    LOG_INFO("UserStore: local %s, sync interval: %dms", path, syncIntervalMs);
+    return true;
+}
+
+void WebServer::SetRegisterBatch(int intervalMs, size_t maxRows) {
+    MySqlUserStore* store = dynamic_cast<MySqlUserStore*>(userStore_.get());
+    if(!store) {
+        LOG_WARN("Register batch needs the mysql user store");
+        return;
+    }
+    store->EnableBatch(intervalMs, maxRows);
+    LOG_INFO("Register batch interval: %dms, max rows: %zu", intervalMs, maxRows);
+}
+
+void WebServer::SetSqlPool(int minConn, int waitTimeoutMs, int pingIdleMs, int shrinkIdleMs) {
+    SqlConnPool::Instance()->SetPolicy(minConn, waitTimeoutMs, pingIdleMs, shrinkIdleMs);
+    LOG_INFO("SqlConnPool min: %d, wait timeout: %dms, ping idle: %dms, shrink idle: %dms",
+                    minConn, waitTimeoutMs, pingIdleMs, shrinkIdleMs);
+}
+
+void WebServer::SetUserFilter(size_t memoryBytes, double fpRate) {
+    if(!userStore_) {
+        LOG_WARN("UserFilter needs a user store");
+        return;
+    }
+    if(!HttpRequest::uniqueNames) {
+        LOG_WARN("UserFilter needs a unique key on user names");
+        return;
+    }
+    LOG_INFO("UserFilter memory: %zuKB, false positive rate: %g", memoryBytes / 1024, fpRate);
+    UserFilter::Instance()->Init(userStore_.get(), memoryBytes, fpRate);
+}
+
+// 请求路径上的计数在HttpConn和HttpResponse里，其余的都是抓取时读已有的统计
+void WebServer::SetMetrics(bool enable, const char* allowIp) {
+    if(!enable || Metrics::Enabled()) { return; }
+    struct in_addr allow;
+    if(inet_pton(AF_INET, allowIp, &allow) != 1) {
+        LOG_ERROR("Metrics allow address error: %s", allowIp);
+        return;
+    }
+    Metrics* metrics = Metrics::Instance();
+    HttpConn::InitMetrics(metrics);
+    HttpResponse::InitMetrics(metrics);
+    acceptCount_ = metrics->AddCounter("webserver_connections_accepted_total", "Client connections accepted.");
+    metrics->AddCounterFunc("webserver_overload_rejected_total", "Connections answered with 503 while overloaded.",
+                            [this] { return static_cast<double>(GetOverloadStats().rejected); });
+    metrics->AddCounterFunc("webserver_overload_paused_reads_total", "Read events held back while overloaded.",
+                            [this] { return static_cast<double>(GetOverloadStats().pausedReads); });
+    metrics->AddCounterFunc("webserver_overload_accept_pauses_total", "Times accept was paused while overloaded.",
+                            [this] { return static_cast<double>(GetOverloadStats().acceptPauses); });
+
+    if(threadpool_) { RegisterPool_(metrics, threadpool_.get(), "io"); }
+    if(stealPool_) {
+        metrics->AddGauge("threadpool_queue_depth", "Tasks waiting in the pool queues.",
+                          [this] { return static_cast<double>(stealPool_->QueueSize()); }, "pool=\"io\"");
+    }
+    if(dbpool_) { RegisterPool_(metrics, dbpool_.get(), "db"); }
+
+    HeapTimer* timer = timer_.get();
+    metrics->AddGauge("heaptimer_timers", "Connection timers in the heap.",
+                      [timer] { return static_cast<double>(timer->size()); });
+    metrics->AddCounterFunc("heaptimer_expired_total", "Connection timers that expired.",
+                            [timer] { return static_cast<double>(timer->expired()); });
+
+    SqlConnPool* sql = SqlConnPool::Instance();
+    metrics->AddGauge("sqlconnpool_connections", "Open MySQL connections.",
+                      [sql] { return sql->GetStats().open; });
+    metrics->AddGauge("sqlconnpool_connections_busy", "MySQL connections taken from the pool.",
+                      [sql] { return sql->GetStats().busy; });
+    metrics->AddCounterFunc("sqlconnpool_acquires_total", "Connections taken from the pool.",
+                            [sql] { return static_cast<double>(sql->GetStats().acquires); });
+    metrics->AddCounterFunc("sqlconnpool_waits_total", "Acquires that had to wait for a connection.",
+                            [sql] { return static_cast<double>(sql->GetStats().waits); });
+    metrics->AddCounterFunc("sqlconnpool_wait_seconds_total", "Time spent waiting for a connection.",
+                            [sql] { return sql->GetStats().waitMsTotal / 1e3; });
+    metrics->AddCounterFunc("sqlconnpool_timeouts_total", "Acquires that timed out.",
+                            [sql] { return static_cast<double>(sql->GetStats().timeouts); });
+    metrics->AddCounterFunc("sqlconnpool_reconnects_total", "Broken connections reopened.",
+                            [sql] { return static_cast<double>(sql->GetStats().reconnects); });
+
+    Log* log = Log::Instance();
+    static const char* LEVELS[] = { "debug", "info", "warn", "error" };
+    for(int i = 0; i < 4; i++) {
+        metrics->AddCounterFunc("log_dropped_lines_total", "Log lines dropped because the buffer was full.",
+                                [log, i] { return static_cast<double>(log->GetOverflowStats().dropped[i]); },
+                                string("level=\"") + LEVELS[i] + "\"");
+    }
+    metrics->AddCounterFunc("log_spilled_lines_total", "Log lines put into the spill buffer.",
+                            [log] { return static_cast<double>(log->GetOverflowStats().spilled); });
+    metrics->AddCounterFunc("log_blocked_total", "Times a logging thread waited for buffer space.",
+                            [log] { return static_cast<double>(log->GetOverflowStats().blocked); });
+    metrics->AddGauge("log_spill_bytes", "Bytes in the spill buffer.",
+                      [log] { return static_cast<double>(log->GetOverflowStats().spillBytes); });
+    metrics->AddCounterFunc("log_rotations_total", "Log file rotations.",
+                            [log] { return static_cast<double>(log->GetArchiveStats().rotations); });
+    metrics->AddCounterFunc("log_compressed_files_total", "Rotated log files compressed.",
+                            [log] { return static_cast<double>(log->GetArchiveStats().compressed); });
+    metrics->AddGauge("log_archived_bytes", "Bytes of rotated log files kept on disk.",
+                      [log] { return static_cast<double>(log->GetArchiveStats().totalBytes); });
+    AccessLog* access = AccessLog::Instance();
+    metrics->AddCounterFunc("accesslog_lines_total", "Access log lines written.",
+                            [access] { return static_cast<double>(access->GetStats().written); });
+    metrics->AddCounterFunc("accesslog_dropped_lines_total", "Access log lines dropped because the buffer was full.",
+                            [access] { return static_cast<double>(access->GetStats().dropped); });
+    Metrics::Enable(allow.s_addr);
+    LOG_INFO("Metrics: GET %s from %s", Metrics::PATH, allowIp);
+}
+
+void WebServer::RegisterPool_(Metrics* metrics, const ThreadPool* pool, const char* name) {
+    string labels = string("pool=\"") + name + "\"";
+    metrics->AddGauge("threadpool_threads", "Worker threads.",
+                      [pool] { return static_cast<double>(pool->GetStats().threads); }, labels);
+    metrics->AddGauge("threadpool_queue_depth", "Tasks waiting in the pool queues.",
+                      [pool] { return static_cast<double>(pool->QueueSize()); }, labels);
+    metrics->AddGauge("threadpool_queue_wait_seconds", "Queue wait of recently dequeued tasks.",
+                      [pool] { return pool->GetStats().waitMs / 1e3; }, labels);
+    metrics->AddCounterFunc("threadpool_grows_total", "Threads added by the adaptive pool.",
+                            [pool] { return static_cast<double>(pool->GetStats().grows); }, labels);
+    metrics->AddCounterFunc("threadpool_shrinks_total", "Idle threads that exited.",
+                            [pool] { return static_cast<double>(pool->GetStats().shrinks); }, labels);
+}
+
+WebServer::OverloadStats WebServer::GetOverloadStats() const {
+    return { rejectCount_.load(memory_order_relaxed), pauseCount_.load(memory_order_relaxed),
+             acceptPauseCount_.load(memory_order_relaxed) };
+}
+
+// 队列深度超过上限，或者队列不空且最近出队的任务排队时间超过上限
+bool WebServer::IsOverloaded_() const {
+    if(overloadPolicy_ == OVERLOAD_NONE) { return false; }
+    size_t depth = stealPool_ ? stealPool_->QueueSize() : threadpool_->QueueSize();
+    if(maxQueueDepth_ > 0 && depth >= maxQueueDepth_) { return true; }
+    if(maxQueueWaitMs_ > 0 && depth > 0 && threadpool_ && threadpool_->QueueWaitMs() >= maxQueueWaitMs_) {
+        return true;
+    }
+    return false;
+}
+
+// 记录进入过载状态，只在状态变化时写日志
+void WebServer::NoteOverload_() {
+    if(!isOverloaded_) {
+        isOverloaded_ = true;
+        LOG_WARN("Server overloaded, queue size: %zu", stealPool_ ? stealPool_->QueueSize() : threadpool_->QueueSize());
+    }
+}
+
+// 过载时按策略处理读事件，事件循环线程中执行
+void WebServer::Shed_(HttpConn* client) {
+    NoteOverload_();
+    int fd = client->GetFd();
+    if(overloadPolicy_ == OVERLOAD_REJECT) {
+        rejectCount_.fetch_add(1, memory_order_relaxed);
+        send(fd, BUSY_RESPONSE, sizeof(BUSY_RESPONSE) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        CloseConn_(client);
+        return;
+    }
+    /* OVERLOAD_PAUSE_READ：不分发也不重新注册，等负载降下来再分发 */
+    if(pausedFds_.insert(fd).second) {
+        pausedQue_.push_back(fd);
+        pauseCount_.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+// 负载降下来后恢复暂停的读事件和accept，事件循环线程中执行
+void WebServer::ResumePaused_() {
+    if(IsOverloaded_()) { return; }
+    if(listenPaused_) {
+        listenPaused_ = false;
+        epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN);
+    }
+    while(!pausedQue_.empty() && !IsOverloaded_()) {
+        int fd = pausedQue_.front();
+        pausedQue_.pop_front();
+        if(pausedFds_.erase(fd) == 0) { continue; }     // 暂停期间连接已被关闭或fd已被新连接复用
+        HttpConn* client = &users_[fd];
+        if(client->IsClose()) { continue; }
+        ExtentTime_(client);
+        if(!TryAddTask_(client, [this, client] { OnRead_(client); })) {
+            pausedFds_.insert(fd);
+            pausedQue_.push_front(fd);
+            break;
+        }
+    }
+    if(pausedQue_.empty()) {
+        isOverloaded_ = false;
+        OverloadStats stats = GetOverloadStats();
+        LOG_INFO("Server recovered, rejected: %llu, paused reads: %llu, accept pauses: %llu",
+                    (unsigned long long)stats.rejected, (unsigned long long)stats.pausedReads,
+                    (unsigned long long)stats.acceptPauses);
     }
 }
 
+// 回复预先生成的503响应并关闭，用于新连接
+void WebServer::SendBusy_(int fd) {
+    NoteOverload_();
+    rejectCount_.fetch_add(1, memory_order_relaxed);
+    send(fd, BUSY_RESPONSE, sizeof(BUSY_RESPONSE) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(fd);
+}
+
 void WebServer::SendError_(int fd, const char*info) {
     assert(fd > 0);
     int ret = send(fd, info, strlen(info), 0);
@@ -132,7 +462,17 @@ void WebServer::CloseConn_(HttpConn* client) {
 
 void WebServer::AddClient_(int fd, sockaddr_in addr) {
     assert(fd > 0);
+    pausedFds_.erase(fd);                       // fd被复用，之前暂停的旧连接作废
+    if(acceptCount_) { acceptCount_->Inc(); }
     users_[fd].init(fd, addr);
+    if(coLoop_) {
+        /* 协程模式：超时由协程的每次等待自己处理，先注册不带事件的fd，协程等待时再修改 */
+        epoller_->AddFd(fd, connEvent_);
+        SetFdNonblock(fd);
+        LOG_INFO("Client[%d] in!", fd);
+        HandleConn_(&users_[fd]);
+        return;
+    }
     if(timeoutMS_ > 0) {
         timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
     }
@@ -145,6 +485,14 @@ void WebServer::DealListen_() {
     struct sockaddr_in addr;
     socklen_t len = sizeof(addr);
     do {
+        if(overloadPolicy_ == OVERLOAD_STOP_ACCEPT && IsOverloaded_()) {
+            /* 暂停accept，新连接留在内核队列里，负载降下来后在ResumePaused_中恢复 */
+            NoteOverload_();
+            epoller_->DelFd(listenFd_);
+            listenPaused_ = true;
+            acceptPauseCount_.fetch_add(1, memory_order_relaxed);
+            return;
+        }
         int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
         if(fd <= 0) { return;}
         else if(HttpConn::userCount >= MAX_FD) {
@@ -152,20 +500,35 @@ void WebServer::DealListen_() {
             LOG_WARN("Clients is full!");
             return;
         }
+        else if(overloadPolicy_ == OVERLOAD_REJECT && IsOverloaded_()) {
+            SendBusy_(fd);
+            continue;
+        }
         AddClient_(fd, addr);
     } while(listenEvent_ & EPOLLET);
 }
 
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
+    if(overloadPolicy_ == OVERLOAD_PAUSE_READ || overloadPolicy_ == OVERLOAD_REJECT) {
+        if(IsOverloaded_()) {
+            Shed_(client);
+            return;
+        }
+        ExtentTime_(client);
+        if(!TryAddTask_(client, [this, client] { OnRead_(client); })) {
+            Shed_(client);                      // 队列满也按策略处理，事件循环不等待
+        }
+        return;
+    }
     ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
+    AddTask_(client, [this, client] { OnRead_(client); });      // 捕获两个指针，放得进Task的内部存储，提交不分配内存
 }
 
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
     ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    AddTask_(client, [this, client] { OnWrite_(client); });
 }
 
 // 发生了通信，需要重新调整定时器的超时时间
@@ -191,11 +554,73 @@ void WebServer::OnRead_(HttpConn* client) {
 void WebServer::OnProcess(HttpConn* client) {
     if(client->process()) {
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);    // 成功返回true向epoll注册写事件
+    } else if(client->IsVerifyPending()) {
+        DealVerify_(client);                                        // 登录注册交给数据库线程池
     } else {
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);     // 失败继续注册读事件
     }
 }
 
+// 协程模式下一个连接的处理流程，全部在事件循环线程中执行：
+// 解析读缓冲区里的请求，没有完整请求就等可读，登录注册交给线程池验证，然后写响应，写不完就等可写
+CoDetached WebServer::HandleConn_(HttpConn* client) {
+    int fd = client->GetFd();
+    ThreadPool& verifyPool = dbpool_ ? *dbpool_ : *threadpool_;
+    while(true) {
+        if(!client->process()) {
+            if(client->IsVerifyPending() && asyncSql_) {
+                co_await coLoop_->Callback([this, client](std::function<void()> resume) {
+                    client->VerifyAsync(*asyncSql_, std::move(resume));
+                });
+            }
+            else if(client->IsVerifyPending()) {
+                if(!co_await coLoop_->Offload(verifyPool, [client] { client->FinishVerify(); })) {
+                    LOG_WARN("DbPool busy, client[%d] verify rejected!", fd);
+                    client->FinishVerify(false);
+                }
+            } else {
+                CoLoop::IoResult res = co_await coLoop_->Read(fd, connEvent_, timeoutMS_,
+                                                              [client](int* err) { return client->read(err); });
+                if(res.n <= 0 && res.err != EAGAIN) { break; }     // 超时、对端关闭或出错
+                continue;
+            }
+        }
+        /* 写响应，内核缓冲区满时等可写 */
+        bool done = true;
+        while(client->ToWriteBytes() > 0) {
+            CoLoop::IoResult res = co_await coLoop_->Write(fd, connEvent_, timeoutMS_,
+                                                           [client](int* err) { return client->write(err); });
+            if(res.n > 0 || res.err == EAGAIN) { continue; }
+            done = false;
+            break;
+        }
+        if(!done || !client->IsKeepAlive()) { break; }
+    }
+    CloseConn_(client);
+}
+
+// 数据库线程池有界，满了不排队等待，直接按验证失败返回，IO线程继续服务静态资源
+void WebServer::DealVerify_(HttpConn* client) {
+    if(asyncSql_) {
+        /* 查询在事件循环线程中完成，回调里注册写事件 */
+        client->VerifyAsync(*asyncSql_, [this, client] { epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT); });
+        return;
+    }
+    assert(client && dbpool_);
+    if(!dbpool_->TryAddTask([this, client] { OnVerify_(client); })) {
+        LOG_WARN("DbPool busy, client[%d] verify rejected!", client->GetFd());
+        client->FinishVerify(false);
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+    }
+}
+
+// 数据库线程中执行，验证完生成响应，注册写事件回到正常的写路径
+void WebServer::OnVerify_(HttpConn* client) {
+    assert(client);
+    client->FinishVerify();
+    epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+}
+
 // 子线程中执行，将用户写缓冲区数据和内存映射的资源数据转入通信文件描述符内核缓冲区中
 void WebServer::OnWrite_(HttpConn* client) {
     assert(client);
@@ -294,6 +719,21 @@ bool WebServer::InitSocket_() {
     return true;
 }
 
+const char* WebServer::PoolModeName_(int poolMode) {
+    switch(poolMode) {
+    case WORK_STEALING:
+        return "work-stealing";
+    case AFFINITY:
+        return "affinity";
+    case AFFINITY_PINNED:
+        return "affinity-pinned";
+    case COROUTINE:
+        return "coroutine";
+    default:
+        return "shared-queue";
+    }
+}
+
 int WebServer::SetFdNonblock(int fd) {
     assert(fd > 0);
     return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
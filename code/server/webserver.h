@@ -6,6 +6,9 @@
 #define WEBSERVER_H
 
 #include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <atomic>
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
@@ -15,24 +18,92 @@
 #include <arpa/inet.h>
 
 #include "epoller.h"
+#include "coloop.h"
+#include "metrics.h"
 #include "../log/log.h"
 #include "../timer/heaptimer.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
+#include "../pool/workstealingpool.h"
 #include "../pool/sqlconnRAII.h"
+#include "../pool/asyncsqlpool.h"
 #include "../http/httpconn.h"
+#include "../http/localstore.h"
 
 class WebServer {
 public:
+    enum POOL_MODE {                            // 处理读写事件的线程池
+        SHARED_QUEUE = 0,                       // 单队列线程池ThreadPool
+        WORK_STEALING,                          // 工作窃取线程池WorkStealingPool
+        AFFINITY,                               // ThreadPool亲和模式，同一连接的任务固定交给一个工作线程
+        AFFINITY_PINNED,                        // 亲和模式，并把工作线程绑定到CPU
+        COROUTINE,                              // 每个连接一个协程，在事件循环线程中读写，只把数据库验证交给线程池
+    };
+
     WebServer(
         int port, int trigMode, int timeoutMS, bool OptLinger, 
         int sqlPort, const char* sqlUser, const  char* sqlPwd, 
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize,
+        int poolMode = SHARED_QUEUE, int dbThreadNum = 0, int asyncSqlNum = 0);
+
+    enum OVERLOAD_POLICY {                      // 线程池过载时的处理策略
+        OVERLOAD_NONE = 0,                      // 不处理，队列满时事件循环等待空位
+        OVERLOAD_PAUSE_READ,                    // 暂停分发读事件，数据留在内核缓冲区，靠TCP流控反压客户端
+        OVERLOAD_REJECT,                        // 直接回复预先生成的503和Retry-After并关闭连接
+        OVERLOAD_STOP_ACCEPT,                   // 暂停accept新连接，连接留在内核的全连接队列里
+    };
+
+    struct OverloadStats {                      // 过载保护的计数
+        uint64_t rejected;                      // 回复503的次数
+        uint64_t pausedReads;                   // 暂停分发的读事件数
+        uint64_t acceptPauses;                  // 暂停accept的次数
+    };
 
     ~WebServer();
     void Start();
 
+    // 日志交给写线程的方式(Log::BACKEND)，binary为true时写二进制日志(bin/logdecode解码)。开启日志时有效，在其他设置之前调用
+    void SetLogBackend(int backend, bool binary);
+
+    // 日志缓冲区满时的处理方式(Log::OVERFLOW_POLICY)，丢弃的行数定期写进日志
+    void SetLogOverflow(int policy);
+
+    // 轮换下来的日志文件是否在后台压缩成gzip，最多保留maxFiles个、总共maxMB兆字节，0表示不限制。开启日志时有效
+    void SetLogArchive(bool compress, size_t maxFiles, size_t maxMB);
+
+    // 访问日志：状态码为code(1~5表示整类)的请求只记录rate的比例，在SetAccessLog之前调用
+    void SetAccessSampling(int code, double rate);
+    // 开启访问日志，format为AccessLog::FORMAT，ringSize是每个线程的缓冲区字节数。不调用时访问日志完全关闭
+    bool SetAccessLog(const char* path, int format, size_t ringSize);
+
+    // 设置过载策略，队列深度或队首任务排队时间(毫秒)超过上限即视为过载，上限为0表示不检查
+    void SetOverloadPolicy(int policy, size_t maxQueueDepth, int maxQueueWaitMs);
+    OverloadStats GetOverloadStats() const;
+
+    // 开启线程池自适应线程数，排队时间超过targetWaitMs时扩容到上限，空闲idleMs后收缩，亲和模式和工作窃取模式不支持
+    void SetAdaptivePool(size_t maxThreads, size_t maxDbThreads, int targetWaitMs, int idleMs);
+
+    // 开启登录凭据缓存，capacity为条目上限，ttlMs为正向条目有效期，negativeTtlMs为不存在用户的有效期
+    void SetUserCache(size_t capacity, int ttlMs, int negativeTtlMs);
+
+    // 改用进程内的本地用户存储，不依赖MySQL，path是日志文件，syncIntervalMs是攒一批注册再刷盘的时间(负数表示不刷盘)。
+    // 需要在Start之前、SetUserFilter之前调用
+    bool SetLocalUserStore(const char* path, int syncIntervalMs);
+
+    // 注册攒批：MySQL存储的注册交给写线程，每intervalMs或攒够maxRows条用预处理的多行INSERT在一个事务里提交。需要在Start之前调用
+    void SetRegisterBatch(int intervalMs, size_t maxRows);
+
+    // 数据库连接池的最少连接数、取连接的等待超时、空闲多久先ping再用、多余连接空闲多久关闭，上限是构造时的连接池数量
+    void SetSqlPool(int minConn, int waitTimeoutMs, int pingIdleMs, int shrinkIdleMs);
+
+    // 开启已注册用户名的布隆过滤器，后台从数据库加载完成后注册时确定没被用过的用户名不再查重；用户名上没有唯一索引时不开启
+    void SetUserFilter(size_t memoryBytes, double fpRate);
+
+    // 开启指标统计和GET /metrics(Prometheus文本格式)，覆盖请求、连接、线程池、定时器、数据库连接池、日志和静态文件。
+    // 只有来自allowIp的GET能抓取，"0.0.0.0"表示不限制，其他请求按普通文件处理。在其他设置之后、Start之前调用一次
+    void SetMetrics(bool enable, const char* allowIp = "127.0.0.1");
+
 private:
     bool InitSocket_(); 
     void InitEventMode_(int trigMode);
@@ -50,9 +121,41 @@ private:
     void OnWrite_(HttpConn* client);
     void OnProcess(HttpConn* client);
 
+    CoDetached HandleConn_(HttpConn* client);   // 协程模式下一个连接的完整处理流程
+
+    void DealVerify_(HttpConn* client);         // 把需要查数据库的请求交给异步连接池或数据库线程池
+    void OnVerify_(HttpConn* client);           // 数据库线程中执行，验证完回到正常的写路径
+
+    template<class F>
+    void AddTask_(HttpConn* client, F&& task) { // 按线程池模式把任务交给对应的线程池，亲和模式按fd选工作线程
+        if(stealPool_) { stealPool_->AddTask(std::forward<F>(task)); }
+        else { threadpool_->AddTask(client->GetFd(), std::forward<F>(task)); }
+    }
+
+    template<class F>
+    bool TryAddTask_(HttpConn* client, F&& task) {  // 同上，有界队列满时返回false
+        if(stealPool_) {
+            stealPool_->AddTask(std::forward<F>(task));
+            return true;
+        }
+        return threadpool_->TryAddTask(client->GetFd(), std::forward<F>(task));
+    }
+
+    void RegisterPool_(Metrics* metrics, const ThreadPool* pool, const char* name);  // 注册一个线程池的指标
+
+    bool IsOverloaded_() const;                 // 线程池是否过载
+    void NoteOverload_();                       // 记录进入过载状态
+    void Shed_(HttpConn* client);               // 过载时按策略处理读事件
+    void ResumePaused_();                       // 负载降下来后恢复暂停的读事件和accept
+    void SendBusy_(int fd);                     // 回复503并关闭
+
     static const int MAX_FD = 65536;            // 最大的文件描述符个数
+    static const int DB_QUEUE_SIZE = 256;       // 数据库线程池的队列容量
+    static const int PAUSE_POLL_MS = 5;         // 有暂停的事件时epoll_wait最多等待的时间
+    static const char BUSY_RESPONSE[];          // 预先生成的503响应
 
     static int SetFdNonblock(int fd);           // 设置文件描述符非阻塞
+    static const char* PoolModeName_(int poolMode); // 线程池模式的名字，写日志用
 
     int port_;                                  // 服务器端口
     bool openLinger_;                           // 是否打开优雅关闭
@@ -66,8 +169,26 @@ private:
    
     std::unique_ptr<HeapTimer> timer_;          // 定时器
     std::unique_ptr<ThreadPool> threadpool_;    // 线程池
+    std::unique_ptr<WorkStealingPool> stealPool_;   // 工作窃取线程池，poolMode为WORK_STEALING时代替threadpool_
+    std::unique_ptr<ThreadPool> dbpool_;        // 数据库线程池，登录注册在这里查数据库，不占用处理IO的线程
     std::unique_ptr<Epoller> epoller_;          // epoll对象
+    std::unique_ptr<CoLoop> coLoop_;            // 协程调度，poolMode为COROUTINE时使用
+    std::unique_ptr<UserStore> userStore_;      // 登录注册用的用户存储，MySQL或者本地存储
+    std::unique_ptr<AsyncSqlPool> asyncSql_;    // 非阻塞数据库连接池，socket注册在epoller_上，开启后登录注册不占用线程
     std::unordered_map<int, HttpConn> users_;   // 保存的是客户端连接的信息，键为文件描述符
+
+    int poolMode_;                              // 线程池模式
+    int overloadPolicy_;                        // 过载策略
+    size_t maxQueueDepth_;                      // 线程池队列深度上限
+    int maxQueueWaitMs_;                        // 队首任务排队时间上限
+    bool isOverloaded_;                         // 是否处于过载状态，只在状态变化时写日志
+    bool listenPaused_;                         // 是否暂停了accept
+    std::deque<int> pausedQue_;                 // 暂停分发读事件的连接，按暂停顺序恢复
+    std::unordered_set<int> pausedFds_;         // 同上，用于去重和连接关闭后剔除
+    std::atomic<uint64_t> rejectCount_;         // 回复503的次数
+    std::atomic<uint64_t> pauseCount_;          // 暂停分发的读事件数
+    std::atomic<uint64_t> acceptPauseCount_;    // 暂停accept的次数
+    Metrics::Counter* acceptCount_;             // 接受的连接数，开启指标后才有
 };
 
 
@@ -4,59 +4,68 @@
 */
 #include "heaptimer.h"
 
-// 将一个节点向上调整
+// 把节点放到位置i，并更新索引表
+void HeapTimer::Place_(size_t i, const TimerNode& node) {
+    heap_[i] = node;
+    ref_[node.id] = static_cast<int>(i);
+}
+
+// 将一个节点向上调整，空穴法：父节点下移，最后一次性放入
 void HeapTimer::siftup_(size_t i) {
-    assert(i >= 0 && i < heap_.size());
-    size_t j = (i - 1) / 2;
-    while(j >= 0) {
-        if(heap_[j] < heap_[i]) { break; }
-        SwapNode_(i, j);
+    assert(i < heap_.size());
+    TimerNode node = heap_[i];
+    while(i > 0) {
+        size_t j = (i - 1) / D;
+        if(!(node < heap_[j])) { break; }
+        Place_(i, heap_[j]);
         i = j;
-        j = (i - 1) / 2;
     }
+    Place_(i, node);
 }
 
-// 交换两个定时器位置
-void HeapTimer::SwapNode_(size_t i, size_t j) {
-    assert(i >= 0 && i < heap_.size());
-    assert(j >= 0 && j < heap_.size());
-    std::swap(heap_[i], heap_[j]);
-    ref_[heap_[i].id] = i;
-    ref_[heap_[j].id] = j;
-} 
-
-// 将一个节点向下调整，，n是heap_长度
+// 将一个节点向下调整，n是heap_长度
 bool HeapTimer::siftdown_(size_t index, size_t n) {
-    assert(index >= 0 && index < heap_.size());
-    assert(n >= 0 && n <= heap_.size());
+    assert(index < heap_.size());
+    assert(n <= heap_.size());
+    TimerNode node = heap_[index];
     size_t i = index;
-    size_t j = i * 2 + 1;
+    size_t j = i * D + 1;
     while(j < n) {
-        if(j + 1 < n && heap_[j + 1] < heap_[j]) j++;
-        if(heap_[i] < heap_[j]) break;
-        SwapNode_(i, j);
-        i = j;
-        j = i * 2 + 1;
+        /* 在最多D个孩子中找最小的 */
+        size_t end = std::min(j + D, n);
+        size_t m = j;
+        for(size_t k = j + 1; k < end; k++) {
+            if(heap_[k] < heap_[m]) { m = k; }
+        }
+        if(!(heap_[m] < node)) { break; }
+        Place_(i, heap_[m]);
+        i = m;
+        j = i * D + 1;
     }
+    Place_(i, node);
     return i > index;
 }
 
 // 加一个定时器
 void HeapTimer::add(int id, int timeout, const TimeoutCallBack& cb) {
     assert(id >= 0);
-    size_t i;
-    if(ref_.count(id) == 0) {
+    if(static_cast<size_t>(id) >= ref_.size()) {
+        ref_.resize(id + 1, -1);
+        cbs_.resize(id + 1);
+    }
+    cbs_[id] = cb;
+    if(ref_[id] < 0) {
         /* 新节点：堆尾插入，调整堆 */
-        i = heap_.size();
-        ref_[id] = i;
-        heap_.push_back({id, Clock::now() + MS(timeout), cb});
+        size_t i = heap_.size();
+        heap_.push_back({Clock::now() + MS(timeout), id});
+        ref_[id] = static_cast<int>(i);
         siftup_(i); // 向上调整，跟父亲比较
+        size_.store(heap_.size(), std::memory_order_relaxed);
     } 
     else {
         /* 已有结点：调整堆 */
-        i = ref_[id];
+        size_t i = ref_[id];
         heap_[i].expires = Clock::now() + MS(timeout);
-        heap_[i].cb = cb;
         if(!siftdown_(i, heap_.size())) {
             siftup_(i);
         }
@@ -65,53 +74,63 @@ void HeapTimer::add(int id, int timeout, const TimeoutCallBack& cb) {
 
 // 删除指定id结点，并触发回调函数
 void HeapTimer::doWork(int id) {
-    if(heap_.empty() || ref_.count(id) == 0) {
+    if(heap_.empty() || id < 0 || static_cast<size_t>(id) >= ref_.size() || ref_[id] < 0) {
         return;
     }
-    size_t i = ref_[id];
-    TimerNode node = heap_[i];
-    node.cb();
-    del_(i);
+    TimeoutCallBack cb = std::move(cbs_[id]);
+    del_(ref_[id]);
+    cb();
+}
+
+// 删除指定id结点，不触发回调函数
+void HeapTimer::remove(int id) {
+    if(id < 0 || static_cast<size_t>(id) >= ref_.size() || ref_[id] < 0) {
+        return;
+    }
+    del_(ref_[id]);
 }
 
 // 删除指定位置的结点
 void HeapTimer::del_(size_t index) {
-    assert(!heap_.empty() && index >= 0 && index < heap_.size());
-    /* 将要删除的结点换到队尾，然后调整堆 */
-    size_t i = index;
+    assert(!heap_.empty() && index < heap_.size());
+    /* 将队尾结点填到要删除的位置，然后调整堆 */
+    int id = heap_[index].id;
     size_t n = heap_.size() - 1;
-    assert(i <= n);
-    if(i < n) {
-        SwapNode_(i, n);
-        if(!siftdown_(i, n)) {
-            siftup_(i);
+    if(index < n) {
+        Place_(index, heap_[n]);
+        heap_.pop_back();
+        if(!siftdown_(index, n)) {
+            siftup_(index);
         }
     }
-    /* 队尾元素删除 */
-    ref_.erase(heap_.back().id);
-    heap_.pop_back();
+    else {
+        heap_.pop_back();
+    }
+    ref_[id] = -1;
+    cbs_[id] = nullptr;
+    size_.store(heap_.size(), std::memory_order_relaxed);
 }
 
 // 发生数据交流，设定新的超时时间，所以需要调整堆
 void HeapTimer::adjust(int id, int timeout) {
-    /* 调整指定id的结点 */
-    assert(!heap_.empty() && ref_.count(id) > 0);
-    heap_[ref_[id]].expires = Clock::now() + MS(timeout);;
+    /* 调整指定id的结点，超时时间只会变大，向下调整即可 */
+    assert(!heap_.empty() && static_cast<size_t>(id) < ref_.size() && ref_[id] >= 0);
+    heap_[ref_[id]].expires = Clock::now() + MS(timeout);
     siftdown_(ref_[id], heap_.size());
 }
 
 // 清除超时结点,并断开相应的http通信
 void HeapTimer::tick() {
-    if(heap_.empty()) {
-        return;
-    }
+    TimeStamp now = Clock::now();
     while(!heap_.empty()) {
-        TimerNode node = heap_.front();
-        if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) { 
+        const TimerNode& node = heap_.front();
+        if(node.expires > now) { 
             break; 
         }
-        node.cb();  // 断开通信(将通信文件描述符从epoll删除，通信用户-1，关闭通信文件描述符)
+        TimeoutCallBack cb = std::move(cbs_[node.id]);
         pop();      // 清除堆中第一个定时器
+        expired_.store(expired_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        cb();       // 断开通信(将通信文件描述符从epoll删除，通信用户-1，关闭通信文件描述符)
     }
 }
 
@@ -121,19 +140,21 @@ void HeapTimer::pop() {
     del_(0);
 }
 
-// 清空heap_和ref_
+// 清空heap_、ref_和cbs_
 void HeapTimer::clear() {
     ref_.clear();
+    cbs_.clear();
     heap_.clear();
+    size_.store(0, std::memory_order_relaxed);
 }
 
 // 清除超时结点，并返回到下一个超时节点的时间差
 int HeapTimer::GetNextTick() {
     tick();
-    size_t res = -1;
+    int64_t res = -1;
     if(!heap_.empty()) {
         res = std::chrono::duration_cast<MS>(heap_.front().expires - Clock::now()).count();
         if(res < 0) { res = 0; }
     }
-    return res;
-}
\ No newline at end of file
+    return static_cast<int>(res);
+}
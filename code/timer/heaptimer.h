@@ -13,24 +13,25 @@
 #include <functional> 
 #include <assert.h> 
 #include <chrono>
+#include <atomic>
 #include "../log/log.h"
+#include "timecache.h"
 
 typedef std::function<void()> TimeoutCallBack;                  // 回调函数
-typedef std::chrono::high_resolution_clock Clock;               // 高精度时钟
+typedef CoarseClock Clock;                                      // 事件循环缓存的粗粒度单调时钟
 typedef std::chrono::milliseconds MS;                           // 毫秒
 typedef Clock::time_point TimeStamp;                            // 时间戳
 
-struct TimerNode {                                              // 定时器结构体
-    int id;                                                     // 文件描述符
+struct TimerNode {                                              // 堆节点，只放小的POD键，回调放在堆外
     TimeStamp expires;                                          // 超时时间
-    TimeoutCallBack cb;                                         // 超时回调函数
-    bool operator<(const TimerNode& t) {                        // 重载小于运算符
+    int id;                                                     // 文件描述符
+    bool operator<(const TimerNode& t) const {                  // 重载小于运算符
         return expires < t.expires;
     }
 };
 class HeapTimer {
 public:
-    HeapTimer() { heap_.reserve(64); }                          // 预留64个定时器内存
+    HeapTimer(): size_(0), expired_(0) { heap_.reserve(64); }   // 预留64个定时器内存
 
     ~HeapTimer() { clear(); }
     
@@ -40,7 +41,9 @@ public:
 
     void doWork(int id);
 
-    void clear();                                               // 清空heap_和ref_
+    void remove(int id);                                        // 删除指定id的定时器，不触发回调
+
+    void clear();                                               // 清空heap_、ref_和cbs_
 
     void tick();                                                // 清除超时结点
 
@@ -48,18 +51,29 @@ public:
 
     int GetNextTick();                                          // 清除超时结点，并返回到下一个超时节点的时间差
 
+    // 下面两个给其他线程统计用，堆本身只在事件循环线程中访问
+    size_t size() const { return size_.load(std::memory_order_relaxed); }          // 定时器个数
+    uint64_t expired() const { return expired_.load(std::memory_order_relaxed); }  // 超时触发回调的次数
+
 private:
+    static const size_t D = 4;                                  // 4叉堆，层数更少，兄弟节点挨在同一条缓存行里
+
     void del_(size_t i);                                        // 删除一个定时器，i是索引
     
     void siftup_(size_t i);                                     // 将一个节点向上调整，i是索引
 
     bool siftdown_(size_t index, size_t n);                     // 将一个节点向下调整，n是heap_长度
 
-    void SwapNode_(size_t i, size_t j);                         // 交换两个定时器
+    void Place_(size_t i, const TimerNode& node);               // 把节点放到位置i，并更新索引表
 
     std::vector<TimerNode> heap_;                               // 放定时器的容器
 
-    std::unordered_map<int, size_t> ref_;                       // 键是文件描述符，值是索引
+    std::vector<int> ref_;                                      // 下标是文件描述符，值是堆中索引，-1表示不在堆中
+
+    std::vector<TimeoutCallBack> cbs_;                          // 下标是文件描述符，值是超时回调，调整堆时不移动
+
+    std::atomic<size_t> size_;                                  // heap_.size()，只由事件循环线程写
+    std::atomic<uint64_t> expired_;                             // 同上，tick中超时的定时器数
 };
 
 #endif //HEAP_TIMER_H
\ No newline at end of file
@@ -0,0 +1,66 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "timecache.h"
+
+thread_local bool TimeCache::isLoopThread_ = false;
+thread_local int64_t TimeCache::monoMs_ = 0;
+thread_local int64_t TimeCache::realUs_ = 0;
+thread_local time_t TimeCache::dateSec_ = 0;
+thread_local char TimeCache::date_[TimeCache::HTTP_DATE_LEN];
+
+static int64_t ReadMonoMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 墙上时间用精确时钟，日志里的微秒才有意义；走vDSO，不进内核
+static int64_t ReadRealUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 每次epoll_wait返回后调用一次，调用的线程从此读自己的缓存
+void TimeCache::Update() {
+    monoMs_ = ReadMonoMs();
+    realUs_ = ReadRealUs();
+    time_t sec = realUs_ / 1000000;
+    if(sec != dateSec_) {
+        FormatDate_(sec);
+    }
+    isLoopThread_ = true;
+}
+
+// 不是事件循环线程(工作线程、单元测试)时直接读时钟
+int64_t TimeCache::NowMs() {
+    if(!isLoopThread_) { return ReadMonoMs(); }
+    return monoMs_;
+}
+
+int64_t TimeCache::ReadNowMs() {
+    return ReadMonoMs();
+}
+
+int64_t TimeCache::RealUs() {
+    if(!isLoopThread_) { return ReadRealUs(); }
+    return realUs_;
+}
+
+// 其他线程每次读一次时钟，秒数没变时复用本线程上次格式化的字符串
+void TimeCache::HttpDate(char* buf) {
+    if(!isLoopThread_) {
+        time_t sec = ReadRealUs() / 1000000;
+        if(sec != dateSec_) { FormatDate_(sec); }
+    }
+    for(int i = 0; i < HTTP_DATE_LEN; i++) { buf[i] = date_[i]; }
+}
+
+void TimeCache::FormatDate_(time_t sec) {
+    struct tm t;
+    gmtime_r(&sec, &t);
+    strftime(date_, HTTP_DATE_LEN, "%a, %d %b %Y %H:%M:%S GMT", &t);
+    dateSec_ = sec;
+}
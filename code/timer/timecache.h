@@ -0,0 +1,48 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#ifndef TIME_CACHE_H
+#define TIME_CACHE_H
+
+#include <time.h>
+#include <stdint.h>
+#include <chrono>
+
+// 事件循环级别的时间源：每次epoll_wait返回后由事件循环线程读一次时钟，
+// 定时器、日志和响应头Date共用这一份缓存，避免每个事件都去读时钟。
+// 缓存只给调用Update的线程用，工作线程、数据库线程、归档线程的时间可能离上次唤醒已经过了好几秒，
+// 它们直接读时钟，Date字符串在本线程内按秒缓存
+class TimeCache {
+public:
+    static void Update();                                   // 事件循环线程调用，读取一次单调时钟和墙上时钟
+
+    static int64_t NowMs();                                 // 单调时钟(毫秒)，事件循环线程读缓存
+    static int64_t RealUs();                                // 墙上时间(微秒)，事件循环线程读缓存
+    static int64_t ReadNowMs();                             // 不读缓存，直接读一次粗粒度单调时钟(毫秒)
+    static void HttpDate(char* buf);                        // 复制HTTP Date字符串，buf至少HTTP_DATE_LEN字节
+
+    static const int HTTP_DATE_LEN = 30;                    // "Sun, 06 Nov 1994 08:49:37 GMT" 加 '\0'
+
+private:
+    static void FormatDate_(time_t sec);                    // 秒数变化时重新格式化本线程的Date字符串
+
+    static thread_local bool isLoopThread_;                 // 本线程是否调用过Update
+    static thread_local int64_t monoMs_;                    // 单调时钟(毫秒)
+    static thread_local int64_t realUs_;                    // 墙上时间(微秒)
+    static thread_local time_t dateSec_;                    // Date字符串对应的秒数
+    static thread_local char date_[HTTP_DATE_LEN];          // 本线程的Date字符串
+};
+
+// 满足std::chrono时钟要求的粗粒度单调时钟，now()只读缓存
+struct CoarseClock {
+    typedef std::chrono::milliseconds duration;
+    typedef duration::rep rep;
+    typedef duration::period period;
+    typedef std::chrono::time_point<CoarseClock> time_point;
+    static const bool is_steady = true;
+
+    static time_point now() { return time_point(duration(TimeCache::NowMs())); }
+};
+
+#endif //TIME_CACHE_H
@@ -0,0 +1,146 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+#include "../code/pool/threadpool.h"
+#include "../code/pool/workstealingpool.h"
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+typedef std::chrono::steady_clock BenchClock;
+
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            BenchClock::now().time_since_epoch()).count();
+}
+
+// 吞吐：一个生产者(模拟事件循环)连续提交小任务，统计全部执行完的耗时
+template<class P>
+void BenchThroughput(const char* name, size_t threads, int tasks) {
+    P pool(threads);
+    std::atomic<int> done(0);
+    int64_t start = NowNs();
+    for(int i = 0; i < tasks; i++) {
+        pool.AddTask([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+    }
+    while(done.load(std::memory_order_relaxed) < tasks) {
+        std::this_thread::yield();
+    }
+    double sec = (NowNs() - start) / 1e9;
+    printf("%-16s threads:%2zu throughput: %10.0f tasks/s\n", name, threads, tasks / sec);
+}
+
+// 延迟：按批提交任务，批间休眠，统计从提交到开始执行的时间
+template<class P>
+void BenchLatency(const char* name, size_t threads, int rounds, int batch) {
+    P pool(threads);
+    std::vector<int64_t> lat(rounds * batch);
+    std::atomic<int> done(0);
+    for(int r = 0; r < rounds; r++) {
+        for(int b = 0; b < batch; b++) {
+            int idx = r * batch + b;
+            int64_t enq = NowNs();
+            pool.AddTask([&lat, &done, idx, enq] {
+                lat[idx] = NowNs() - enq;
+                done.fetch_add(1, std::memory_order_release);
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    while(done.load(std::memory_order_acquire) < rounds * batch) {
+        std::this_thread::yield();
+    }
+    std::sort(lat.begin(), lat.end());
+    printf("%-16s threads:%2zu latency p50: %8.1f us  p99: %8.1f us  max: %8.1f us\n", name, threads,
+            lat[lat.size() / 2] / 1e3, lat[lat.size() * 99 / 100] / 1e3, lat.back() / 1e3);
+}
+
+// 硬件缓存未命中计数器，inherit让之后创建的工作线程也计入(线程退出后才汇总到这里)
+class PerfCounter {
+public:
+    PerfCounter(uint32_t type, uint64_t config) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        err_ = fd_ < 0 ? errno : 0;
+        if(fd_ >= 0) { ioctl(fd_, PERF_EVENT_IOC_RESET, 0); ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0); }
+    }
+    ~PerfCounter() { if(fd_ >= 0) { close(fd_); } }
+    bool ok() const { return fd_ >= 0; }
+    int err() const { return err_; }
+    long long Read() {
+        long long v = 0;
+        if(fd_ < 0 || read(fd_, &v, sizeof(v)) != sizeof(v)) { return -1; }
+        return v;
+    }
+private:
+    int fd_;
+    int err_;
+};
+
+// 模拟连接：每个任务读写所属连接的状态(类似HttpConn的读写缓冲区和解析状态)，
+// 比较共享队列和按连接亲和分发时的L1/LLC未命中
+void BenchAffinity(const char* name, size_t threads, bool affinity, bool pin, int tasks) {
+    const int CONNS = 512, STATE = 4096;
+    std::vector<char> state(static_cast<size_t>(CONNS) * STATE, 1);
+    std::atomic<int> done(0);
+    PerfCounter l1(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                   (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    PerfCounter llc(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    int64_t start = NowNs();
+    {
+        ThreadPool pool(threads, 4096, affinity, pin);
+        unsigned int seed = 1;
+        for(int i = 0; i < tasks; i++) {
+            seed = seed * 1103515245 + 12345;
+            int conn = (seed >> 8) % CONNS;
+            char* p = &state[static_cast<size_t>(conn) * STATE];
+            pool.AddTask(conn, [p, &done] {
+                int sum = 0;
+                for(int k = 0; k < STATE; k += 64) { sum += p[k]; p[k] = static_cast<char>(sum); }
+                done.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        while(done.load(std::memory_order_relaxed) < tasks) {
+            std::this_thread::yield();
+        }
+    }
+    double sec = (NowNs() - start) / 1e9;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));    // 等工作线程退出，计数汇总
+    if(l1.ok() && llc.ok()) {
+        printf("%-16s threads:%2zu %10.0f tasks/s  L1D miss/task: %7.1f  LLC miss/task: %7.2f\n", name, threads,
+                tasks / sec, l1.Read() / double(tasks), llc.Read() / double(tasks));
+    } else {
+        printf("%-16s threads:%2zu %10.0f tasks/s  (perf counters unavailable: %s)\n", name, threads,
+                tasks / sec, strerror(l1.ok() ? llc.err() : l1.err()));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t threads = argc > 1 ? atoi(argv[1]) : 8;
+    int tasks = argc > 2 ? atoi(argv[2]) : 500000;
+    BenchThroughput<ThreadPool>("ThreadPool", threads, tasks);
+    BenchThroughput<WorkStealingPool>("WorkStealingPool", threads, tasks);
+    BenchLatency<ThreadPool>("ThreadPool", threads, 2000, 16);
+    BenchLatency<WorkStealingPool>("WorkStealingPool", threads, 2000, 16);
+    BenchAffinity("Shared", threads, false, false, tasks);
+    BenchAffinity("Affinity", threads, true, false, tasks);
+    BenchAffinity("AffinityPinned", threads, true, true, tasks);
+}
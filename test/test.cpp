@@ -3,7 +3,20 @@
     Date         : 2022-12-24
 */
 #include "../code/log/log.h"
+#include "../code/log/accesslog.h"
 #include "../code/pool/threadpool.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/server/coloop.h"
+#include "../code/server/metrics.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/usercache.h"
+#include "../code/pool/bloomfilter.h"
+#include "../code/pool/sha1.h"
+#include "../code/http/localstore.h"
+#include <map>
+#include <zlib.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
 #include <features.h>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
@@ -32,6 +45,133 @@ void TestLog() {
             }
         }
     }
+    cnt = 0;
+    Log::Instance()->init(level, "./testlog3", ".log", 5000, Log::BLOCK_BACKEND);
+    for(level = 0; level < 4; level++) {
+        Log::Instance()->SetLevel(level);
+        for(int j = 0; j < 10000; j++ ){
+            for(int i = 0; i < 4; i++) {
+                LOG_BASE(i,"%s 333333333 %d ============= ", "Test", cnt++);
+            }
+        }
+    }
+    cnt = 0;
+    Log::Instance()->init(0, "./testlog4", ".log", 5000, Log::RING_BACKEND, true);
+    for(int j = 0; j < 10000; j++ ){
+        for(int i = 0; i < 4; i++) {
+            LOG_BASE(i,"%s 444444444 %d %05zu %.2f ============= ", "Test", cnt++, (size_t)j, j / 4.0);
+        }
+    }
+    cnt = 0;
+    Log::Instance()->init(0, "./testlog5", ".log", 1);          // 最小的环形缓冲区，大部分行进溢出缓冲区
+    Log::Instance()->SetOverflowPolicy(Log::OVERFLOW_SPILL);
+    Log::OverflowStats before = Log::Instance()->GetOverflowStats();
+    for(int j = 0; j < 10000; j++ ){
+        for(int i = 0; i < 4; i++) {
+            LOG_BASE(i,"%s 555555555 %d ============= ", "Test", cnt++);
+        }
+    }
+    Log::OverflowStats stats = Log::Instance()->GetOverflowStats();
+    for(int i = 0; i < 4; i++) { assert(stats.dropped[i] == before.dropped[i]); }
+    assert(stats.blocked == before.blocked);                    // 溢出时不等待，也不丢
+    Log::Instance()->SetOverflowPolicy(Log::OVERFLOW_BLOCK);
+}
+
+void TestAccessLog() {
+    AccessLog* log = AccessLog::Instance();
+    log->SetSampling(2, 0);
+    log->SetSampling(404, 0.5);
+    bool opened = log->Open("./testaccess/access.log", AccessLog::JSON);
+    assert(opened);
+    int kept = 0;
+    for(int i = 0; i < 1000; i++) {
+        for(int code : { 200, 404, 500 }) {
+            if(!log->Sample(code)) { continue; }
+            AccessLog::Entry entry = { "127.0.0.1", "GET", "/a\"b\n", "1.1", nullptr, "curl", code, 10, 5 };
+            log->Write(entry);
+            kept++;
+        }
+    }
+    AccessLog::Stats stats = log->GetStats();
+    assert(stats.written == (uint64_t)kept && stats.sampledOut == 3000 - (uint64_t)kept && stats.dropped == 0);
+    assert(kept > 1000 + 400 && kept < 1000 + 600);            // 500全留，404大约一半，200都不留
+    usleep(500000);                                             // 等写线程写出
+    FILE* fp = fopen("./testaccess/access.log", "r");
+    char line[512];
+    int lines = 0;
+    while(fgets(line, sizeof(line), fp)) {
+        assert(strstr(line, "\"path\":\"/a\\\"b\\u000a\"") && !strstr(line, "\"status\":200"));
+        lines++;
+    }
+    fclose(fp);
+    assert(lines == kept);
+}
+
+void TestLogArchiver() {
+    const char* dir = "./testarchive";
+    mkdir(dir, 0777);
+    std::string line(100, 'x');
+    for(int day = 1; day <= 6; day++) {
+        char name[64];
+        snprintf(name, sizeof(name), "%s/2022_12_%02d.log", dir, day);
+        FILE* fp = fopen(name, "w");
+        for(int i = 0; i < 1000; i++) { fprintf(fp, "%d %s\n", i, line.c_str()); }
+        fclose(fp);
+        struct timespec times[2] = { { day * 86400, 0 }, { day * 86400, 0 } };
+        utimensat(AT_FDCWD, name, times, 0);
+    }
+    fclose(fopen("./testarchive/notes.txt", "w"));
+    {
+        LogArchiver archiver;
+        archiver.Start(dir, "./testarchive/2022_12_06.log", true, 3, 0);
+        LogArchiver::Stats stats;
+        for(int i = 0; i < 500; i++) {
+            stats = archiver.GetStats();
+            if(stats.pending == 0 && stats.compressed + stats.removed == 5) { break; }
+            usleep(10000);
+        }
+        assert(stats.failed == 0 && stats.files == 3 && stats.bytesOut * 10 < stats.bytesIn);
+    }
+    /* 最旧的两个被删掉，正在写的文件和别的文件不动 */
+    assert(access("./testarchive/2022_12_01.log", F_OK) != 0 && access("./testarchive/2022_12_02.log.gz", F_OK) != 0);
+    assert(access("./testarchive/2022_12_06.log", F_OK) == 0 && access("./testarchive/notes.txt", F_OK) == 0);
+    gzFile gz = gzopen("./testarchive/2022_12_05.log.gz", "rb");
+    char buf[256];
+    int lines = 0;
+    while(gzgets(gz, buf, sizeof(buf))) { lines++; }
+    gzclose(gz);
+    assert(lines == 1000);
+}
+
+void TestMetrics() {
+    Metrics metrics;
+    Metrics::Counter* ok = metrics.AddCounter("test_requests_total", "Requests.", "code=\"2xx\"");
+    Metrics::Counter* bad = metrics.AddCounter("test_requests_total", "Requests.", "code=\"4xx\"");
+    Metrics::Histogram* hist = metrics.AddHistogram("test_seconds", "Latency.", { 0.5, 1 });
+    int depth = 7;
+    metrics.AddGauge("test_depth", "Depth.", [&depth] { return depth; });
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 8; t++) {
+        threads.emplace_back([=] {
+            for(int i = 0; i < 10000; i++) {
+                ok->Inc();
+                hist->Observe(i % 4 == 0 ? 0.5 : 2);
+            }
+            bad->Inc(t);
+        });
+    }
+    for(auto& th : threads) { th.join(); }
+    assert(ok->Value() == 80000 && bad->Value() == 28);
+    std::string text = metrics.Render();
+    /* 同名的放在一起，直方图的桶是累计的，le取小于等于 */
+    assert(text.find("# TYPE test_requests_total counter\ntest_requests_total{code=\"2xx\"} 80000\n"
+                     "test_requests_total{code=\"4xx\"} 28\n") != std::string::npos);
+    assert(text.find("test_seconds_bucket{le=\"0.5\"} 20000\ntest_seconds_bucket{le=\"1\"} 20000\n"
+                     "test_seconds_bucket{le=\"+Inf\"} 80000\ntest_seconds_sum 130000\ntest_seconds_count 80000\n") != std::string::npos);
+    assert(text.find("# TYPE test_depth gauge\ntest_depth 7\n") != std::string::npos);
+    /* 只读之后不加锁抓取，结果不变 */
+    metrics.Seal();
+    assert(metrics.Render() == text);
 }
 
 void ThreadLogTask(int i, int cnt) {
@@ -49,7 +189,386 @@ void TestThreadPool() {
     getchar();
 }
 
+void TestHeapTimer() {
+    HeapTimer timer;
+    std::vector<int> fired;
+    for(int i = 0; i < 1000; i++) {
+        int id = (i * 7919) % 1000;
+        timer.add(id, 1000 + (i * 31) % 500, [&fired, id] { fired.push_back(id); });
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        timer.adjust(i, 50000);
+    }
+    timer.doWork(1);
+    assert(fired.size() == 1 && fired[0] == 1);
+    timer.tick();
+    assert(fired.size() == 1);
+    while(timer.GetNextTick() > 0 && timer.GetNextTick() < 2000) {
+        usleep(10 * 1000);
+    }
+    /* 没被调整过的定时器全部到期，调整过的还在堆中 */
+    assert(fired.size() == 1000 - 334);
+    for(int id : fired) { assert(id % 3 != 0); }
+    assert(timer.size() == 334 && timer.expired() == 1000 - 335);
+    timer.clear();
+    assert(timer.GetNextTick() == -1 && timer.size() == 0);
+}
+
+void TestMpmcQueue() {
+    MpmcQueue<Task> que(1024);
+    std::atomic<long> sum(0);
+    std::atomic<int> popped(0);
+    std::vector<std::thread> threads;
+    for(int p = 0; p < 4; p++) {
+        threads.emplace_back([&que, &sum, p] {
+            for(int i = 0; i < 100000; i++) {
+                long v = p * 100000 + i;
+                Task task([&sum, v] { sum += v; });
+                while(!que.TryPush(std::move(task))) { std::this_thread::yield(); }
+            }
+        });
+    }
+    for(int c = 0; c < 4; c++) {
+        threads.emplace_back([&que, &popped] {
+            Task task;
+            while(popped < 400000) {
+                if(que.TryPop(task)) { task(); task.reset(); popped++; }
+                else { std::this_thread::yield(); }
+            }
+        });
+    }
+    for(auto& t : threads) { t.join(); }
+    assert(sum == 400000L * 399999 / 2 && que.empty());
+}
+
+void TestAdaptiveThreadPool() {
+    ThreadPool threadpool(1);
+    threadpool.EnableAdaptive(4, 10, 200);
+    std::atomic<int> done(0);
+    for(int i = 0; i < 8; i++) {
+        threadpool.AddTask([&done] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));   // 模拟阻塞在数据库上的任务
+            done++;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    assert(threadpool.GetStats().threads > 1);
+    while(done < 8) { std::this_thread::sleep_for(std::chrono::milliseconds(10)); }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    ThreadPool::Stats stats = threadpool.GetStats();
+    assert(stats.threads == 1 && stats.grows > 0 && stats.shrinks == stats.grows);
+}
+
+CoTask<int> CoAdd(CoLoop& loop, ThreadPool& pool, int a, int b) {
+    int sum = 0;
+    bool ok = co_await loop.Offload(pool, [&sum, a, b] { sum = a + b; });  // 在线程池中计算，回到事件循环继续
+    co_return ok ? sum : -1;
+}
+
+CoDetached CoEcho(CoLoop& loop, ThreadPool& pool, int fd, std::vector<int>& steps) {
+    char c = 0;
+    auto readOne = [fd, &c](int* err) {
+        ssize_t n = read(fd, &c, 1);
+        if(n < 0) { *err = errno; }
+        return n;
+    };
+    CoLoop::IoResult res = co_await loop.Read(fd, EPOLLONESHOT, 1000, readOne);
+    assert(res.n == 1);
+    steps.push_back(c);
+    steps.push_back(co_await CoAdd(loop, pool, c, 1));
+    res = co_await loop.Write(fd, EPOLLONESHOT, 1000, [fd](int* err) {     // 可写，不挂起
+        ssize_t n = write(fd, "b", 1);
+        if(n < 0) { *err = errno; }
+        return n;
+    });
+    steps.push_back(res.n);
+    res = co_await loop.Read(fd, EPOLLONESHOT, 50, readOne);
+    steps.push_back(res.err);                                               // 没有数据，超时
+    uint32_t events = co_await loop.WaitEvent(fd, EPOLLIN | EPOLLONESHOT, 50);
+    steps.push_back(events);                                                // 超时结果为0
+}
+
+void TestCoLoop() {
+    Epoller epoller;
+    HeapTimer timer;
+    CoLoop loop(&epoller, &timer);
+    ThreadPool pool(2);
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    epoller.AddFd(fds[0], EPOLLONESHOT);
+    std::vector<int> steps;
+    CoEcho(loop, pool, fds[0], steps);
+    assert(steps.empty());
+    assert(write(fds[1], "a", 1) == 1);
+    while(true) {
+        int timeMs = timer.GetNextTick();               // 到期的定时器在这里恢复协程
+        if(steps.size() == 5) { break; }
+        int n = epoller.Wait(timeMs);
+        for(int i = 0; i < n; i++) {
+            loop.OnEvent(epoller.GetEventFd(i), epoller.GetEvents(i));
+        }
+    }
+    assert(steps[0] == 'a' && steps[1] == 'a' + 1 && steps[2] == 1 && steps[3] == ETIMEDOUT && steps[4] == 0);
+    char c = 0;
+    assert(read(fds[1], &c, 1) == 1 && c == 'b');
+    close(fds[0]);
+    close(fds[1]);
+    /* 空闲帧的缓存有上限，多出来的还给malloc */
+    std::vector<void*> frames;
+    for(size_t i = 0; i < FramePool::MAX_CACHED_BYTES / 512 * 2; i++) { frames.push_back(FramePool::Alloc(500)); }
+    for(void* frame : frames) { FramePool::Free(frame, 500); }
+    assert(FramePool::CachedBytes() <= FramePool::MAX_CACHED_BYTES);
+}
+
+/* 模拟的MySQL服务器：握手、mysql_native_password认证、按用户名查询和插入user表 */
+static bool MockRecv(int fd, std::string& payload) {
+    unsigned char head[4];
+    if(recv(fd, head, 4, MSG_WAITALL) != 4) { return false; }
+    payload.resize(head[0] | (head[1] << 8) | (head[2] << 16));
+    return payload.empty() || recv(fd, &payload[0], payload.size(), MSG_WAITALL) == (ssize_t)payload.size();
+}
+
+static void MockSend(int fd, uint8_t seq, const std::string& payload) {
+    std::string packet(4, '\0');
+    packet[0] = payload.size() & 0xff;
+    packet[1] = (payload.size() >> 8) & 0xff;
+    packet[2] = (payload.size() >> 16) & 0xff;
+    packet[3] = seq;
+    packet += payload;
+    assert(send(fd, packet.data(), packet.size(), MSG_NOSIGNAL) == (ssize_t)packet.size());
+}
+
+static std::string MockLenenc(const std::string& str) {
+    return std::string(1, static_cast<char>(str.size())) + str;
+}
+
+static void MockMysqlConn(int fd, std::map<std::string, std::string>* users, std::mutex* mtx) {
+    const std::string salt = "abcdefgh12345678ijkl";
+    std::string hello("\x0a" "5.7.0-mock\0" "\x01\0\0\0", 16);
+    hello += salt.substr(0, 8);
+    hello += std::string("\0\xff\xff\x2d\x02\0\xff\xff\x15", 9) + std::string(10, '\0');
+    hello += salt.substr(8) + std::string("\0mysql_native_password\0", 23);
+    MockSend(fd, 0, hello);
+    std::string payload;
+    if(!MockRecv(fd, payload)) {                            // 客户端在握手中途关闭
+        close(fd);
+        return;
+    }
+    size_t off = 4 + 4 + 1 + 23;
+    std::string user(payload.c_str() + off);
+    off += user.size() + 1;
+    std::string auth = payload.substr(off + 1, static_cast<uint8_t>(payload[off]));
+    if(user != "root" || auth != AsyncSqlPool::NativePassword("root", salt)) {
+        MockSend(fd, 2, std::string("\xff\x15\x04#28000Access denied", 22));
+        close(fd);
+        return;
+    }
+    MockSend(fd, 2, std::string("\0\0\0\x02\0\0\0", 7));
+    const std::string eof("\xfe\0\0\x02\0", 5);
+    while(MockRecv(fd, payload) && payload[0] == 0x03) {
+        std::string sql = payload.substr(1);
+        if(sql == "DO SLEEP(10)") { continue; }                 // 不回应，测试查询期限
+        size_t l = sql.find('\''), r = sql.find('\'', l + 1);
+        std::string name = sql.substr(l + 1, r - l - 1);
+        std::lock_guard<std::mutex> locker(*mtx);
+        if(sql.compare(0, 6, "SELECT") == 0) {
+            uint8_t seq = 1;
+            MockSend(fd, seq++, "\x02");
+            MockSend(fd, seq++, MockLenenc("def") + MockLenenc("username"));
+            MockSend(fd, seq++, MockLenenc("def") + MockLenenc("password"));
+            MockSend(fd, seq++, eof);
+            if(users->count(name)) { MockSend(fd, seq++, MockLenenc(name) + MockLenenc((*users)[name])); }
+            MockSend(fd, seq++, eof);
+        } else if(sql.compare(0, 6, "INSERT") == 0) {
+            size_t pl = sql.find('\'', r + 1), pr = sql.find('\'', pl + 1);
+            (*users)[name] = sql.substr(pl + 1, pr - pl - 1);
+            MockSend(fd, 1, std::string("\0\x01\0\x02\0\0\0", 7));
+        } else {
+            MockSend(fd, 1, std::string("\xff\x28\x04#42000syntax error", 21));
+        }
+    }
+    close(fd);
+}
+
+void TestAsyncSqlPool() {
+    assert(Sha1("abc") == std::string("\xa9\x99\x3e\x36\x47\x06\x81\x6a\xba\x3e"
+                                      "\x25\x71\x78\x50\xc2\x6c\x9c\xd0\xd8\x9d", 20));
+    assert(AsyncSqlPool::Escape("a'b\\c") == "a\\'b\\\\c");
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(listenFd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(listenFd, 16) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(listenFd, (sockaddr*)&addr, &len);
+    std::map<std::string, std::string> users;
+    std::mutex mtx;
+    std::thread([listenFd, &users, &mtx] {
+        int fd;
+        while((fd = accept(listenFd, nullptr, nullptr)) >= 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // 结果集分几个包发，不等延迟确认
+            std::thread(MockMysqlConn, fd, &users, &mtx).detach();
+        }
+    }).detach();
+
+    Epoller epoller;
+    AsyncSqlPool pool(&epoller, 256, 500);
+    bool inited = pool.Init("127.0.0.1", ntohs(addr.sin_port), "root", "root", "webserver", 4);
+    assert(inited);
+    auto runUntil = [&epoller, &pool](std::function<bool()> cond) {
+        while(!cond()) {
+            int ms = pool.Tick();
+            int n = epoller.Wait(ms < 0 || ms > 100 ? 100 : ms);
+            for(int i = 0; i < n; i++) { pool.OnEvent(epoller.GetEventFd(i), epoller.GetEvents(i)); }
+        }
+    };
+    int ok = 0, fail = 0;
+    HttpRequest::AsyncUserVerify(pool, "alice", "123", false, [&](bool r) { r ? ok++ : fail++; });
+    runUntil([&] { return ok + fail == 1 && pool.ReadyCount() == 4; });
+    assert(ok == 1 && users["alice"] == "123" && pool.ReadyCount() == 4);
+    /* 从另一个线程提交，大量登录同时在途 */
+    std::thread([&pool, &ok, &fail] {
+        for(int i = 0; i < 200; i++) {
+            HttpRequest::AsyncUserVerify(pool, i % 4 ? "alice" : "bob", "123", true, [&](bool r) { r ? ok++ : fail++; });
+        }
+    }).join();
+    HttpRequest::AsyncUserVerify(pool, "alice", "456", false, [&](bool r) { r ? ok++ : fail++; });
+    runUntil([&] { return ok + fail == 202; });
+    assert(ok == 151 && fail == 51 && pool.Outstanding() == 0);
+    bool failed = false;
+    pool.Query("DROP TABLE user", [&](const SqlResult& res) { failed = !res.ok && res.error == "syntax error"; });
+    runUntil([&] { return pool.Outstanding() == 0; });
+    assert(failed);
+    /* 服务器不回应的查询到期失败，连接关掉重连后还能用 */
+    std::string error;
+    pool.Query("DO SLEEP(10)", [&](const SqlResult& res) { error = res.error; });
+    runUntil([&] { return pool.Outstanding() == 0; });
+    assert(error == "query timeout");
+    HttpRequest::AsyncUserVerify(pool, "alice", "123", true, [&](bool r) { r ? ok++ : fail++; });
+    runUntil([&] { return pool.Outstanding() == 0; });
+    assert(ok == 152);
+    shutdown(listenFd, SHUT_RDWR);
+    close(listenFd);
+}
+
+void TestUserCache() {
+    UserCache cache;
+    assert(cache.Check("alice", "123") == UserCache::MISS);     // 没开启
+    cache.Init(4, 100, 50, 1);
+    cache.Put("alice", "123");
+    cache.PutUnknown("bob");
+    assert(cache.Check("alice", "123") == UserCache::MATCH);
+    assert(cache.Check("alice", "456") == UserCache::MISMATCH);
+    assert(cache.Check("bob", "123") == UserCache::UNKNOWN_USER);
+    cache.Invalidate("bob");
+    assert(cache.Check("bob", "123") == UserCache::MISS);
+    /* 超过上限淘汰最久没用的 */
+    cache.Put("u1", "1");
+    cache.Put("u2", "2");
+    cache.Put("u3", "3");
+    assert(cache.Check("u1", "1") == UserCache::MATCH);
+    cache.Put("u4", "4");
+    assert(cache.Check("alice", "123") == UserCache::MISS && cache.Check("u1", "1") == UserCache::MATCH);
+    /* 负缓存先过期，正向条目后过期 */
+    cache.PutUnknown("carol");
+    usleep(60 * 1000);
+    assert(cache.Check("carol", "") == UserCache::MISS && cache.Check("u1", "1") == UserCache::MATCH);
+    usleep(60 * 1000);
+    assert(cache.Check("u4", "4") == UserCache::MISS);
+    UserCache::Stats stats = cache.GetStats();
+    assert(stats.hits == 5 && stats.negativeHits == 1 && stats.misses == 4);
+    /* 注册成功写入后，注册前发出的查询才回来写的负缓存不会盖掉新用户 */
+    cache.PutUnknown("dave");
+    cache.Put("dave", "1");
+    cache.PutUnknown("dave");
+    assert(cache.Check("dave", "1") == UserCache::MATCH);
+}
+
+void TestBloomFilter() {
+    BloomFilter filter(16 * 1024, 0.01);
+    assert(filter.HashCount() == 7 && filter.Capacity() > 10000);
+    for(int i = 0; i < 10000; i++) { filter.Add("user" + std::to_string(i)); }
+    for(int i = 0; i < 10000; i++) { assert(filter.MayContain("user" + std::to_string(i))); }   // 没有漏判
+    int falsePositive = 0;
+    for(int i = 0; i < 100000; i++) { falsePositive += filter.MayContain("guest" + std::to_string(i)); }
+    assert(falsePositive < 2000);                               // 误判率在目标附近
+}
+
+void TestLocalUserStore() {
+    const char* path = "./testlog_users.db";
+    unlink(path);
+    {
+        LocalUserStore store;
+        bool ok = store.Init(path, 1);
+        assert(ok);
+        std::vector<std::thread> threads;
+        for(int i = 0; i < 8; i++) {                            // 并发注册，同一批共用一次刷盘
+            threads.emplace_back([&store, i] {
+                UserStore::RESULT res = store.Insert("user" + std::to_string(i), "pwd" + std::to_string(i));
+                assert(res == UserStore::OK);
+            });
+        }
+        for(auto& t : threads) { t.join(); }
+        UserStore::RESULT res = store.Insert("user0", "x");
+        assert(res == UserStore::EXISTS);
+        std::string pwd;
+        res = store.Lookup("user3", &pwd);
+        assert(res == UserStore::OK && pwd == "pwd3");
+        res = store.Lookup("nobody", &pwd);
+        assert(res == UserStore::NOT_FOUND);
+    }
+    /* 模拟写到一半崩溃：尾部追加半条记录 */
+    int fd = open(path, O_WRONLY | O_APPEND);
+    ssize_t written = write(fd, "\x12\x34\x56\x78\x05\x00", 6);
+    assert(written == 6);
+    close(fd);
+    {
+        LocalUserStore store;
+        bool ok = store.Init(path, 0);
+        assert(ok && store.Size() == 8);
+        std::string pwd;
+        UserStore::RESULT res = store.Lookup("user7", &pwd);
+        assert(res == UserStore::OK && pwd == "pwd7");
+        res = store.Insert("user8", "pwd8");
+        assert(res == UserStore::OK);
+    }
+    {
+        /* 刷盘之前登录查不到新用户，同名的注册返回EXISTS */
+        LocalUserStore store;
+        bool ok = store.Init(path, 200);
+        assert(ok);
+        std::thread t([&store] {
+            UserStore::RESULT res = store.Insert("user9", "pwd9");
+            assert(res == UserStore::OK);
+        });
+        usleep(50 * 1000);
+        std::string pwd;
+        UserStore::RESULT found = store.Lookup("user9", &pwd);
+        UserStore::RESULT res = store.Insert("user9", "x");
+        assert(found == UserStore::NOT_FOUND && res == UserStore::EXISTS);
+        t.join();
+        res = store.Lookup("user9", &pwd);
+        assert(res == UserStore::OK && pwd == "pwd9");
+    }
+    LocalUserStore store;
+    bool ok = store.Init(path, -1);
+    assert(ok && store.Size() == 10);
+    unlink(path);
+}
+
 int main() {
+    TestLocalUserStore();
+    TestBloomFilter();
+    TestUserCache();
+    TestAsyncSqlPool();
+    TestCoLoop();
+    TestAdaptiveThreadPool();
+    TestMpmcQueue();
+    TestHeapTimer();
+    TestMetrics();
     TestLog();
+    TestAccessLog();
+    TestLogArchiver();
     TestThreadPool();
 }
\ No newline at end of file
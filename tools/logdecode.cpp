@@ -0,0 +1,240 @@
+/*
+    Author       : liudou
+    Date         : 2022-12-24
+*/
+// 把二进制日志解码成和文本日志相同的格式：./logdecode log/2022_12_24.bin [更多文件...] > 2022_12_24.log
+// 轮换后压缩过的.bin.gz文件也可以直接解码
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <unordered_map>
+#include <zlib.h>
+#include "../code/log/log.h"
+
+using namespace std;
+
+struct Format {                                             // 一个调用点的格式描述
+    string file;
+    int line;
+    string format;
+    string types;                                           // 每个参数一个类型码
+};
+
+static const char* LevelTitle(int level) {
+    switch(level) {
+    case 0: return "[debug]: ";
+    case 1: return "[info] : ";
+    case 2: return "[warn] : ";
+    case 3: return "[error]: ";
+    default: return "[info] : ";
+    }
+}
+
+static void PrintPrefix(int64_t us, int level) {
+    time_t sec = us / 1000000;
+    struct tm t;
+    localtime_r(&sec, &t);
+    printf("%d-%02d-%02d %02d:%02d:%02d.%06ld %s", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+           t.tm_hour, t.tm_min, t.tm_sec, (long)(us % 1000000), LevelTitle(level));
+}
+
+// 按类型码从记录里取出的一个参数
+struct Arg {
+    char type;                                              // 0表示记录被截断，参数缺失
+    long long i;
+    unsigned long long u;
+    double f;
+    string s;
+};
+
+static Arg NextArg(const Format& fmt, size_t idx, const char*& p, const char* end) {
+    Arg arg = { 0, 0, 0, 0, "" };
+    if(idx >= fmt.types.size()) { return arg; }
+    char type = fmt.types[idx];
+    if(type == 's') {
+        uint16_t len;
+        if(end - p < 2) { return arg; }
+        memcpy(&len, p, 2);
+        if(end - p - 2 < len) { return arg; }
+        arg.s.assign(p + 2, len);
+        p += 2 + len;
+    } else if(type == 'i' || type == 'u') {
+        if(end - p < 4) { return arg; }
+        int32_t i;
+        uint32_t u;
+        memcpy(&i, p, 4);
+        memcpy(&u, p, 4);
+        arg.i = i;
+        arg.u = u;
+        p += 4;
+    } else {
+        if(end - p < 8) { return arg; }
+        int64_t i;
+        uint64_t u;
+        memcpy(&i, p, 8);
+        memcpy(&u, p, 8);
+        memcpy(&arg.f, p, 8);
+        arg.i = i;
+        arg.u = u;
+        p += 8;
+    }
+    arg.type = type;
+    return arg;
+}
+
+// 逐个转换说明符格式化：去掉原来的长度修饰，按记录里参数的实际类型重新拼一个说明符交给snprintf
+static string Render(const Format& fmt, const char* p, const char* end) {
+    string out;
+    char buf[4096];
+    size_t argIdx = 0;
+    const string& f = fmt.format;
+    for(size_t i = 0; i < f.size(); i++) {
+        if(f[i] != '%') {
+            out += f[i];
+            continue;
+        }
+        if(i + 1 < f.size() && f[i + 1] == '%') {
+            out += '%';
+            i++;
+            continue;
+        }
+        string spec = "%";
+        size_t j = i + 1;
+        while(j < f.size() && strchr("-+ #0", f[j])) { spec += f[j++]; }
+        for(int part = 0; part < 2; part++) {
+            if(part == 1) {
+                if(j >= f.size() || f[j] != '.') { break; }
+                spec += f[j++];
+            }
+            if(j < f.size() && f[j] == '*') {
+                /* 宽度或精度来自参数 */
+                Arg arg = NextArg(fmt, argIdx++, p, end);
+                spec += to_string(arg.type == 'u' || arg.type == 'L' ? (long long)arg.u : arg.i);
+                j++;
+            }
+            while(j < f.size() && f[j] >= '0' && f[j] <= '9') { spec += f[j++]; }
+        }
+        while(j < f.size() && strchr("hlLqjzt", f[j])) { j++; }
+        if(j >= f.size()) {
+            out += f.substr(i);
+            break;
+        }
+        char conv = f[j];
+        i = j;
+        Arg arg = NextArg(fmt, argIdx++, p, end);
+        if(arg.type == 0) {
+            out += "?";
+            continue;
+        }
+        if(strchr("eEfFgGaA", conv)) {
+            double v = arg.type == 'f' ? arg.f : (arg.type == 'i' || arg.type == 'l' ? (double)arg.i : (double)arg.u);
+            snprintf(buf, sizeof(buf), (spec + conv).c_str(), v);
+        } else if(conv == 's') {
+            string v = arg.type == 's' ? arg.s : (arg.type == 'f' ? to_string(arg.f) :
+                       (arg.type == 'i' || arg.type == 'l' ? to_string(arg.i) : to_string(arg.u)));
+            snprintf(buf, sizeof(buf), (spec + 's').c_str(), v.c_str());
+        } else if(arg.type == 's') {
+            snprintf(buf, sizeof(buf), "%s", arg.s.c_str());
+        } else if(conv == 'p') {
+            snprintf(buf, sizeof(buf), (spec + 'p').c_str(), (void*)(uintptr_t)arg.u);
+        } else if(conv == 'c') {
+            snprintf(buf, sizeof(buf), (spec + 'c').c_str(), (int)arg.i);
+        } else if(strchr("di", conv)) {
+            long long v = arg.type == 'f' ? (long long)arg.f : (arg.type == 'i' || arg.type == 'l' ? arg.i : (long long)arg.u);
+            snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(), v);
+        } else {
+            unsigned long long v = arg.type == 'f' ? (unsigned long long)arg.f :
+                                   (arg.type == 'i' ? (unsigned long long)(unsigned int)arg.i : arg.u);
+            snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(), v);
+        }
+        out += buf;
+    }
+    return out;
+}
+
+static bool Decode(gzFile fp, const char* name) {
+    unordered_map<uint32_t, Format> formats;
+    string data;
+    char buf[65536];
+    int n;
+    while((n = gzread(fp, buf, sizeof(buf))) > 0) { data.append(buf, n); }
+
+    size_t pos = 0;
+    while(pos < data.size()) {
+        if(data.size() - pos >= (size_t)Log::BIN_MAGIC_LEN &&
+           memcmp(data.data() + pos, Log::BIN_MAGIC, Log::BIN_MAGIC_LEN) == 0) {
+            formats.clear();                // 每次打开文件重新登记
+            pos += Log::BIN_MAGIC_LEN;
+            continue;
+        }
+        uint32_t len;
+        if(data.size() - pos < 5) { break; }
+        memcpy(&len, data.data() + pos, 4);
+        if(len == 0 || data.size() - pos - 4 < len) { break; }
+        const char* p = data.data() + pos + 4;
+        const char* end = p + len;
+        char kind = *p++;
+        pos += 4 + len;
+
+        if(kind == Log::BIN_FORMAT && end - p >= 8) {
+            uint32_t id;
+            int32_t line;
+            memcpy(&id, p, 4);
+            memcpy(&line, p + 4, 4);
+            p += 8;
+            Format fmt;
+            fmt.line = line;
+            fmt.file = string(p, strnlen(p, end - p));
+            p += fmt.file.size() + 1;
+            if(p < end) { fmt.format = string(p, strnlen(p, end - p)); p += fmt.format.size() + 1; }
+            if(p < end) { fmt.types = string(p, strnlen(p, end - p)); }
+            formats[id] = fmt;
+        } else if(kind == Log::BIN_RECORD && end - p >= 13) {
+            uint32_t id;
+            int64_t us;
+            memcpy(&id, p, 4);
+            memcpy(&us, p + 4, 8);
+            int level = p[12];
+            p += 13;
+            PrintPrefix(us, level);
+            auto it = formats.find(id);
+            if(it == formats.end()) { printf("<unknown format %u>\n", id); }
+            else { printf("%s\n", Render(it->second, p, end).c_str()); }
+        } else if(kind == Log::BIN_TEXT && end - p >= 9) {
+            int64_t us;
+            memcpy(&us, p, 8);
+            PrintPrefix(us, p[8]);
+            fwrite(p + 9, 1, end - p - 9, stdout);
+            putchar('\n');
+        } else {
+            fprintf(stderr, "%s: bad record at offset %zu\n", name, pos - 4 - len);
+            return false;
+        }
+    }
+    if(pos < data.size()) {
+        /* 进程退出时最后一批可能只写了一部分 */
+        fprintf(stderr, "%s: %zu trailing bytes ignored\n", name, data.size() - pos);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s file.bin [file.bin ...]\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for(int i = 1; i < argc; i++) {
+        gzFile fp = gzopen(argv[i], "rb");     // 不是gzip格式时按原样读
+        if(!fp) {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        if(!Decode(fp, argv[i])) { ret = 1; }
+        gzclose(fp);
+    }
+    return ret;
+}